@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_ALGO_LZ4_H
+#define _KERNEL_ALGO_LZ4_H
+
+#include <libkern/types.h>
+
+#define LZ4_HASH_BITS (12)
+#define LZ4_MAX_INPUT_SIZE (65536) // Positions of the hash table are 16 bits.
+
+// The hash table is given by a caller, it's too big for a kernel stack.
+struct lz4_wrkmem {
+    uint16_t table[1 << LZ4_HASH_BITS];
+};
+typedef struct lz4_wrkmem lz4_wrkmem_t;
+
+/**
+ * Compresses data to the LZ4 block format. A greedy matcher with one
+ * candidate per hash is used, it's fast and good enough for memory pages.
+ *
+ * @return The size of compressed data, or -ENOSPC if it does not fit dst.
+ */
+int lz4_compress(const void* src, size_t src_len, void* dst, size_t dst_cap, lz4_wrkmem_t* wrkmem);
+int lz4_decompress(const void* src, size_t src_len, void* dst, size_t dst_cap);
+
+#endif // _KERNEL_ALGO_LZ4_H
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_ALGO_RBTREE_H
+#define _KERNEL_ALGO_RBTREE_H
+
+#include <libkern/types.h>
+
+/**
+ * Intrusive red-black tree: nodes are embedded into the structs they order,
+ * so the tree never allocates memory and could be used by the scheduler.
+ *
+ * A tree could be augmented: every node keeps data derived from its subtree
+ * (e.g. the largest gap between memzones), which is recomputed by the
+ * augment callback from the node and its children whenever they change.
+ */
+
+enum RB_COLORS {
+    RB_RED,
+    RB_BLACK,
+};
+
+struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    int color;
+};
+typedef struct rb_node rb_node_t;
+
+typedef void (*rb_augment_t)(rb_node_t* node);
+
+struct rb_tree {
+    rb_node_t* root;
+    rb_node_t* leftmost;
+    rb_augment_t augment;
+};
+typedef struct rb_tree rb_tree_t;
+
+typedef bool (*rb_less_t)(rb_node_t* a, rb_node_t* b);
+
+#define rb_entry(ptr, type, member) ((type*)((uintptr_t)(ptr)-__builtin_offsetof(type, member)))
+
+static inline void rb_tree_init(rb_tree_t* tree)
+{
+    tree->root = NULL;
+    tree->leftmost = NULL;
+    tree->augment = NULL;
+}
+
+static inline void rb_tree_init_augmented(rb_tree_t* tree, rb_augment_t augment)
+{
+    rb_tree_init(tree);
+    tree->augment = augment;
+}
+
+static inline rb_node_t* rb_first(rb_tree_t* tree) { return tree->leftmost; }
+static inline bool rb_empty(rb_tree_t* tree) { return !tree->root; }
+
+// Equal nodes are inserted after the existing ones.
+void rb_insert(rb_tree_t* tree, rb_node_t* node, rb_less_t less);
+void rb_erase(rb_tree_t* tree, rb_node_t* node);
+rb_node_t* rb_next(rb_node_t* node);
+rb_node_t* rb_prev(rb_node_t* node);
+rb_node_t* rb_last(rb_tree_t* tree);
+
+// Recomputes augmented data of the node and its ancestors after the node was changed in place.
+void rb_augment_propagate(rb_tree_t* tree, rb_node_t* node);
+
+#endif // _KERNEL_ALGO_RBTREE_H
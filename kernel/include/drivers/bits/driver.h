@@ -91,6 +91,7 @@ enum DRIVER_FILE_SYSTEM_OPERTAION {
     DRIVER_FILE_SYSTEM_FCHMOD,
     DRIVER_FILE_SYSTEM_IOCTL,
     DRIVER_FILE_SYSTEM_MMAP,
+    DRIVER_FILE_SYSTEM_WAIT_QUEUE,
 };
 
 enum DRIVER_RTC_OPERTAION {
@@ -18,6 +18,12 @@ enum GICDControlMasks {
     MASKDEFINE(GICD_ENABLE, 0, 1),
 };
 
+enum GICDSgirMasks {
+    MASKDEFINE(GICD_SGIR_INTID, 0, 4),
+    MASKDEFINE(GICD_SGIR_NSATT, 15, 1),
+    MASKDEFINE(GICD_SGIR_TARGET_LIST, 16, 8),
+};
+
 enum GICCControlMasks {
     MASKDEFINE(GICC_ENABLE_GR1, 0, 1),
     MASKDEFINE(GICC_FIQ_BYP_DIS_GR1, 5, 1),
@@ -49,6 +55,8 @@ struct gicv2_distributor_registers {
     uint32_t itargetsr[64];
     SKIP(0x8FC + 0x4, 0xC00);
     uint32_t icfgr[16];
+    SKIP(0xC3C + 0x4, 0xF00);
+    uint32_t sgir;
     // TO BE CONTINUED
 };
 typedef struct gicv2_distributor_registers gicv2_distributor_registers_t;
@@ -73,5 +81,6 @@ void gicv2_install();
 void gicv2_install_secondary_cpu();
 uint32_t gicv2_interrupt_descriptor();
 void gicv2_end(uint32_t int_disc);
+void gicv2_send_ipi(ipi_t ipi, int cpu_mask);
 
 #endif //_KERNEL_DRIVERS_IRQ_ARM_GICV2_H
@@ -23,6 +23,13 @@ typedef int irq_line_t;
 typedef uint8_t irq_priority_t;
 typedef void (*irq_handler_t)();
 
+// Inter-processor interrupts, irqdevs map them to their own lines.
+typedef int ipi_t;
+enum IPI_TYPES {
+    IPI_RESCHED, // The cpu got new threads to run.
+    IPI_TIMER, // The boot cpu got a closer timeout (see clockevent.c).
+};
+
 // Currently flags maps to devtree irq_flags.
 // Later we might need to enhance irq_flags_from_devtree() to use as translator.
 #define IRQ_FLAG_EDGE_TRIGGERED (1 << 0)
@@ -31,6 +38,7 @@ struct irqdev_descritptor {
     uint32_t (*interrupt_descriptor)();
     void (*end_interrupt)(uint32_t int_desc);
     void (*enable_irq)(irq_line_t line, irq_priority_t prior, irq_flags_t type, int cpu_mask);
+    void (*send_ipi)(ipi_t ipi, int cpu_mask);
 };
 typedef struct irqdev_descritptor irqdev_descritptor_t;
 
@@ -39,5 +47,7 @@ static inline irq_flags_t irq_flags_from_devtree(uint32_t devtree_irq_flags) { r
 void irq_register_handler(irq_line_t line, irq_priority_t prior, irq_flags_t flags, irq_handler_t func, int cpu_mask);
 void irq_set_dev(irqdev_descritptor_t irqdev_desc);
 irq_line_t irqline_from_id(int id);
+void irq_register_ipi_handler(ipi_t ipi, irq_handler_t func);
+void irq_send_ipi(ipi_t ipi, int cpu_mask);
 
 #endif
\ No newline at end of file
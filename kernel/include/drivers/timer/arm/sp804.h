@@ -15,6 +15,7 @@
 #include <time/time_manager.h>
 
 #define SP804_CLK_HZ 1000000
+#define SP804_MIN_CYCLES 10
 
 // https://developer.arm.com/documentation/ddi0271/d/programmer-s-model/register-descriptions/control-register--timerxcontrol?lang=en
 enum SP804ControlMasks {
@@ -13,6 +13,15 @@
 #include <time/time_manager.h>
 
 #define PIT_BASE_FREQ 1193180
+#define PIT_MIN_CYCLES 12 // About 10us.
+
+#define PIT_CH0_PORT 0x40
+#define PIT_COMMAND_PORT 0x43
+
+// Channel 0, lobyte/hibyte access, mode 0 (interrupt on terminal count).
+#define PIT_CH0_ONE_SHOT 0b00110000
+#define PIT_READ_BACK_CH0 0b11000010 // Latches both the status and the count.
+#define PIT_STATUS_OUTPUT (1 << 7)
 
 void pit_setup();
 void pit_handler();
@@ -14,6 +14,7 @@
 #include <fs/ext2/ext2.h>
 #include <libkern/lock.h>
 #include <libkern/syscall_structs.h>
+#include <tasking/wait_queue.h>
 
 #define DENTRY_WAS_IN_CACHE 0
 #define DENTRY_NEWLY_ALLOCATED 1
@@ -88,6 +89,7 @@ struct file_descriptor;
 struct file_ops {
     bool (*can_read)(struct file* file, size_t start);
     bool (*can_write)(struct file* file, size_t start);
+    struct wait_queue* (*wait_queue)(struct file* file); // Notified when can_read/can_write could change.
     int (*read)(struct file* file, void __user* buf, size_t start, size_t len);
     int (*write)(struct file* file, void __user* buf, size_t start, size_t len);
     int (*truncate)(struct file* file, size_t len);
@@ -167,6 +169,7 @@ struct socket {
     int protocol;
     mode_t mode;
     sync_ringbuffer_t buffer;
+    wait_queue_t wait_queue;
     file_t* bind_file;
     spinlock_t lock;
 };
@@ -228,6 +231,7 @@ static inline socket_t* file_socket_assert(file_t* file)
     ASSERT(file->type == FTYPE_SOCKET);
     return file->socket;
 }
+void file_init_cache();
 file_t* file_init_pseudo_dentry(dentry_t* pseudo_dentry);
 file_t* file_init_socket(socket_t* socket, file_ops_t* ops);
 file_t* file_init_path(const path_t* path);
@@ -266,6 +270,7 @@ int vfs_open(const path_t* path, file_descriptor_t* fd, int flags);
 int vfs_close(file_descriptor_t* fd);
 bool vfs_can_read(file_descriptor_t* fd);
 bool vfs_can_write(file_descriptor_t* fd);
+wait_queue_t* vfs_wait_queue(file_descriptor_t* fd);
 int vfs_read(file_descriptor_t* fd, void __user* buf, size_t len);
 int vfs_write(file_descriptor_t* fd, void __user* buf, size_t len);
 int vfs_mkdir(const path_t* path, const char* name, size_t len, mode_t mode, uid_t uid, gid_t gid);
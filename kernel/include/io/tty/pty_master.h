@@ -19,6 +19,7 @@
 struct pty_slave_entry;
 struct pty_master_entry {
     sync_ringbuffer_t buffer;
+    wait_queue_t wait_queue;
     struct pty_slave_entry* pts;
     dentry_t dentry;
 };
@@ -12,6 +12,7 @@
 #include <algo/sync_ringbuffer.h>
 #include <fs/vfs.h>
 #include <libkern/types.h>
+#include <tasking/wait_queue.h>
 
 #define TTY_MAX_COUNT 8
 #define TTY_BUFFER_SIZE 1024
@@ -78,6 +79,7 @@ typedef struct termios termios_t;
 
 struct tty_entry {
     sync_ringbuffer_t buffer;
+    wait_queue_t wait_queue; // Notified when the buffer is changed.
     int line_count;
     gid_t pgid;
     termios_t termios;
@@ -16,5 +16,8 @@
 #define atomic_add(x, val) (__atomic_add_fetch(x, val, __ATOMIC_SEQ_CST))
 #define atomic_store(x, val) (__atomic_store_n(x, val, __ATOMIC_SEQ_CST))
 #define atomic_load(x) (__atomic_load_n(x, __ATOMIC_SEQ_CST))
+#define atomic_exchange(x, val) (__atomic_exchange_n(x, val, __ATOMIC_SEQ_CST))
+// On failure the expected value is updated with the current one.
+#define atomic_compare_exchange(x, expected, val) (__atomic_compare_exchange_n(x, expected, val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
 
 #endif // _KERNEL_LIBKERN_LOCK_H
\ No newline at end of file
@@ -757,6 +757,7 @@ enum __sysid {
     SYS_PTHREAD_CREATE,
     SYS_MMAP,
     SYS_WAITPID,
+    SYS_ALARM,
 };
 #elif __aarch64__
 enum __sysid {
@@ -1121,6 +1122,7 @@ enum __sysid {
     SYS_PTHREAD_CREATE,
     SYS_MMAP,
     SYS_WAITPID,
+    SYS_ALARM,
 };
 #endif
 
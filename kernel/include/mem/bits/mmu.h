@@ -21,6 +21,7 @@ enum MMU_FLAGS {
     MMU_FLAG_COW = (1 << 6), // TODO: Remove this flag.
     MMU_FLAG_DEVICE = MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE | MMU_FLAG_UNCACHED,
     MMU_FLAG_HUGE_PAGE = (1 << 7),
+    MMU_FLAG_GLOBAL = (1 << 8), // The translation is the same in all address spaces, so it's not tagged with an ASID.
 };
 typedef uint32_t mmu_flags_t;
 
@@ -14,6 +14,8 @@
 
 #define KMALLOC_SPACE_SIZE (4 * MB)
 #define KMALLOC_BLOCK_SIZE 32
+#define KMALLOC_CLASSES_COUNT 10
+#define KMALLOC_MAX_CLASS_SIZE 512
 
 void kmalloc_init();
 void* kmalloc(size_t size);
@@ -9,12 +9,18 @@
 #ifndef _KERNEL_MEM_MEMZONE_H
 #define _KERNEL_MEM_MEMZONE_H
 
-#include <algo/dynamic_array.h>
+#include <algo/rbtree.h>
 #include <fs/vfs.h>
 #include <libkern/types.h>
 #include <mem/bits/zone.h>
 
 struct vm_ops;
+
+/**
+ * Zones of an address space are kept in a red-black tree ordered by vaddr.
+ * Every node is augmented with the largest gap of free space in its subtree,
+ * so both the lookup and the search for a free range take O(log n).
+ */
 struct memzone {
     uintptr_t vaddr;
     size_t len;
@@ -24,17 +30,25 @@ struct memzone {
     off_t file_offset;
     size_t file_size;
     struct vm_ops* ops;
+
+    rb_node_t node;
+    size_t gap; // Free space between the previous zone and this one.
+    size_t subtree_gap;
 };
 typedef struct memzone memzone_t;
 
 struct vm_address_space;
+void memzone_init_cache();
+void memzone_init_zones(struct vm_address_space* vm_aspace);
+void memzone_free_all(struct vm_address_space* vm_aspace);
+
 memzone_t* memzone_new(struct vm_address_space* vm_aspace, size_t start, size_t len);
 memzone_t* memzone_new_random(struct vm_address_space* vm_aspace, size_t len);
 memzone_t* memzone_new_random_backward(struct vm_address_space* vm_aspace, size_t len);
 memzone_t* memzone_find(struct vm_address_space* vm_aspace, size_t addr);
-memzone_t* memzone_find_no_proc(dynamic_array_t* zones, size_t addr);
+memzone_t* memzone_find_no_proc(rb_tree_t* zones, size_t addr);
 memzone_t* memzone_split(struct vm_address_space* vm_aspace, memzone_t* zone, uintptr_t addr);
-int memzone_free_no_proc(dynamic_array_t*, memzone_t*);
+int memzone_free_no_proc(rb_tree_t*, memzone_t*);
 int memzone_free(struct vm_address_space* vm_aspace, memzone_t*);
 
 int memzone_copy(struct vm_address_space* to_vm_aspace, struct vm_address_space* from_vm_aspace);
@@ -5,6 +5,58 @@
 #include <libkern/types.h>
 #include <mem/boot.h>
 #include <platform/generic/pmm/settings.h>
+#include <platform/generic/vmm/consts.h>
+
+// Free blocks are kept in lists of 2^order blocks, up to 4MB with 4KB blocks.
+#define PMM_MAX_ORDER 10
+#define PMM_FRAME_NONE (0xffffffff)
+#define PMM_FRAME_USED (0xff)
+
+// Reclaim is woken up when less than 1/8 of blocks is free and goes on until 1/4 is free.
+#define PMM_LOW_WATERMARK_DIV 8
+#define PMM_HIGH_WATERMARK_DIV 4
+
+/**
+ * Per-block data of the buddy allocator. Only the first block of a free
+ * chunk has its order set, the rest are marked as used.
+ */
+struct pmm_frame {
+    uint32_t next; // Links of the free list, PMM_FRAME_NONE ends it.
+    uint32_t prev;
+    uint32_t shares; // Owners besides the first one, e.g. pages shared after fork.
+    uint8_t order;
+};
+typedef struct pmm_frame pmm_frame_t;
+
+struct pmm_buddy {
+    bool ready;
+    pmm_frame_t* frames;
+    uint32_t free_lists[PMM_MAX_ORDER + 1];
+    size_t free_counts[PMM_MAX_ORDER + 1];
+};
+typedef struct pmm_buddy pmm_buddy_t;
+
+/**
+ * Every cpu keeps a stack of free page-sized chunks, so most page
+ * allocations do not take the global lock. It's refilled and drained
+ * in batches, the coldest chunks are drained first.
+ */
+#define PMM_PCP_BLOCKS (VMM_PAGE_SIZE / PMM_BLOCK_SIZE)
+#define PMM_PCP_SIZE 64
+#define PMM_PCP_BATCH 16
+
+struct pmm_pcp {
+    uint32_t blocks[PMM_PCP_SIZE];
+    uint32_t count;
+
+    /* Stat */
+    uint32_t stat_hits;
+    uint32_t stat_misses;
+    uint32_t stat_frees;
+    uint32_t stat_refills;
+    uint32_t stat_drains;
+};
+typedef struct pmm_pcp pmm_pcp_t;
 
 struct pmm_state {
     size_t kernel_va_base;
@@ -18,15 +70,28 @@ struct pmm_state {
 
     size_t max_blocks;
     size_t used_blocks;
+    size_t low_watermark; // In free blocks.
+    size_t high_watermark;
+
+    // The MAT serves early boot, the buddy allocator takes over once the
+    // kernel address space is set up. The MAT is still kept in sync.
+    pmm_buddy_t buddy;
 };
 typedef struct pmm_state pmm_state_t;
 
+typedef void (*pmm_low_memory_handler_t)();
+
 void pmm_setup(boot_args_t* boot_args);
+void pmm_setup_buddy();
 
 void* pmm_alloc(size_t size);
 void* pmm_alloc_aligned(size_t size, size_t alignment);
 int pmm_free(void* ptr, size_t size);
 
+void pmm_ref(void* block);
+bool pmm_unref(void* block);
+uint32_t pmm_refs(void* block);
+
 size_t pmm_get_ram_size();
 size_t pmm_get_max_blocks();
 size_t pmm_get_used_blocks();
@@ -34,6 +99,10 @@ size_t pmm_get_free_blocks();
 size_t pmm_get_block_size();
 size_t pmm_get_ram_in_kb();
 size_t pmm_get_free_space_in_kb();
+bool pmm_is_below_low_watermark();
+bool pmm_is_above_high_watermark();
+void pmm_set_low_memory_handler(pmm_low_memory_handler_t handler);
+const pmm_pcp_t* pmm_get_pcp(int cpu_id);
 const pmm_state_t* pmm_get_state();
 const boot_args_t* boot_args();
 
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_MEM_SLAB_H
+#define _KERNEL_MEM_SLAB_H
+
+#include <libkern/libkern.h>
+#include <libkern/lock.h>
+#include <libkern/types.h>
+#include <platform/generic/cpu.h>
+
+#define KMEM_SLAB_SPACE_SIZE (4 * MB)
+#define KMEM_SLAB_SIZE (4096)
+#define KMEM_CPU_CACHE_SIZE 32
+#define KMEM_CPU_CACHE_BATCH 16
+
+struct kmem_cache;
+
+/**
+ * Slab is a KMEM_SLAB_SIZE aligned chunk of the slab zone, the header is
+ * placed at its start and is followed by objects of one cache. Free objects
+ * are linked through their first word.
+ */
+struct kmem_slab {
+    struct kmem_cache* cache;
+    struct kmem_slab* prev;
+    struct kmem_slab* next;
+    void* freelist;
+    uint32_t inuse;
+};
+typedef struct kmem_slab kmem_slab_t;
+
+struct kmem_cpu_cache {
+    void* objs[KMEM_CPU_CACHE_SIZE];
+    uint32_t count;
+};
+typedef struct kmem_cpu_cache kmem_cpu_cache_t;
+
+/**
+ * Cache of objects of the same size. Every cpu keeps a stack of free
+ * objects, which is refilled from and drained to slabs in batches, so
+ * most allocations do not take the cache lock.
+ */
+struct kmem_cache {
+    const char* name;
+    size_t obj_size;
+    size_t slot_size; // Object size with KASAN redzone, aligned to 8 bytes.
+    size_t objs_offset;
+    size_t objs_per_slab;
+
+    spinlock_t lock;
+    kmem_slab_t* partial; // Slabs with free objects.
+    kmem_cpu_cache_t cpus[MAX_CPU_CNT];
+
+    /* Stat */
+    uint32_t stat_slabs;
+};
+typedef struct kmem_cache kmem_cache_t;
+
+void kmem_slab_init();
+void kmem_cache_init(kmem_cache_t* cache, const char* name, size_t size);
+kmem_cache_t* kmem_cache_create(const char* name, size_t size);
+
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void* kmem_cache_alloc_sized(kmem_cache_t* cache, size_t size);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+kmem_cache_t* kmem_cache_of(void* ptr);
+
+#endif // _KERNEL_MEM_SLAB_H
@@ -12,12 +12,47 @@
 #include <libkern/libkern.h>
 #include <mem/bits/mmu.h>
 #include <mem/bits/swap.h>
+#include <mem/kmemzone.h>
 #include <platform/generic/vmm/consts.h>
 
+// The swapfile never grows beyond this, freed slots are reused.
+#define SWAPFILE_MAX_SLOTS (16384)
+#define SWAPFILE_BATCH_PAGES (16)
+#define SWAPFILE_WRITEBACK_BATCHES (2)
+#define SWAPFILE_READAHEAD_PAGES (8)
+
+enum SWAPFILE_BATCH_STATES {
+    SWAPFILE_BATCH_FREE,
+    SWAPFILE_BATCH_FILLING,
+    SWAPFILE_BATCH_WRITEBACK,
+};
+
+/**
+ * Pages which are swapped out are copied to a batch and their frames are
+ * freed at once. A full batch is written by kswapflusherd, runs of
+ * consecutive slots go in one write. Until then the batch serves loads
+ * of its slots.
+ */
+struct swapfile_batch {
+    int state;
+    uint32_t seq; // Batches are written in the order they were submitted.
+    kmemzone_t buf;
+    int slots[SWAPFILE_BATCH_PAGES];
+    int count;
+};
+typedef struct swapfile_batch swapfile_batch_t;
+
 int swapfile_init();
 int swapfile_new_ref(int id);
 int swapfile_rem_ref(int id);
 int swapfile_load(uintptr_t vaddr, int id);
 int swapfile_store(uintptr_t vaddr);
 
+void swapfile_begin_batch();
+void swapfile_submit_batch();
+void kswapflusherd();
+
+size_t swapfile_get_total_in_kb();
+size_t swapfile_get_free_in_kb();
+
 #endif // _KERNEL_MEM_SWAPFILE_H
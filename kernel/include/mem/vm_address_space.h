@@ -9,20 +9,29 @@
 #ifndef _KERNEL_MEM_VM_ADDRESS_SPACE_H
 #define _KERNEL_MEM_VM_ADDRESS_SPACE_H
 
-#include <algo/dynamic_array.h>
+#include <algo/rbtree.h>
 #include <libkern/libkern.h>
 #include <libkern/lock.h>
 #include <mem/bits/vm.h>
 
+struct memzone;
 struct vm_address_space {
     ptable_t* pdir;
-    dynamic_array_t zones;
+    rb_tree_t zones;
+    struct memzone* last_zone; // Faults tend to hit the zone which was found last.
     int count;
     spinlock_t lock;
+    size_t lru_pages; // Pages on the LRU owned by this address space, guarded by the LRU lock.
+
+    // Guarded by the ASID lock, see vm_asid.c.
+    int asid;
+    uint32_t asid_generation; // The ASID is valid only while its generation is current.
+    uint32_t asid_cpus; // Cpus which could hold entries of the ASID.
 };
 typedef struct vm_address_space vm_address_space_t;
 
 vm_address_space_t* vm_address_space_alloc();
+bool vm_address_space_try_get(vm_address_space_t* aspace);
 int vm_address_space_free(vm_address_space_t* old);
 
 #endif // _KERNEL_MEM_VM_ADDRESS_SPACE_H
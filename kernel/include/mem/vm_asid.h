@@ -0,0 +1,24 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_MEM_VM_ASID_H
+#define _KERNEL_MEM_VM_ASID_H
+
+#include <libkern/types.h>
+#include <mem/vm_address_space.h>
+
+/**
+ * Address space identifiers (PCIDs on x86_64, ASIDs on arm) tag TLB entries,
+ * so a switch does not flush entries of other address spaces. Platforms
+ * which can't tag entries fall back to flushing on every switch.
+ */
+void vm_asid_init();
+void vm_asid_setup_secondary_cpu();
+void vm_asid_switch(vm_address_space_t* vm_aspace, uintptr_t pdir0, uintptr_t pdir1);
+
+#endif // _KERNEL_MEM_VM_ASID_H
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_MEM_VM_KMAP_H
+#define _KERNEL_MEM_VM_KMAP_H
+
+#include <libkern/types.h>
+
+enum VM_KMAP_SLOTS {
+    VM_KMAP_SLOT_SRC,
+    VM_KMAP_SLOT_DST,
+    VM_KMAP_SLOTS_PER_CPU,
+};
+
+/**
+ * Every cpu owns a few windows in kernel space, which are reserved at
+ * init. A frame is mapped to a window of the current cpu for a short
+ * access, so no zone has to be allocated and only the local TLB entry is
+ * flushed. Interrupts are disabled while a window is mapped. Frames are
+ * taken from the direct map instead where the platform has one.
+ */
+void vm_kmap_init();
+void* vm_kmap_atomic(uintptr_t paddr, int slot);
+void vm_kunmap_atomic(void* ptr, int slot);
+
+void vm_kmap_copy_frame(uintptr_t dst_paddr, uintptr_t src_paddr);
+void vm_kmap_zero_frame(uintptr_t paddr);
+
+#endif // _KERNEL_MEM_VM_KMAP_H
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_MEM_VM_LRU_H
+#define _KERNEL_MEM_VM_LRU_H
+
+#include <libkern/types.h>
+#include <mem/memzone.h>
+#include <mem/vm_address_space.h>
+
+#define VM_LRU_NONE_PAGE (0xffffffff)
+
+enum VM_LRU_LISTS {
+    VM_LRU_NONE,
+    VM_LRU_ACTIVE,
+    VM_LRU_INACTIVE,
+    VM_LRU_ISOLATED, // Taken by kswapd, it's put back or dropped later.
+};
+
+/**
+ * Per-page data of the LRU. Only private pages which are mapped by one
+ * address space are kept in lists, so the owner is enough to find the
+ * page table entry.
+ */
+struct vm_lru_page {
+    uint32_t next;
+    uint32_t prev;
+    uint32_t list;
+    vm_address_space_t* aspace;
+    uintptr_t vaddr;
+};
+typedef struct vm_lru_page vm_lru_page_t;
+
+struct vm_lru_victim {
+    uintptr_t paddr;
+    vm_address_space_t* aspace; // Referenced, released with vm_address_space_free().
+    uintptr_t vaddr;
+};
+typedef struct vm_lru_victim vm_lru_victim_t;
+
+/**
+ * User pages are kept in two lists. New and recently accessed pages are
+ * on the active one, kswapd moves pages which were not accessed since its
+ * last pass to the inactive one and reclaims from its tail.
+ */
+void vm_lru_init();
+void vm_lru_add(uintptr_t paddr, vm_address_space_t* aspace, uintptr_t vaddr);
+void vm_lru_add_mapped_page(memzone_t* zone, uintptr_t vaddr);
+void vm_lru_del(uintptr_t paddr);
+void vm_lru_forget_address_space(vm_address_space_t* aspace);
+
+bool vm_lru_isolate(int list, vm_lru_victim_t* victim);
+void vm_lru_putback(uintptr_t paddr, int list);
+size_t vm_lru_count(int list);
+
+#endif // _KERNEL_MEM_VM_LRU_H
@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_MEM_VM_ZERO_H
+#define _KERNEL_MEM_VM_ZERO_H
+
+#include <libkern/types.h>
+
+#define VM_ZERO_POOL_SIZE 32
+#define VM_ZERO_POOL_LOW 8
+
+/**
+ * Anonymous pages are mapped to one shared read-only zero page until they
+ * are written to. Frames for the first write are taken from a pool which
+ * kzerod keeps filled with zeroed pages, so faults skip clearing the page.
+ */
+void vm_zero_init();
+uintptr_t vm_zero_page_paddr();
+bool vm_is_zero_page_paddr(uintptr_t paddr);
+uintptr_t vm_zero_pool_take();
+
+void kzerod();
+
+#endif // _KERNEL_MEM_VM_ZERO_H
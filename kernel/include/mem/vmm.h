@@ -49,7 +49,8 @@ int vmm_map_page(uintptr_t vaddr, uintptr_t paddr, mmu_flags_t mmu_flags);
 int vmm_map_pages(uintptr_t vaddr, uintptr_t paddr, size_t n_pages, mmu_flags_t mmu_flags);
 int vmm_unmap_page(uintptr_t vaddr);
 int vmm_unmap_pages(uintptr_t vaddr, size_t n_pages);
-int vmm_swap_page(ptable_entity_t* page_desc, struct memzone* zone, uintptr_t vaddr);
+int vmm_swap_page_locked(ptable_entity_t* page_desc, struct memzone* zone, uintptr_t vaddr);
+bool vmm_is_page_dirty(uintptr_t vaddr);
 
 int vmm_map_page_locked(uintptr_t vaddr, uintptr_t paddr, mmu_flags_t mmu_flags);
 int vmm_map_pages_locked(uintptr_t vaddr, uintptr_t paddr, size_t n_pages, mmu_flags_t mmu_flags);
@@ -60,6 +61,8 @@ vm_address_space_t* vmm_new_address_space();
 vm_address_space_t* vmm_new_forked_address_space();
 
 bool vmm_is_copy_on_write(uintptr_t vaddr);
+bool vmm_is_page_copy_on_write(uintptr_t vaddr);
+int vmm_resolve_page_copy_on_write(uintptr_t vaddr);
 
 void vmm_ensure_writing_to_active_address_space(uintptr_t dest_vaddr, size_t length);
 void vmm_ensure_reading_from_active_address_space(uintptr_t dest_vaddr, size_t length);
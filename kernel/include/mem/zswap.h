@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_MEM_ZSWAP_H
+#define _KERNEL_MEM_ZSWAP_H
+
+#ifdef ZSWAP_ENABLED
+
+#include <libkern/types.h>
+
+#define ZSWAP_MAX_POOL_PERCENT (20) // Of RAM, the pool does not grow beyond this.
+#define ZSWAP_MAX_POOL_PAGES (1024)
+#define ZSWAP_CHUNKS_PER_PAGE (64) // Used chunks of a pool page are tracked with one 64-bit mask.
+
+/**
+ * Compressed cache in front of the swapfile. Swapped out pages are kept
+ * compressed in a pool of memory pages, which are split into chunks. Once
+ * the pool is full, its objects are written back to the swapfile to make
+ * room. The cache is keyed by swapfile slots and guarded by the swapfile
+ * lock.
+ */
+int zswap_init();
+int zswap_store(int slot, const void* page);
+int zswap_load(int slot, void* page);
+bool zswap_contains(int slot);
+void zswap_invalidate(int slot);
+int zswap_writeback(void* page);
+
+size_t zswap_get_pool_in_kb();
+size_t zswap_get_stored_in_kb();
+size_t zswap_get_hits();
+size_t zswap_get_misses();
+
+#endif
+
+#endif // _KERNEL_MEM_ZSWAP_H
@@ -82,6 +82,51 @@ inline static void system_set_pdir(uintptr_t pdir0, uintptr_t pdir1)
     system_flush_whole_tlb();
 }
 
+inline static void system_set_asid(int asid)
+{
+    asm volatile("mcr p15, 0, %0, c13, c0, 1"
+                 :
+                 : "r"(asid)
+                 : "memory");
+    system_instruction_barrier();
+}
+
+// ASIDs are 8 bits long, ASID 0 is reserved for switches.
+inline static int system_setup_asids()
+{
+    system_set_asid(0);
+    return 256;
+}
+
+/**
+ * @brief Switches the table and the ASID. The reserved ASID is set while
+ *        TTBR0 changes, so no entries of the new table are cached with the
+ *        old ASID and vice versa (ARM ARM B3.10.4).
+ */
+inline static void system_set_pdir_asid(uintptr_t pdir0, uintptr_t pdir1, int asid, bool flush)
+{
+    system_data_synchronise_barrier();
+    system_set_asid(0);
+    asm volatile("mcr p15, 0, %0, c2, c0, 0"
+                 :
+                 : "r"(pdir0)
+                 : "memory");
+    system_instruction_barrier();
+    if (flush) {
+        asm volatile("mcr p15, 0, %0, c8, c7, 2"
+                     :
+                     : "r"(asid)
+                     : "memory");
+        system_data_synchronise_barrier();
+    }
+    system_set_asid(asid);
+}
+
+inline static void system_flush_tlb_all_asids()
+{
+    system_flush_whole_tlb();
+}
+
 inline static void system_enable_write_protect()
 {
 }
@@ -33,5 +33,8 @@ uintptr_t vm_ptable_entity_get_frame(ptable_entity_t* entity, ptable_lv_t lv);
 ptable_state_t vm_ptable_entity_state(ptable_entity_t* entity, ptable_lv_t lv);
 bool vm_ptable_entity_is_present(ptable_entity_t* entity, ptable_lv_t lv);
 bool vm_ptable_entity_is_only_allocated(ptable_entity_t* entity, ptable_lv_t lv);
+bool vm_ptable_entity_test_and_clear_accessed(ptable_entity_t* entity, ptable_lv_t lv);
+bool vm_ptable_entity_is_dirty(ptable_entity_t* entity, ptable_lv_t lv);
+void vm_ptable_entity_clear_dirty(ptable_entity_t* entity, ptable_lv_t lv);
 
 #endif // _KERNEL_PLATFORM_ARM32_VMM_MMU_H
\ No newline at end of file
@@ -75,6 +75,43 @@ inline static void system_flush_whole_tlb()
     asm volatile("dsb sy");
 }
 
+// ASIDs are taken from TTBR0 and are 8 bits long, as TCR_EL1 is set up by the prekernel.
+inline static int system_setup_asids()
+{
+    return 256;
+}
+
+/**
+ * @brief Switches the user table with its ASID in one write. The kernel
+ *        table is shared by all address spaces and is not reloaded. The
+ *        instruction cache is still invalidated as system_set_pdir does.
+ */
+inline static void system_set_pdir_asid(uintptr_t pdir0, uintptr_t pdir1, int asid, bool flush)
+{
+    uint64_t ttbr0 = pdir0 | ((uint64_t)asid << 48);
+    asm volatile("dsb ish");
+    if (flush) {
+        asm volatile("tlbi aside1, %0"
+                     :
+                     : "r"((uint64_t)asid << 48)
+                     : "memory");
+        asm volatile("dsb ish");
+    }
+    asm volatile("msr ttbr0_el1, %0"
+                 :
+                 : "r"(ttbr0)
+                 : "memory");
+    asm volatile("isb");
+    asm volatile("ic iallu");
+    asm volatile("dsb sy");
+    asm volatile("isb");
+}
+
+inline static void system_flush_tlb_all_asids()
+{
+    system_flush_whole_tlb();
+}
+
 inline static void system_enable_write_protect()
 {
 }
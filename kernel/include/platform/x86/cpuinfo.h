@@ -27,6 +27,8 @@ enum CPUFEAT_FLAGS {
     CPUFEAT_XSAVE = (1 << 10),
     CPUFEAT_AVX = (1 << 11),
     CPUFEAT_PDPE1GB = (1 << 12),
+    CPUFEAT_PGE = (1 << 13),
+    CPUFEAT_PCID = (1 << 14),
 };
 
 void cpuinfo_init();
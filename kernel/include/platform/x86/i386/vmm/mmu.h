@@ -14,6 +14,10 @@
 #include <platform/x86/i386/vmm/pde.h>
 #include <platform/x86/i386/vmm/pte.h>
 
+// Directory entries have their own write permission, so ptables shared
+// after fork are write-protected without touching their pages.
+#define TABLE_LEVEL_WRITE_PROTECTION
+
 typedef uint32_t ptable_entity_t;
 typedef uint32_t arch_pf_info_t;
 
@@ -33,5 +37,8 @@ uintptr_t vm_ptable_entity_get_frame(ptable_entity_t* entity, ptable_lv_t lv);
 ptable_state_t vm_ptable_entity_state(ptable_entity_t* entity, ptable_lv_t lv);
 bool vm_ptable_entity_is_present(ptable_entity_t* entity, ptable_lv_t lv);
 bool vm_ptable_entity_is_only_allocated(ptable_entity_t* entity, ptable_lv_t lv);
+bool vm_ptable_entity_test_and_clear_accessed(ptable_entity_t* entity, ptable_lv_t lv);
+bool vm_ptable_entity_is_dirty(ptable_entity_t* entity, ptable_lv_t lv);
+void vm_ptable_entity_clear_dirty(ptable_entity_t* entity, ptable_lv_t lv);
 
 #endif // _KERNEL_PLATFORM_X86_I386_VMM_MMU_H
\ No newline at end of file
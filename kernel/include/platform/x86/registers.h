@@ -70,4 +70,20 @@ static inline void write_cr0(uintptr_t val)
                  : "memory");
 }
 
+static inline uintptr_t read_cr4()
+{
+    uintptr_t val;
+    asm volatile("mov %%cr4, %0"
+                 : "=r"(val));
+    return val;
+}
+
+static inline void write_cr4(uintptr_t val)
+{
+    asm volatile("mov %0, %%cr4"
+                 :
+                 : "r"(val)
+                 : "memory");
+}
+
 #endif /* _KERNEL_PLATFORM_X86_REGISTERS_H */
\ No newline at end of file
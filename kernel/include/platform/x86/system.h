@@ -47,10 +47,10 @@ inline static void system_flush_all_cpus_tlb_entry(uintptr_t vaddr)
     // TODO: Send inter-processor messages.
 }
 
-inline static void system_flush_whole_tlb()
-{
-    system_set_pdir(read_cr3(), 0x0);
-}
+void system_flush_whole_tlb();
+int system_setup_asids();
+void system_set_pdir_asid(uintptr_t pdir0, uintptr_t pdir1, int asid, bool flush);
+void system_flush_tlb_all_asids();
 
 inline static void system_enable_write_protect()
 {
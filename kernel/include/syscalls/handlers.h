@@ -24,6 +24,7 @@ void sys_handler(trapframe_t* tf);
 void sys_restart_syscall(trapframe_t* tf);
 void sys_exit(trapframe_t* tf);
 void sys_fork(trapframe_t* tf);
+void sys_vfork(trapframe_t* tf);
 void sys_read(trapframe_t* tf);
 void sys_write(trapframe_t* tf);
 void sys_open(trapframe_t* tf);
@@ -66,9 +67,16 @@ void sys_select(trapframe_t* tf);
 void sys_fstat(trapframe_t* tf);
 void sys_fsync(trapframe_t* tf);
 void sys_sched_yield(trapframe_t* tf);
+void sys_sched_setparam(trapframe_t* tf);
+void sys_sched_getparam(trapframe_t* tf);
+void sys_sched_setscheduler(trapframe_t* tf);
+void sys_sched_getscheduler(trapframe_t* tf);
+void sys_sched_setaffinity(trapframe_t* tf);
+void sys_sched_getaffinity(trapframe_t* tf);
 void sys_uname(trapframe_t* tf);
 void sys_clock_settime(trapframe_t* tf);
 void sys_clock_gettime(trapframe_t* tf);
+void sys_alarm(trapframe_t* tf);
 void sys_clock_getres(trapframe_t* tf);
 void sys_nice(trapframe_t* tf);
 void sys_shbuf_create(trapframe_t* tf);
@@ -9,6 +9,11 @@
 #ifndef _KERNEL_TASKING_BITS_SCHED_H
 #define _KERNEL_TASKING_BITS_SCHED_H
 
+#include <algo/rbtree.h>
+#include <libkern/bits/sched.h>
+#include <libkern/lock.h>
+#include <libkern/types.h>
+
 #define MAX_PRIO 0
 #define MIN_PRIO 11
 #define IDLE_PRIO (MIN_PRIO + 1)
@@ -17,6 +22,26 @@
 #define DEFAULT_PRIO 6
 #define SCHED_INT 10
 #define LAST_CPU_NOT_SET 0xffff
+#define SCHED_RT_PRIOS_COUNT (SCHED_RT_PRIO_MAX - SCHED_RT_PRIO_MIN + 1)
+#define SCHED_CPU_MASK_ALL (0xffffffff)
+
+/**
+ * Classes are listed from the most important one, a thread of a class is
+ * always picked before threads of the following ones. The idle thread
+ * belongs to the prio class.
+ */
+enum SCHED_CLASSES {
+    SCHED_CLASS_RT, // SCHED_FIFO and SCHED_RR threads, ordered by their rt prio.
+    SCHED_CLASS_FAIR, // Ordered by virtual runtime, which grows slower for higher prios.
+    SCHED_CLASS_PRIO, // Round-robin over prio runqueues with fixed timeslices.
+};
+
+// #define SCHED_FAIR_BY_DEFAULT
+#ifdef SCHED_FAIR_BY_DEFAULT
+#define SCHED_DEFAULT_CLASS SCHED_CLASS_FAIR
+#else
+#define SCHED_DEFAULT_CLASS SCHED_CLASS_PRIO
+#endif
 
 struct thread;
 
@@ -26,11 +51,28 @@ struct runqueue {
 };
 typedef struct runqueue runqueue_t;
 
+/**
+ * Runqueues of a cpu. Threads are taken from the master buffer and put back
+ * into the slave one, buffers are swapped when the master one is empty.
+ * Bit i of a prios mask is set when the runqueue with prio i is not empty,
+ * so the next thread is found in constant time.
+ */
 struct sched_data {
-    int next_read_prio;
+    spinlock_t lock;
     runqueue_t* master_buf;
     runqueue_t* slave_buf;
+    uint32_t master_buf_prios;
+    uint32_t slave_buf_prios;
     int enqueued_tasks;
+
+    rb_tree_t fair_tree;
+    uint64_t fair_min_vruntime;
+    int fair_enqueued_tasks;
+
+    // Bit i is set when rt_queues[i] is not empty, the queue of
+    // SCHED_RT_PRIO_MAX comes first.
+    runqueue_t rt_queues[SCHED_RT_PRIOS_COUNT];
+    uint32_t rt_prios;
 };
 typedef struct sched_data sched_data_t;
 
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_TASKING_PID_HASH_H
+#define _KERNEL_TASKING_PID_HASH_H
+
+#include <libkern/types.h>
+
+// Ids are allocated sequentially, so the low bits spread them evenly.
+#define PID_HASH_BUCKETS 1024
+
+struct proc;
+struct thread;
+
+/**
+ * Pid and tid indexes, so lookups do not walk the whole thread storage.
+ * Entries are linked through pid_hash_next/tid_hash_next and are kept
+ * while the id is valid: from setup till the slot is freed or evicted.
+ */
+void pid_hash_add_proc(struct proc* p);
+void pid_hash_remove_proc(struct proc* p);
+struct proc* pid_hash_find_proc(pid_t pid);
+
+void pid_hash_add_thread(struct thread* thread);
+void pid_hash_remove_thread(struct thread* thread);
+struct thread* pid_hash_find_thread(pid_t tid);
+
+#endif // _KERNEL_TASKING_PID_HASH_H
@@ -19,6 +19,7 @@
 #include <mem/memzone.h>
 #include <mem/vm_address_space.h>
 #include <mem/vmm.h>
+#include <time/timer.h>
 
 #define MAX_PROCESS_COUNT 1024
 #define MAX_OPENED_FILES 16
@@ -40,7 +41,11 @@ struct proc {
     pid_t pid;
     pid_t ppid;
     pid_t pgid;
+    struct proc* pid_hash_next;
     uint32_t prio;
+    int sched_class;
+    int sched_policy;
+    int rt_prio;
     uint32_t status;
     struct thread* main_thread;
 
@@ -58,6 +63,9 @@ struct proc {
     file_descriptor_t* fds;
 
     int exit_code;
+    struct proc* reap_next; // Linked into the reaper list while dying.
+    struct thread* vfork_parent; // Set while the address space of the parent is borrowed.
+    timer_t alarm_timer;
 
     bool is_kthread;
 
@@ -96,8 +104,10 @@ int kthread_fill_up_stack(struct thread* thread, void* data);
 
 int proc_load(proc_t* p, struct thread* main_thread, const char* path);
 int proc_fork_from(proc_t* new_proc, struct thread* from_thread);
+int proc_vfork_from(proc_t* new_proc, struct thread* from_thread);
 
 int proc_die(proc_t* p, int exit_code);
+void proc_alarm_expired(timer_t* timer);
 int proc_block_all_threads(proc_t* p, const struct blocker* blocker);
 
 /**
@@ -18,9 +18,13 @@ void scheduler_init();
 void schedule_activate_cpu();
 void resched_dont_save_context();
 void resched();
+void sched_yield();
 void sched();
 void sched_enqueue(thread_t* thread);
 void sched_dequeue(thread_t* thread);
+void sched_set_inherited_prio(thread_t* thread, int rt_prio);
+int sched_setscheduler(proc_t* p, int policy, int rt_prio);
+int sched_setaffinity(thread_t* thread, uint32_t mask);
 size_t active_cpu_count();
 
 static inline void sched_tick()
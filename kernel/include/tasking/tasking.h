@@ -28,6 +28,7 @@
 extern proc_t proc[MAX_PROCESS_COUNT];
 
 proc_t* tasking_get_proc(pid_t pid);
+thread_t* tasking_get_thread(pid_t tid);
 
 /**
  * CPU FUNCTIONS
@@ -48,7 +49,8 @@ proc_t* tasking_run_kernel_thread(void* entry_point, void* data);
  */
 
 void tasking_init();
-void tasking_kill_dying();
+void tasking_queue_dying(proc_t* p);
+void kreaperd();
 bool tasking_should_become_zombie(proc_t* p);
 void tasking_evict_proc_entry(proc_t* p);
 void tasking_evict_zombies_waiting_for(proc_t* p);
@@ -60,6 +62,8 @@ pid_t tasking_get_proc_count();
  */
 
 void tasking_fork();
+void tasking_vfork();
+void tasking_vfork_release(proc_t* p);
 int tasking_exec(const char __user* path, const char __user** argv, const char __user** env);
 void tasking_exit(int exit_code);
 int tasking_waitpid(int pid, int* status, int options);
@@ -9,6 +9,7 @@
 #ifndef _KERNEL_TASKING_THREAD_H
 #define _KERNEL_TASKING_THREAD_H
 
+#include <algo/rbtree.h>
 #include <fs/vfs.h>
 #include <libkern/lock.h>
 #include <libkern/types.h>
@@ -16,7 +17,9 @@
 #include <platform/generic/tasking/context.h>
 #include <platform/generic/tasking/trapframe.h>
 #include <tasking/signal.h>
+#include <tasking/wait_queue.h>
 #include <time/time_manager.h>
+#include <time/timer.h>
 
 enum THREAD_STATUS {
     THREAD_STATUS_INVALID = 0,
@@ -44,6 +47,7 @@ enum BLOCKER_REASON {
     BLOCKER_SELECT,
     BLOCKER_DUMPING,
     BLOCKER_STOP, // Just waiting for signal which will continue the thread.
+    BLOCKER_WAIT_QUEUE,
 };
 
 struct blocker_join {
@@ -62,6 +66,9 @@ struct blocker_sleep {
 };
 typedef struct blocker_sleep blocker_sleep_t;
 
+// select() could wait for all opened files at once.
+#define BLOCKER_MAX_WAIT_QUEUES 16
+
 struct blocker_select {
     int nfds;
     fd_set_t readfds;
@@ -77,6 +84,7 @@ struct proc;
 struct thread {
     struct proc* process;
     pid_t tid;
+    struct thread* tid_hash_next;
     uint32_t status;
 
     /* Kernel data */
@@ -88,12 +96,23 @@ struct thread {
     /* Scheduler data */
     struct thread* sched_prev;
     struct thread* sched_next;
+    struct runqueue* runqueue; // The runqueue the thread is linked into.
+    rb_node_t fair_node;
+    bool in_fair_tree;
+    uint64_t vruntime;
+    int inherited_rt_prio; // See sched_set_inherited_prio().
     int last_cpu;
+    uint32_t cpu_mask; // Cpus the thread is allowed to run on.
     time_t ticks_until_preemption;
     time_t start_time_in_ticks; // Time when the task was put to run.
 
     /* Blocker data */
     blocker_t blocker;
+    wait_queue_entry_t wait_entries[BLOCKER_MAX_WAIT_QUEUES];
+    size_t wait_entries_count;
+    timer_t timeout_timer;
+    wait_queue_t join_wait_queue; // Notified when the thread dies.
+    bool vfork_waiting; // A vfork() child borrows the address space.
     union {
         blocker_join_t join;
         blocker_rw_t rw;
@@ -155,11 +174,16 @@ static ALWAYS_INLINE int thread_is_alive(thread_t* thread) { return !thread_is_f
 
 int thread_init_blocker(thread_t* thread, const struct blocker* blocker);
 
+void blocker_setup(thread_t* thread);
+void blocker_detach(thread_t* thread);
+void blocker_wake_up(thread_t* thread);
+
 int init_join_blocker(thread_t* thread, int wait_for_pid);
 int init_read_blocker(thread_t* thread, file_descriptor_t* bfd);
 int init_write_blocker(thread_t* thread, file_descriptor_t* bfd);
 int init_sleep_blocker(thread_t* thread, timespec_t ts);
 int init_select_blocker(thread_t* thread, int nfds, fd_set_t* readfds, fd_set_t* writefds, fd_set_t* exceptfds, timeval_t* timeout);
+int init_wait_queue_blocker(thread_t* thread, wait_queue_t* wq, bool (*should_unblock)(thread_t* thread));
 
 /**
  * DEBUG FUNCTIONS
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_TASKING_WAIT_QUEUE_H
+#define _KERNEL_TASKING_WAIT_QUEUE_H
+
+#include <libkern/lock.h>
+#include <libkern/types.h>
+
+struct thread;
+struct wait_queue;
+
+/**
+ * Wait queue entry is owned by a thread (see thread_t::wait_entries),
+ * so a thread could wait for several queues at once (e.g. select).
+ */
+struct wait_queue_entry {
+    struct thread* thread;
+    struct wait_queue* queue;
+    struct wait_queue_entry* prev;
+    struct wait_queue_entry* next;
+};
+typedef struct wait_queue_entry wait_queue_entry_t;
+
+struct wait_queue {
+    wait_queue_entry_t* head;
+    wait_queue_entry_t* tail;
+    spinlock_t lock;
+};
+typedef struct wait_queue wait_queue_t;
+
+void wait_queue_init(wait_queue_t* wq);
+void wait_queue_add(wait_queue_t* wq, wait_queue_entry_t* entry);
+void wait_queue_remove(wait_queue_entry_t* entry);
+void wait_queue_notify_all(wait_queue_t* wq);
+
+#endif // _KERNEL_TASKING_WAIT_QUEUE_H
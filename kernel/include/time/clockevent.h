@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_TIME_CLOCKEVENT_H
+#define _KERNEL_TIME_CLOCKEVENT_H
+
+#include <libkern/lock.h>
+#include <libkern/types.h>
+
+// Every cpu has its own instance of the device (e.g. arm64 generic timer).
+#define CLOCKEVENT_PER_CPU (1 << 0)
+
+/**
+ * Clockevent device is a one-shot timer. Instead of ticking periodically,
+ * it is programmed for the next tick or the next timeout, whichever comes
+ * first. While the cpu is idle the tick is stopped and ticks which were
+ * skipped are accounted on wake up.
+ */
+struct clockevent_device {
+    const char* name;
+    uint32_t flags;
+    uint32_t freq; // Frequency of the counter in Hz.
+    uint32_t min_cycles;
+    uint32_t max_cycles; // Not more than 0x7fffffff.
+    void (*set_next_event)(uint32_t cycles);
+    int32_t (*cycles_left)(); // Goes negative once the event has fired, counting cycles since then.
+};
+typedef struct clockevent_device clockevent_device_t;
+
+void clockevent_register(clockevent_device_t* dev);
+void clockevent_handle_event();
+void clockevent_update();
+void clockevent_timers_changed();
+void clockevent_idle_enter();
+void clockevent_idle_exit();
+
+#endif // _KERNEL_TIME_CLOCKEVENT_H
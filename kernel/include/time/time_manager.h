@@ -15,6 +15,7 @@
 #include <platform/generic/cpu.h>
 
 #define TIMER_TICKS_PER_SECOND 125
+#define TIMER_NSEC_PER_TICK (1000000000 / TIMER_TICKS_PER_SECOND)
 
 extern time_t ticks_since_boot;
 extern time_t ticks_since_second;
@@ -26,6 +27,9 @@ time_t timeman_to_seconds_since_epoch(uint8_t secs, uint8_t mins, uint8_t hrs, u
 
 int timeman_setup();
 void timeman_timer_tick();
+void timeman_timer_set_nsec_since_tick(uint32_t nsec);
+uint32_t timeman_timer_nsec_since_tick();
+static inline time_t timeman_timer_ticks() { return atomic_load(&ticks_since_boot); };
 
 time_t timeman_seconds_since_epoch();
 time_t timeman_seconds_since_boot();
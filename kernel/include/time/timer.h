@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _KERNEL_TIME_TIMER_H
+#define _KERNEL_TIME_TIMER_H
+
+#include <libkern/bits/time.h>
+#include <libkern/types.h>
+
+#define TIMER_WHEEL_LEVELS 5
+#define TIMER_WHEEL_SLOT_BITS 5
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+struct timer;
+typedef void (*timer_callback_t)(struct timer* timer);
+
+struct timer_slot {
+    struct timer* head;
+};
+typedef struct timer_slot timer_slot_t;
+
+/**
+ * Timers are kept in a hierarchical timing wheel, so arming and cancelling
+ * take constant time and a tick costs as much as the timers which expire
+ * at it. Callbacks are called from the timer interrupt on the boot cpu,
+ * timer_cancel() returns only after a callback which is already running.
+ */
+struct timer {
+    struct timer* prev;
+    struct timer* next;
+    timer_slot_t* slot; // Not NULL while the timer is pending.
+    time_t expires; // In ticks since boot.
+    uint32_t expires_nsec; // Within the tick, timers fire between ticks.
+    timer_callback_t callback;
+    void* data;
+};
+typedef struct timer timer_t;
+
+void timer_setup(timer_t* timer, timer_callback_t callback, void* data);
+void timer_arm(timer_t* timer, time_t ticks, uint32_t nsec);
+void timer_arm_timespec(timer_t* timer, const timespec_t* delay);
+bool timer_cancel(timer_t* timer);
+time_t timer_ticks_left(timer_t* timer);
+static inline bool timer_pending(timer_t* timer) { return timer->slot; }
+
+void timer_run();
+uint32_t timer_nsec_until_next(uint32_t limit);
+
+#endif // _KERNEL_TIME_TIMER_H
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <algo/lz4.h>
+#include <libkern/bits/errno.h>
+#include <libkern/libkern.h>
+
+#define LZ4_MIN_MATCH (4)
+#define LZ4_LAST_LITERALS (5) // The block ends with literals only.
+#define LZ4_MFLIMIT (12) // The last match starts at least this far from the end.
+#define LZ4_MAX_OFFSET (65535)
+#define LZ4_RUN_MASK (15)
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static inline uint32_t _lz4_read32(const uint8_t* ptr)
+{
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static inline uint32_t _lz4_hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Lengths which do not fit the token are continued with bytes, 255 means more to follow.
+static uint8_t* _lz4_write_length(uint8_t* op, uint8_t* oend, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        if (op >= oend) {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+
+    if (op >= oend) {
+        return NULL;
+    }
+    *op++ = len;
+    return op;
+}
+
+static const uint8_t* _lz4_read_length(const uint8_t* ip, const uint8_t* iend, size_t* len)
+{
+    uint8_t byte;
+    do {
+        if (ip >= iend) {
+            return NULL;
+        }
+        byte = *ip++;
+        *len += byte;
+    } while (byte == 255);
+    return ip;
+}
+
+/**
+ * @brief Writes a sequence of literals followed by a match. The last
+ *        sequence of a block has no match, match_len is ignored then.
+ *
+ * @param match_len The length of the match without LZ4_MIN_MATCH.
+ */
+static uint8_t* _lz4_write_sequence(uint8_t* op, uint8_t* oend, const uint8_t* literals, size_t lit_len, size_t match_len, uint32_t offset, bool has_match)
+{
+    if (op >= oend) {
+        return NULL;
+    }
+
+    uint8_t* token = op++;
+    *token = min(lit_len, LZ4_RUN_MASK) << 4;
+    if (lit_len >= LZ4_RUN_MASK) {
+        op = _lz4_write_length(op, oend, lit_len - LZ4_RUN_MASK);
+        if (!op) {
+            return NULL;
+        }
+    }
+
+    if ((size_t)(oend - op) < lit_len) {
+        return NULL;
+    }
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+
+    if (!has_match) {
+        return op;
+    }
+
+    if (oend - op < 2) {
+        return NULL;
+    }
+    *op++ = offset & 0xff;
+    *op++ = (offset >> 8) & 0xff;
+
+    *token |= min(match_len, LZ4_RUN_MASK);
+    if (match_len >= LZ4_RUN_MASK) {
+        op = _lz4_write_length(op, oend, match_len - LZ4_RUN_MASK);
+    }
+    return op;
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+int lz4_compress(const void* src, size_t src_len, void* dst, size_t dst_cap, lz4_wrkmem_t* wrkmem)
+{
+    if (src_len > LZ4_MAX_INPUT_SIZE) {
+        return -EINVAL;
+    }
+
+    const uint8_t* base = (const uint8_t*)src;
+    const uint8_t* iend = base + src_len;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* oend = op + dst_cap;
+
+    if (src_len > LZ4_MFLIMIT) {
+        const uint8_t* mflimit = iend - LZ4_MFLIMIT;
+        const uint8_t* matchlimit = iend - LZ4_LAST_LITERALS;
+        memset(wrkmem->table, 0, sizeof(wrkmem->table));
+
+        while (ip < mflimit) {
+            uint32_t seq = _lz4_read32(ip);
+            uint32_t hash = _lz4_hash(seq);
+            const uint8_t* ref = base + wrkmem->table[hash];
+            wrkmem->table[hash] = ip - base;
+
+            // The table is zeroed, so a candidate is valid only if its data matches.
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || _lz4_read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            const uint8_t* match_end = ip + LZ4_MIN_MATCH;
+            const uint8_t* ref_end = ref + LZ4_MIN_MATCH;
+            while (match_end < matchlimit && *match_end == *ref_end) {
+                match_end++;
+                ref_end++;
+            }
+
+            op = _lz4_write_sequence(op, oend, anchor, ip - anchor, match_end - ip - LZ4_MIN_MATCH, ip - ref, true);
+            if (!op) {
+                return -ENOSPC;
+            }
+            ip = match_end;
+            anchor = ip;
+        }
+    }
+
+    op = _lz4_write_sequence(op, oend, anchor, iend - anchor, 0, 0, false);
+    if (!op) {
+        return -ENOSPC;
+    }
+    return op - (uint8_t*)dst;
+}
+
+/**
+ * @brief Decompresses a block. Every length and offset is checked, so
+ *        broken data could not be written past dst.
+ *
+ * @return The size of decompressed data, or -EINVAL if the block is broken.
+ */
+int lz4_decompress(const void* src, size_t src_len, void* dst, size_t dst_cap)
+{
+    const uint8_t* ip = (const uint8_t*)src;
+    const uint8_t* iend = ip + src_len;
+    uint8_t* base = (uint8_t*)dst;
+    uint8_t* op = base;
+    uint8_t* oend = base + dst_cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == LZ4_RUN_MASK) {
+            ip = _lz4_read_length(ip, iend, &lit_len);
+            if (!ip) {
+                return -EINVAL;
+            }
+        }
+        if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len) {
+            return -EINVAL;
+        }
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -EINVAL;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - base)) {
+            return -EINVAL;
+        }
+
+        size_t match_len = token & LZ4_RUN_MASK;
+        if (match_len == LZ4_RUN_MASK) {
+            ip = _lz4_read_length(ip, iend, &match_len);
+            if (!ip) {
+                return -EINVAL;
+            }
+        }
+        match_len += LZ4_MIN_MATCH;
+        if ((size_t)(oend - op) < match_len) {
+            return -EINVAL;
+        }
+
+        // The match could overlap the output, so it's copied bytewise.
+        const uint8_t* ref = op - offset;
+        while (match_len--) {
+            *op++ = *ref++;
+        }
+    }
+    return op - base;
+}
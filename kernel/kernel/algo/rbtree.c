@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <algo/rbtree.h>
+#include <libkern/libkern.h>
+
+static inline bool _rb_is_black(rb_node_t* node)
+{
+    return !node || node->color == RB_BLACK;
+}
+
+static inline void _rb_change_child(rb_tree_t* tree, rb_node_t* parent, rb_node_t* old, rb_node_t* new)
+{
+    if (!parent) {
+        tree->root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+static inline void _rb_augment(rb_tree_t* tree, rb_node_t* node)
+{
+    if (tree->augment) {
+        tree->augment(node);
+    }
+}
+
+static void _rb_rotate_left(rb_tree_t* tree, rb_node_t* node)
+{
+    rb_node_t* right = node->right;
+    node->right = right->left;
+    if (right->left) {
+        right->left->parent = node;
+    }
+
+    _rb_change_child(tree, node->parent, node, right);
+    right->parent = node->parent;
+    right->left = node;
+    node->parent = right;
+
+    // Only these two nodes got new subtrees.
+    _rb_augment(tree, node);
+    _rb_augment(tree, right);
+}
+
+static void _rb_rotate_right(rb_tree_t* tree, rb_node_t* node)
+{
+    rb_node_t* left = node->left;
+    node->left = left->right;
+    if (left->right) {
+        left->right->parent = node;
+    }
+
+    _rb_change_child(tree, node->parent, node, left);
+    left->parent = node->parent;
+    left->right = node;
+    node->parent = left;
+
+    _rb_augment(tree, node);
+    _rb_augment(tree, left);
+}
+
+static void _rb_insert_fixup(rb_tree_t* tree, rb_node_t* node)
+{
+    rb_node_t* parent;
+    while ((parent = node->parent) && parent->color == RB_RED) {
+        // The parent is red, so it is not the root.
+        rb_node_t* grandparent = parent->parent;
+        if (parent == grandparent->left) {
+            rb_node_t* uncle = grandparent->right;
+            if (!_rb_is_black(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->right) {
+                _rb_rotate_left(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            _rb_rotate_right(tree, grandparent);
+        } else {
+            rb_node_t* uncle = grandparent->left;
+            if (!_rb_is_black(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->left) {
+                _rb_rotate_right(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            _rb_rotate_left(tree, grandparent);
+        }
+    }
+    tree->root->color = RB_BLACK;
+}
+
+static void _rb_erase_fixup(rb_tree_t* tree, rb_node_t* node, rb_node_t* parent)
+{
+    // The node could be NULL, so its parent is passed explicitly.
+    while (node != tree->root && _rb_is_black(node)) {
+        if (node == parent->left) {
+            rb_node_t* sibling = parent->right;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                _rb_rotate_left(tree, parent);
+                sibling = parent->right;
+            }
+
+            if (_rb_is_black(sibling->left) && _rb_is_black(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (_rb_is_black(sibling->right)) {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                _rb_rotate_right(tree, sibling);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            _rb_rotate_left(tree, parent);
+            node = tree->root;
+        } else {
+            rb_node_t* sibling = parent->left;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                _rb_rotate_right(tree, parent);
+                sibling = parent->left;
+            }
+
+            if (_rb_is_black(sibling->left) && _rb_is_black(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (_rb_is_black(sibling->left)) {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                _rb_rotate_left(tree, sibling);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            _rb_rotate_right(tree, parent);
+            node = tree->root;
+        }
+    }
+
+    if (node) {
+        node->color = RB_BLACK;
+    }
+}
+
+void rb_insert(rb_tree_t* tree, rb_node_t* node, rb_less_t less)
+{
+    rb_node_t* parent = NULL;
+    rb_node_t** link = &tree->root;
+    bool is_leftmost = true;
+
+    while (*link) {
+        parent = *link;
+        if (less(node, parent)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            is_leftmost = false;
+        }
+    }
+
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+    if (is_leftmost) {
+        tree->leftmost = node;
+    }
+
+    rb_augment_propagate(tree, node);
+    _rb_insert_fixup(tree, node);
+}
+
+void rb_erase(rb_tree_t* tree, rb_node_t* node)
+{
+    if (tree->leftmost == node) {
+        tree->leftmost = rb_next(node);
+    }
+
+    rb_node_t* child;
+    rb_node_t* parent;
+    int removed_color;
+
+    if (!node->left || !node->right) {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        removed_color = node->color;
+        if (child) {
+            child->parent = parent;
+        }
+        _rb_change_child(tree, parent, node, child);
+    } else {
+        // Replace the node with its successor, which has no left child.
+        rb_node_t* successor = node->right;
+        while (successor->left) {
+            successor = successor->left;
+        }
+
+        removed_color = successor->color;
+        child = successor->right;
+        if (successor->parent == node) {
+            parent = successor;
+        } else {
+            parent = successor->parent;
+            parent->left = child;
+            if (child) {
+                child->parent = parent;
+            }
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+
+        successor->left = node->left;
+        node->left->parent = successor;
+        successor->color = node->color;
+        _rb_change_child(tree, node->parent, node, successor);
+        successor->parent = node->parent;
+    }
+
+    node->parent = node->left = node->right = NULL;
+
+    // The parent is the lowest node which lost a descendant, the successor is on its way up.
+    if (parent) {
+        rb_augment_propagate(tree, parent);
+    }
+    if (removed_color == RB_BLACK) {
+        _rb_erase_fixup(tree, child, parent);
+    }
+}
+
+rb_node_t* rb_next(rb_node_t* node)
+{
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return node;
+    }
+
+    while (node->parent && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+rb_node_t* rb_prev(rb_node_t* node)
+{
+    if (node->left) {
+        node = node->left;
+        while (node->right) {
+            node = node->right;
+        }
+        return node;
+    }
+
+    while (node->parent && node == node->parent->left) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+rb_node_t* rb_last(rb_tree_t* tree)
+{
+    rb_node_t* node = tree->root;
+    if (!node) {
+        return NULL;
+    }
+
+    while (node->right) {
+        node = node->right;
+    }
+    return node;
+}
+
+void rb_augment_propagate(rb_tree_t* tree, rb_node_t* node)
+{
+    if (!tree->augment) {
+        return;
+    }
+
+    for (; node; node = node->parent) {
+        tree->augment(node);
+    }
+}
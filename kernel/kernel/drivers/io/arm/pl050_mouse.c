@@ -27,6 +27,7 @@
 #endif
 
 static ringbuffer_t mouse_buffer;
+static wait_queue_t mouse_wait_queue;
 static kmemzone_t mapped_zone;
 static volatile pl050_registers_t* registers = 0x0;
 
@@ -64,6 +65,11 @@ static int _mouse_read(file_t* file, void __user* buf, size_t start, size_t len)
     return leno;
 }
 
+static wait_queue_t* _mouse_wait_queue(file_t* file)
+{
+    return &mouse_wait_queue;
+}
+
 static void pl050_mouse_recieve_notification(uintptr_t msg, uintptr_t param)
 {
     // Checking if device is inited
@@ -80,6 +86,7 @@ static void pl050_mouse_recieve_notification(uintptr_t msg, uintptr_t param)
         file_ops_t fops = { 0 };
         fops.can_read = _mouse_can_read;
         fops.read = _mouse_read;
+        fops.wait_queue = _mouse_wait_queue;
         devfs_inode_t* res = devfs_register(&vfspth, MKDEV(10, 1), "mouse", 5, S_IFCHR | 0400, &fops);
 
         path_put(&vfspth);
@@ -157,6 +164,7 @@ static void _pl050_mouse_int_handler()
     }
 
     ringbuffer_write(&mouse_buffer, (uint8_t*)&packet, sizeof(mouse_packet_t));
+    wait_queue_notify_all(&mouse_wait_queue);
 
 #ifdef MOUSE_DRIVER_DEBUG
     log("%x ", packet.button_states);
@@ -196,6 +204,7 @@ int pl050_mouse_init(device_t* dev)
     _mouse_send_cmd_and_data(0xF3, 100);
     _mouse_send_cmd_and_data(0xF3, 80);
     mouse_buffer = ringbuffer_create_std();
+    wait_queue_init(&mouse_wait_queue);
 
     devtree_entry_t* devtree_entry = dev->device_desc.devtree.entry;
     ASSERT(devtree_entry->irq_lane > 0);
@@ -14,6 +14,7 @@
 #include <libkern/libkern.h>
 
 static ringbuffer_t gkeyboard_buffer;
+static wait_queue_t gkeyboard_wait_queue;
 static bool _gkeyboard_has_prefix_e0 = false;
 static bool _gkeyboard_shift_enabled = false;
 static bool _gkeyboard_ctrl_enabled = false;
@@ -46,6 +47,11 @@ static int _generic_keyboard_read(file_t* file, void __user* buf, size_t start,
     return read_len;
 }
 
+static wait_queue_t* _generic_keyboard_wait_queue(file_t* file)
+{
+    return &gkeyboard_wait_queue;
+}
+
 int generic_keyboard_create_devfs()
 {
     path_t vfspth;
@@ -55,6 +61,7 @@ int generic_keyboard_create_devfs()
     file_ops_t fops = { 0 };
     fops.can_read = _generic_keyboard_can_read;
     fops.read = _generic_keyboard_read;
+    fops.wait_queue = _generic_keyboard_wait_queue;
     devfs_inode_t* res = devfs_register(&vfspth, MKDEV(11, 0), "kbd", 3, S_IFCHR | 0400, &fops);
 
     path_put(&vfspth);
@@ -64,6 +71,7 @@ int generic_keyboard_create_devfs()
 void generic_keyboard_init()
 {
     gkeyboard_buffer = ringbuffer_create_std();
+    wait_queue_init(&gkeyboard_wait_queue);
 }
 
 void generic_emit_key_set1(uint32_t scancode)
@@ -137,6 +145,7 @@ void generic_emit_key_set1(uint32_t scancode)
     }
 
     ringbuffer_write(&gkeyboard_buffer, (uint8_t*)&packet, sizeof(kbd_packet_t));
+    wait_queue_notify_all(&gkeyboard_wait_queue);
 }
 
 static key_t _generic_keyboard_apply_modifiers(key_t key)
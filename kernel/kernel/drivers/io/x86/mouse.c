@@ -20,6 +20,7 @@
 // #define MOUSE_DRIVER_DEBUG
 
 static ringbuffer_t mouse_buffer;
+static wait_queue_t mouse_wait_queue;
 
 int mouse_run();
 
@@ -38,6 +39,11 @@ static int _mouse_read(file_t* file, void __user* buf, size_t start, size_t len)
     return leno;
 }
 
+static wait_queue_t* _mouse_wait_queue(file_t* file)
+{
+    return &mouse_wait_queue;
+}
+
 static void _mouse_recieve_notification(uintptr_t msg, uintptr_t param)
 {
     if (msg == DEVMAN_NOTIFICATION_DEVFS_READY) {
@@ -49,6 +55,7 @@ static void _mouse_recieve_notification(uintptr_t msg, uintptr_t param)
         file_ops_t fops = { 0 };
         fops.can_read = _mouse_can_read;
         fops.read = _mouse_read;
+        fops.wait_queue = _mouse_wait_queue;
         devfs_inode_t* res = devfs_register(&vfspth, MKDEV(10, 1), "mouse", 5, S_IFCHR | 0400, &fops);
 
         path_put(&vfspth);
@@ -151,6 +158,7 @@ void mouse_handler()
     }
 
     ringbuffer_write(&mouse_buffer, (uint8_t*)&packet, sizeof(mouse_packet_t));
+    wait_queue_notify_all(&mouse_wait_queue);
 
 #ifdef MOUSE_DRIVER_DEBUG
     log("%x", packet.button_states);
@@ -176,6 +184,7 @@ int mouse_run()
     _mouse_send_cmd_and_data(0xF3, 200);
     _mouse_send_cmd_and_data(0xF3, 100);
     _mouse_send_cmd_and_data(0xF3, 80);
+    wait_queue_init(&mouse_wait_queue);
     irq_register_handler(irqline_from_id(12), 0, 0, mouse_handler, BOOT_CPU_MASK);
 
     mouse_buffer = ringbuffer_create_std();
@@ -24,6 +24,7 @@ static irqdev_descritptor_t gicv2_descriptor = {
     .interrupt_descriptor = gicv2_interrupt_descriptor,
     .end_interrupt = gicv2_end,
     .enable_irq = gicv2_enable_irq,
+    .send_ipi = gicv2_send_ipi,
 };
 static kmemzone_t distributor_zone;
 static kmemzone_t cpu_interface_zone;
@@ -118,6 +119,10 @@ void gicv2_install_secondary_cpu()
 #ifdef DEBUG_GICv2
     log("Gic type %x", distributor_registers->typer);
 #endif
+    // SGI configuration is banked per cpu, so IPIs are set up
+    // the same way as on the boot cpu.
+    distributor_registers->igroup[0] |= 0xffff;
+    distributor_registers->isenabler[0] = 0xffff;
     distributor_registers->control = GICD_ENABLE_MASK;
     cpu_interface_registers->pmr = 0xff;
     cpu_interface_registers->bpr = 0x0;
@@ -132,4 +137,11 @@ uint32_t gicv2_interrupt_descriptor()
 void gicv2_end(uint32_t id)
 {
     cpu_interface_registers->eoir = id;
-}
\ No newline at end of file
+}
+
+void gicv2_send_ipi(ipi_t ipi, int cpu_mask)
+{
+    ASSERT(IS_SGI(ipi));
+    // SGIs are put into group 1 (see gicv2_enable_irq), so NSATT is set.
+    distributor_registers->sgir = ((cpu_mask << GICD_SGIR_TARGET_LIST_POS) & GICD_SGIR_TARGET_LIST_MASK) | GICD_SGIR_NSATT_MASK | (ipi & GICD_SGIR_INTID_MASK);
+}
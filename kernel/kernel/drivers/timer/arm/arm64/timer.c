@@ -12,6 +12,18 @@
 #include <platform/arm64/interrupts.h>
 #include <platform/arm64/registers.h>
 #include <tasking/sched.h>
+#include <time/clockevent.h>
+
+static int32_t _arm64_timer_cycles_left();
+static void _arm64_timer_set_next_event(uint32_t cycles);
+
+static clockevent_device_t _arm64_timer_clockevent = {
+    .name = "aa64timer",
+    .flags = CLOCKEVENT_PER_CPU,
+    .max_cycles = 0x7fffffff, // The timer value register is signed.
+    .set_next_event = _arm64_timer_set_next_event,
+    .cycles_left = _arm64_timer_cycles_left,
+};
 
 static void arm64_timer_write_reg(uint64_t val)
 {
@@ -41,22 +53,39 @@ void arm64_timer_disable()
     arm64_timer_write_reg(0b10);
 }
 
-void arm64_timer_rearm()
+static uint64_t arm64_timer_read_freq()
 {
     uint64_t el;
     asm volatile("mrs %x0, CNTFRQ_EL0"
                  : "=r"(el)
                  :);
+    return el;
+}
 
-    arm64_timer_write_ctrl(el / 125);
+static uint64_t arm64_timer_read_tval()
+{
+    uint64_t val;
+    asm volatile("mrs %x0, cntp_tval_el0"
+                 : "=r"(val)
+                 :);
+    return val;
 }
 
-void tick()
+// The value goes negative once the timer has fired.
+static int32_t _arm64_timer_cycles_left()
 {
-    arm64_timer_rearm();
-    cpu_tick();
-    timeman_timer_tick();
-    sched_tick();
+    return (int32_t)arm64_timer_read_tval();
+}
+
+static void _arm64_timer_set_next_event(uint32_t cycles)
+{
+    arm64_timer_write_ctrl(cycles);
+    arm64_timer_enable();
+}
+
+void arm64_timer_handler()
+{
+    clockevent_handle_event();
 }
 
 int arm64_timer_init(device_t* dev)
@@ -68,13 +97,16 @@ int arm64_timer_init(device_t* dev)
     devtree_entry_t* devtree_entry = dev->device_desc.devtree.entry;
     if (devtree_entry->irq_lane > 0) {
         irq_flags_t irqflags = irq_flags_from_devtree(devtree_entry->irq_flags);
-        irq_register_handler(devtree_entry->irq_lane, devtree_entry->irq_priority, irqflags, tick, ALL_CPU_MASK);
+        irq_register_handler(devtree_entry->irq_lane, devtree_entry->irq_priority, irqflags, arm64_timer_handler, ALL_CPU_MASK);
     }
 
     arm64_timer_disable();
     arm64_timer_write_ctrl(0xfffffff);
     arm64_timer_enable();
-    arm64_timer_rearm();
+
+    _arm64_timer_clockevent.freq = arm64_timer_read_freq();
+    _arm64_timer_clockevent.min_cycles = _arm64_timer_clockevent.freq / 100000 + 1; // About 10us.
+    clockevent_register(&_arm64_timer_clockevent);
     return 0;
 }
 
@@ -14,6 +14,7 @@
 #include <mem/vmm.h>
 #include <tasking/cpu.h>
 #include <tasking/sched.h>
+#include <time/clockevent.h>
 #include <time/time_manager.h>
 
 // #define DEBUG_SP804
@@ -21,6 +22,19 @@
 static kmemzone_t mapped_zone;
 volatile sp804_registers_t* timer1;
 
+static int32_t _sp804_cycles_left();
+static void _sp804_set_next_event(uint32_t cycles);
+
+static clockevent_device_t _sp804_clockevent = {
+    .name = "sp804",
+    .flags = 0,
+    .freq = SP804_CLK_HZ,
+    .min_cycles = SP804_MIN_CYCLES,
+    .max_cycles = 0x7fffffff,
+    .set_next_event = _sp804_set_next_event,
+    .cycles_left = _sp804_cycles_left,
+};
+
 static inline uintptr_t _sp804_mmio_paddr(devtree_entry_t* device)
 {
     if (!device) {
@@ -45,12 +59,23 @@ static inline void _sp804_clear_interrupt(volatile sp804_registers_t* timer)
     timer->intclr = 1;
 }
 
+// In free-running mode the counter wraps around at 0, so the value goes negative after the event.
+static int32_t _sp804_cycles_left()
+{
+    return (int32_t)timer1->value;
+}
+
+static void _sp804_set_next_event(uint32_t cycles)
+{
+    timer1->control = 0;
+    timer1->load = cycles;
+    timer1->control = SP804_ENABLE_MASK | SP804_32_BIT_MASK | SP804_INTS_ENABLED_MASK;
+}
+
 static void _sp804_int_handler()
 {
     _sp804_clear_interrupt(timer1);
-    cpu_tick();
-    timeman_timer_tick();
-    sched_tick();
+    clockevent_handle_event();
 }
 
 int sp804_init(device_t* dev)
@@ -62,13 +87,11 @@ int sp804_init(device_t* dev)
         return -1;
     }
 
-    timer1->load = SP804_CLK_HZ / TIMER_TICKS_PER_SECOND;
-    timer1->control = SP804_ENABLE_MASK | SP804_PERIODIC_MASK | SP804_32_BIT_MASK | SP804_INTS_ENABLED_MASK;
-
     devtree_entry_t* devtree_entry = dev->device_desc.devtree.entry;
     ASSERT(devtree_entry->irq_lane > 0);
     irq_flags_t irqflags = irq_flags_from_devtree(devtree_entry->irq_flags);
     irq_register_handler(devtree_entry->irq_lane, devtree_entry->irq_priority, irqflags, _sp804_int_handler, ALL_CPU_MASK);
+    clockevent_register(&_sp804_clockevent);
     return 0;
 }
 
@@ -14,42 +14,55 @@
 #include <platform/x86/system.h>
 #include <tasking/cpu.h>
 #include <tasking/sched.h>
+#include <time/clockevent.h>
 #include <time/time_manager.h>
 
-static int ticks_to_sched = 0;
-static int second = TIMER_TICKS_PER_SECOND;
-static int _pit_set_frequency(uint16_t freq);
+static int32_t _pit_cycles_left();
+static void _pit_set_next_event(uint32_t cycles);
 
-static int _pit_set_frequency(uint16_t freq)
+static clockevent_device_t _pit_clockevent = {
+    .name = "pit",
+    .flags = 0,
+    .freq = PIT_BASE_FREQ,
+    .min_cycles = PIT_MIN_CYCLES,
+    .max_cycles = 0xffff,
+    .set_next_event = _pit_set_next_event,
+    .cycles_left = _pit_cycles_left,
+};
+
+/**
+ * In mode 0 the output goes high once the count reaches 0, while the
+ * counter itself keeps going and wraps around, so it tells the cycles
+ * passed since the event (up to 0xffff). The status and the count are
+ * latched together.
+ */
+static int32_t _pit_cycles_left()
 {
-    system_disable_interrupts();
-    uint32_t divisor = PIT_BASE_FREQ / freq;
-    if (divisor > 0xffff) {
-        return -1;
+    port_write8(PIT_COMMAND_PORT, PIT_READ_BACK_CH0);
+    bool fired = port_read8(PIT_CH0_PORT) & PIT_STATUS_OUTPUT;
+    uint8_t low = port_read8(PIT_CH0_PORT);
+    uint8_t high = port_read8(PIT_CH0_PORT);
+    uint32_t count = ((uint32_t)high << 8) | low;
+    if (fired) {
+        return -(int32_t)((0x10000 - count) & 0xffff);
     }
-    uint8_t low = (uint8_t)(divisor & 0xFF);
-    uint8_t high = (uint8_t)((divisor >> 8) & 0xFF);
-    port_write8(0x43, 0b110110);
-    port_write8(0x40, low);
-    port_write8(0x40, high);
-    system_enable_interrupts();
-    return 0;
+    return count;
+}
+
+static void _pit_set_next_event(uint32_t cycles)
+{
+    port_write8(PIT_COMMAND_PORT, PIT_CH0_ONE_SHOT);
+    port_write8(PIT_CH0_PORT, (uint8_t)(cycles & 0xFF));
+    port_write8(PIT_CH0_PORT, (uint8_t)((cycles >> 8) & 0xFF));
 }
 
 void pit_setup()
 {
-    int err = _pit_set_frequency(TIMER_TICKS_PER_SECOND);
-    if (err) {
-        kpanic("PIT: failed to set frequency");
-    }
     irq_register_handler(irqline_from_id(0), 0, 0, pit_handler, BOOT_CPU_MASK);
+    clockevent_register(&_pit_clockevent);
 }
 
 void pit_handler()
 {
-    system_disable_interrupts();
-    cpu_tick();
-    timeman_timer_tick();
-    system_enable_interrupts();
-    sched_tick();
+    clockevent_handle_event();
 }
@@ -439,6 +439,15 @@ int devfs_can_write(file_t* file, size_t start)
     return true;
 }
 
+wait_queue_t* devfs_wait_queue(file_t* file)
+{
+    devfs_inode_t* devfs_inode = (devfs_inode_t*)file_dentry_assert(file)->inode;
+    if (devfs_inode->handlers->wait_queue) {
+        return devfs_inode->handlers->wait_queue(file);
+    }
+    return NULL;
+}
+
 int devfs_read(file_t* file, void __user* buf, size_t start, size_t len)
 {
     devfs_inode_t* devfs_inode = (devfs_inode_t*)file_dentry_assert(file)->inode;
@@ -531,6 +540,7 @@ driver_desc_t _devfs_driver_info()
     fs_desc.functions[DRIVER_FILE_SYSTEM_PREPARE_FS] = devfs_prepare_fs;
     fs_desc.functions[DRIVER_FILE_SYSTEM_CAN_READ] = devfs_can_read;
     fs_desc.functions[DRIVER_FILE_SYSTEM_CAN_WRITE] = devfs_can_write;
+    fs_desc.functions[DRIVER_FILE_SYSTEM_WAIT_QUEUE] = devfs_wait_queue;
     fs_desc.functions[DRIVER_FILE_SYSTEM_OPEN] = devfs_open;
     fs_desc.functions[DRIVER_FILE_SYSTEM_READ] = devfs_read;
     fs_desc.functions[DRIVER_FILE_SYSTEM_WRITE] = devfs_write;
@@ -13,13 +13,21 @@
 #include <libkern/log.h>
 #include <libkern/mem.h>
 #include <mem/kmalloc.h>
+#include <mem/slab.h>
 #include <syscalls/handlers.h>
 
 // #define FILE_DEBUG
 
+static kmem_cache_t* _file_cache;
+
+void file_init_cache()
+{
+    _file_cache = kmem_cache_create("file", sizeof(file_t));
+}
+
 static file_t* file_alloc()
 {
-    return (file_t*)kmalloc(sizeof(file_t));
+    return (file_t*)kmem_cache_alloc(_file_cache);
 }
 
 static file_t* file_init_dentry(dentry_t* dentry)
@@ -94,7 +102,7 @@ static void file_put_impl_locked(file_t* file)
 
     file->dentry = NULL;
     file->ops = NULL;
-    kfree(file);
+    kmem_cache_free(_file_cache, file);
 }
 
 static void file_put_locked(file_t* file)
@@ -10,6 +10,9 @@
 #include <fs/vfs.h>
 #include <libkern/bits/errno.h>
 #include <libkern/libkern.h>
+#include <mem/pmm.h>
+#include <mem/swapfile.h>
+#include <mem/zswap.h>
 #include <tasking/sched.h>
 #include <tasking/tasking.h>
 #include <time/time_manager.h>
@@ -41,6 +44,9 @@ static int procfs_root_stat_read(file_t* file, void __user* buf, size_t start, s
 static bool procfs_root_meminfo_can_read(file_t* file, size_t start);
 static int procfs_root_meminfo_read(file_t* file, void __user* buf, size_t start, size_t len);
 
+static bool procfs_root_pcpinfo_can_read(file_t* file, size_t start);
+static int procfs_root_pcpinfo_read(file_t* file, void __user* buf, size_t start, size_t len);
+
 /**
  * DATA
  */
@@ -60,6 +66,11 @@ const file_ops_t procfs_root_meminfo_ops = {
     .read = procfs_root_meminfo_read,
 };
 
+const file_ops_t procfs_root_pcpinfo_ops = {
+    .can_read = procfs_root_pcpinfo_can_read,
+    .read = procfs_root_pcpinfo_read,
+};
+
 const file_ops_t procfs_root_stat_ops = {
     .can_read = procfs_root_stat_can_read,
     .read = procfs_root_stat_read,
@@ -69,6 +80,7 @@ static const procfs_files_t static_procfs_files[] = {
     { .name = "stat", .mode = S_IFREG | 0444, .ops = &procfs_root_stat_ops, .inode_index = procfs_root_sfiles_get_inode_index },
     { .name = "uptime", .mode = S_IFREG | 0444, .ops = &procfs_root_uptime_ops, .inode_index = procfs_root_sfiles_get_inode_index },
     { .name = "meminfo", .mode = S_IFREG | 0444, .ops = &procfs_root_meminfo_ops, .inode_index = procfs_root_sfiles_get_inode_index },
+    { .name = "pcpinfo", .mode = S_IFREG | 0444, .ops = &procfs_root_pcpinfo_ops, .inode_index = procfs_root_sfiles_get_inode_index },
     { .name = "self", .mode = S_IFDIR | 0444, .ops = &procfs_pid_ops, .inode_index = procfs_root_self_get_inode_index },
     { .name = "sys", .mode = S_IFDIR | 0444, .ops = &procfs_sys_ops, .inode_index = procfs_root_self_get_inode_index },
 };
@@ -268,8 +280,41 @@ static bool procfs_root_meminfo_can_read(file_t* file, size_t start)
 
 static int procfs_root_meminfo_read(file_t* file, void __user* buf, size_t start, size_t len)
 {
-    char res[128];
-    snprintf(res, 128, "MemTotal: %u kB\nMemFree: %u kB\n", pmm_get_ram_in_kb(), pmm_get_free_space_in_kb());
+    char res[256];
+    snprintf(res, 256, "MemTotal: %u kB\nMemFree: %u kB\nSwapTotal: %u kB\nSwapFree: %u kB\n", pmm_get_ram_in_kb(), pmm_get_free_space_in_kb(), swapfile_get_total_in_kb(), swapfile_get_free_in_kb());
+#ifdef ZSWAP_ENABLED
+    size_t used = strlen(res);
+    snprintf(res + used, 256 - used, "Zswap: %u kB\nZswapped: %u kB\nZswapHits: %u\nZswapMisses: %u\n", zswap_get_pool_in_kb(), zswap_get_stored_in_kb(), zswap_get_hits(), zswap_get_misses());
+#endif
+    size_t size = strlen(res);
+
+    if (start == size) {
+        return 0;
+    }
+
+    if (len < size) {
+        return -EFAULT;
+    }
+
+    umem_copy_to_user(buf, res, size);
+    return size;
+}
+
+static bool procfs_root_pcpinfo_can_read(file_t* file, size_t start)
+{
+    return true;
+}
+
+// Per-cpu page caches: cached pages, hits, misses, frees, refills and drains.
+static int procfs_root_pcpinfo_read(file_t* file, void __user* buf, size_t start, size_t len)
+{
+    char res[256];
+    int offset = 0;
+    for (int i = 0; i < active_cpu_count(); i++) {
+        const pmm_pcp_t* pcp = pmm_get_pcp(i);
+        snprintf(res + offset, 256 - offset, "cpu%d %u %u %u %u %u %u\n", i, pcp->count, pcp->stat_hits, pcp->stat_misses, pcp->stat_frees, pcp->stat_refills, pcp->stat_drains);
+        offset = strlen(res);
+    }
     size_t size = strlen(res);
 
     if (start == size) {
@@ -282,4 +327,4 @@ static int procfs_root_meminfo_read(file_t* file, void __user* buf, size_t start
 
     umem_copy_to_user(buf, res, size);
     return size;
-}
\ No newline at end of file
+}
@@ -28,11 +28,12 @@ int32_t root_fs_dev_id = -1;
 
 static void vfs_recieve_notification(uintptr_t msg, uintptr_t param);
 static int _vfs_loadpage_from_mmap_file(struct memzone* zone, uintptr_t vaddr);
+static int _vfs_swap_page_mode_of_mmap_file(struct memzone* zone, uintptr_t vaddr);
 
 static vm_ops_t mmap_file_vm_ops = {
     .load_page_content = _vfs_loadpage_from_mmap_file,
     .restore_swapped_page = NULL,
-    .swap_page_mode = NULL,
+    .swap_page_mode = _vfs_swap_page_mode_of_mmap_file,
 };
 
 driver_desc_t _vfs_driver_info()
@@ -55,6 +56,7 @@ driver_desc_t _vfs_driver_info()
  */
 void vfs_install()
 {
+    file_init_cache();
     devman_register_driver(_vfs_driver_info(), "vfs");
 }
 devman_register_driver_installation(vfs_install);
@@ -207,6 +209,7 @@ int vfs_add_fs(driver_t* new_driver)
     new_ops->file.open = new_driver->desc.functions[DRIVER_FILE_SYSTEM_OPEN];
     new_ops->file.can_read = new_driver->desc.functions[DRIVER_FILE_SYSTEM_CAN_READ];
     new_ops->file.can_write = new_driver->desc.functions[DRIVER_FILE_SYSTEM_CAN_WRITE];
+    new_ops->file.wait_queue = new_driver->desc.functions[DRIVER_FILE_SYSTEM_WAIT_QUEUE];
     new_ops->file.read = new_driver->desc.functions[DRIVER_FILE_SYSTEM_READ];
     new_ops->file.write = new_driver->desc.functions[DRIVER_FILE_SYSTEM_WRITE];
     new_ops->file.truncate = new_driver->desc.functions[DRIVER_FILE_SYSTEM_TRUNCATE];
@@ -436,6 +439,17 @@ bool vfs_can_write(file_descriptor_t* fd)
     return res;
 }
 
+wait_queue_t* vfs_wait_queue(file_descriptor_t* fd)
+{
+    spinlock_acquire(&fd->file->lock);
+    wait_queue_t* res = NULL;
+    if (fd->file->ops->wait_queue) {
+        res = fd->file->ops->wait_queue(fd->file);
+    }
+    spinlock_release(&fd->file->lock);
+    return res;
+}
+
 int vfs_read(file_descriptor_t* fd, void __user* buf, size_t len)
 {
     spinlock_acquire(&fd->file->lock);
@@ -805,6 +819,15 @@ static int _vfs_loadpage_from_mmap_file(struct memzone* zone, uintptr_t vaddr)
     return 0;
 }
 
+// A private copy of the file which was not written is the same as the file, so it's read again instead of swapped.
+static int _vfs_swap_page_mode_of_mmap_file(struct memzone* zone, uintptr_t vaddr)
+{
+    if (!TEST_FLAG(zone->mmu_flags, MMU_FLAG_PERM_WRITE) || !vmm_is_page_dirty(vaddr)) {
+        return SWAP_DROP;
+    }
+    return SWAP_TO_DEV;
+}
+
 static memzone_t* _vfs_do_mmap(file_descriptor_t* fd, mmap_params_t* params)
 {
     dentry_t* dentry = file_dentry_assert(fd->file);
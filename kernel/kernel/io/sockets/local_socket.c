@@ -19,6 +19,7 @@
 static file_ops_t local_socket_ops = {
     .can_read = local_socket_can_read,
     .can_write = local_socket_can_write,
+    .wait_queue = local_socket_wait_queue,
     .read = local_socket_read,
     .write = local_socket_write,
     .open = NULL,
@@ -65,9 +66,16 @@ int local_socket_write(file_t* file, void __user* buf, size_t start, size_t len)
 {
     socket_t* sock_entry = file_socket_assert(file);
     size_t written = sync_ringbuffer_write_user_ignore_bounds(&sock_entry->buffer, buf, len);
+    wait_queue_notify_all(&sock_entry->wait_queue);
     return 0;
 }
 
+wait_queue_t* local_socket_wait_queue(file_t* file)
+{
+    socket_t* sock_entry = file_socket_assert(file);
+    return &sock_entry->wait_queue;
+}
+
 int local_socket_fchmod(file_t* file, mode_t mode)
 {
     socket_t* sock_entry = file_socket_assert(file);
@@ -26,6 +26,7 @@ pty_master_entry_t pty_masters[PTYS_COUNT];
 int _pty_master_free_dentry_data(dentry_t* dentry);
 bool pty_master_can_read(file_t* file, size_t start);
 bool pty_master_can_write(file_t* file, size_t start);
+wait_queue_t* pty_master_wait_queue(file_t* file);
 int pty_master_read(file_t* file, void __user* buf, size_t start, size_t len);
 int pty_master_write(file_t* file, void __user* buf, size_t start, size_t len);
 int pty_master_fstat(file_t* file, stat_t* stat);
@@ -42,6 +43,7 @@ static fs_ops_t pty_master_ops = {
     .file = {
         .can_read = pty_master_can_read,
         .can_write = pty_master_can_write,
+        .wait_queue = pty_master_wait_queue,
         .read = pty_master_read,
         .write = pty_master_write,
         .open = NULL,
@@ -96,6 +98,15 @@ bool pty_master_can_write(file_t* file, size_t start)
     return tty_can_write(&ptm->pts->tty, file, start);
 }
 
+wait_queue_t* pty_master_wait_queue(file_t* file)
+{
+    dentry_t* dentry = file_dentry_assert(file);
+    pty_master_entry_t* ptm = _ptm_get(dentry);
+    ASSERT(ptm);
+
+    return &ptm->wait_queue;
+}
+
 int pty_master_read(file_t* file, void __user* buf, size_t start, size_t len)
 {
     dentry_t* dentry = file_dentry_assert(file);
@@ -161,5 +172,6 @@ int pty_master_alloc(file_descriptor_t* fd)
 
     pty_slave_create(INODE2PTSNO(ptm->dentry.inode_indx), ptm);
     ptm->buffer = sync_ringbuffer_create_std();
+    wait_queue_init(&ptm->wait_queue);
     return 0;
 }
\ No newline at end of file
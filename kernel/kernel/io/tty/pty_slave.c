@@ -42,6 +42,15 @@ bool pty_slave_can_write(file_t* file, size_t start)
     return sync_ringbuffer_space_to_write(&pts->ptm->buffer) >= 0;
 }
 
+wait_queue_t* pty_slave_wait_queue(file_t* file)
+{
+    dentry_t* dentry = file_dentry_assert(file);
+    pty_slave_entry_t* pts = _pts_get(dentry);
+    ASSERT(pts);
+
+    return &pts->tty.wait_queue;
+}
+
 int pty_slave_read(file_t* file, void __user* buf, size_t start, size_t len)
 {
     dentry_t* dentry = file_dentry_assert(file);
@@ -58,6 +67,7 @@ int pty_slave_write(file_t* file, void __user* buf, size_t start, size_t len)
     ASSERT(pts);
 
     sync_ringbuffer_write_user(&pts->ptm->buffer, buf, len);
+    wait_queue_notify_all(&pts->ptm->wait_queue);
     return len;
 }
 
@@ -86,6 +96,7 @@ int pty_slave_create(int id, pty_master_entry_t* ptm)
         file_ops_t fops = { 0 };
         fops.can_read = pty_slave_can_read;
         fops.can_write = pty_slave_can_write;
+        fops.wait_queue = pty_slave_wait_queue;
         fops.read = pty_slave_read;
         fops.write = pty_slave_write;
         fops.ioctl = pty_slave_ioctl;
@@ -26,6 +26,7 @@ int tty_init(tty_entry_t* tty)
     if (!tty->buffer.ringbuffer.zone.start) {
         return -ENOMEM;
     }
+    wait_queue_init(&tty->wait_queue);
 
     tty->termios.c_lflag |= ECHO | ICANON;
     return 0;
@@ -69,6 +70,7 @@ int tty_write(tty_entry_t* tty, file_t* file, void __user* buf, size_t start, si
     // TODO: Check line count correctly. Both read & write funcs.
     sync_ringbuffer_write_user(&tty->buffer, buf, len);
     tty->line_count++;
+    wait_queue_notify_all(&tty->wait_queue);
     return len;
 }
 
@@ -90,6 +92,8 @@ int tty_ioctl(tty_entry_t* tty, file_t* file, uintptr_t cmd, uintptr_t arg)
         if (cmd == TCSETSF) {
             tty_clear(tty);
         }
+        // Switching canonical mode changes the readiness of the tty.
+        wait_queue_notify_all(&tty->wait_queue);
         return 0;
     }
 
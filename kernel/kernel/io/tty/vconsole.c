@@ -53,6 +53,13 @@ bool vconsole_can_write(file_t* file, size_t start)
     return tty_can_write(&vconsole->tty, file, start);
 }
 
+wait_queue_t* vconsole_wait_queue(file_t* file)
+{
+    dentry_t* dentry = file_dentry_assert(file);
+    vconsole_entry_t* vconsole = _vconsole_get(dentry);
+    return &vconsole->tty.wait_queue;
+}
+
 int vconsole_read(file_t* file, void __user* buf, size_t start, size_t len)
 {
     return 0;
@@ -147,6 +154,7 @@ vconsole_entry_t* vconsole_new()
     file_ops_t fops = { 0 };
     fops.can_read = vconsole_can_read;
     fops.can_write = vconsole_can_write;
+    fops.wait_queue = vconsole_wait_queue;
     fops.read = vconsole_read;
     fops.write = vconsole_write;
     fops.ioctl = vconsole_ioctl;
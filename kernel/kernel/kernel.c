@@ -18,6 +18,11 @@
 #include <mem/kmalloc.h>
 #include <mem/kswapd.h>
 #include <mem/pmm.h>
+#include <mem/swapfile.h>
+#include <mem/vm_asid.h>
+#include <mem/vm_kmap.h>
+#include <mem/vm_lru.h>
+#include <mem/vm_zero.h>
 #include <mem/vmm.h>
 
 #include <fs/devfs/devfs.h>
@@ -63,8 +68,11 @@ static inline void kernel_preempt_setup()
 
 void launching()
 {
+    tasking_run_kernel_thread(kreaperd, NULL);
     tasking_run_kernel_thread(kdentryflusherd, NULL);
     tasking_run_kernel_thread(kswapd, NULL);
+    tasking_run_kernel_thread(kswapflusherd, NULL);
+    tasking_run_kernel_thread(kzerod, NULL);
     tasking_start_init_proc();
     ksys1(SYS_EXIT, 0);
 }
@@ -81,6 +89,11 @@ void stage3(boot_args_t* boot_args)
     // mem setup
     pmm_setup(boot_args);
     vmm_setup(boot_args);
+    vm_asid_init();
+    pmm_setup_buddy();
+    vm_kmap_init();
+    vm_zero_init();
+    vm_lru_init();
 
     platform_setup_boot_cpu();
     boot_cpu_finish(&__boot_cpu_setup_devices);
@@ -121,6 +134,7 @@ void boot_secondary_cpu()
 
     wait_for_boot_cpu_to_finish(&__boot_cpu_setup_devices);
     vmm_setup_secondary_cpu();
+    vm_asid_setup_secondary_cpu();
     platform_setup_secondary_cpu();
 
     wait_for_boot_cpu_to_finish(&__boot_cpu_setup_tasking);
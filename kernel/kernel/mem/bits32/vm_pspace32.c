@@ -12,7 +12,9 @@
 #include <libkern/log.h>
 #include <mem/kmemzone.h>
 #include <mem/memzone.h>
+#include <mem/swapfile.h>
 #include <mem/vm_alloc.h>
+#include <mem/vm_kmap.h>
 #include <mem/vm_pspace.h>
 #include <mem/vmm.h>
 #include <platform/generic/cpu.h>
@@ -33,6 +35,12 @@ static kmemzone_t pspace_zone;
 
 const ptable_lv_t PSPACE_TABLE_LV = PTABLE_LV0;
 
+// RAM is not direct mapped on 32bit machines, frames are accessed with kmap windows.
+void* vm_kmap_direct_impl(uintptr_t paddr)
+{
+    return NULL;
+}
+
 ptable_t* vm_pspace_get_nth_active_ptable(size_t n, ptable_lv_t lv)
 {
     ASSERT(lv == PTABLE_LV0);
@@ -91,10 +99,7 @@ void vm_pspace_gen(ptable_t* pdir)
     ptable_t* cur_ptable = vm_pspace_get_nth_active_ptable(VMM_OFFSET_IN_DIRECTORY(pspace_zone.start), PTABLE_LV0);
     uintptr_t ptable_paddr = vm_alloc_ptables_to_cover_page();
     ASSERT(ptable_paddr);
-    kmemzone_t tmp_zone = kmemzone_new(VMM_PAGE_SIZE);
-    ptable_t* new_ptable = (ptable_t*)tmp_zone.start;
-
-    vmm_map_page_locked((uintptr_t)new_ptable, ptable_paddr, MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE);
+    ptable_t* new_ptable = (ptable_t*)vm_kmap_atomic(ptable_paddr, VM_KMAP_SLOT_DST);
 
     /* The code assumes that the length of tables which cover pspace
        is 4KB and that the tables are fit in a single page and are continuous. */
@@ -119,8 +124,7 @@ void vm_pspace_gen(ptable_t* pdir)
 
         pdir->entities[VMM_OFFSET_IN_DIRECTORY(ptable_vaddr_for)] = pspace_table;
     }
-    vmm_unmap_page_locked((uintptr_t)new_ptable);
-    kmemzone_free(tmp_zone);
+    vm_kunmap_atomic(new_ptable, VM_KMAP_SLOT_DST);
 }
 
 /**
@@ -195,13 +199,19 @@ ptable_entity_t* vm_get_entity(uintptr_t vaddr, ptable_lv_t lv)
     return vm_lookup(ptable, lv, vaddr);
 }
 
-static int vm_pspace_free_page_locked(uintptr_t vaddr, ptable_entity_t* page, dynamic_array_t* zones)
+static int vm_pspace_free_page_locked(uintptr_t vaddr, ptable_entity_t* page, rb_tree_t* zones)
 {
     if (vmm_is_copy_on_write(vaddr)) {
         return -EBUSY;
     }
 
+    // A swapped out page keeps the id of its slot in the frame bits.
     if (!vm_ptable_entity_is_present(page, PTABLE_LV0)) {
+        uintptr_t swap_id = vm_ptable_entity_get_frame(page, PTABLE_LV0) >> PAGE_DESC_FRAME_OFFSET;
+        if (swap_id) {
+            swapfile_rem_ref(swap_id);
+            vm_ptable_entity_invalidate(page, PTABLE_LV0);
+        }
         return 0;
     }
 
@@ -219,6 +229,42 @@ static int vm_pspace_free_page_locked(uintptr_t vaddr, ptable_entity_t* page, dy
     return 0;
 }
 
+/**
+ * @brief Drops the reference to ptables shared after fork. The last owner
+ *        takes them and frees as usual, others just forget them.
+ *
+ * @return -EBUSY if ptables are still used by other address spaces.
+ */
+static int vm_pspace_leave_cow_ptables_locked(uintptr_t vaddr)
+{
+    vm_address_space_t* active_address_space = THIS_CPU->active_address_space;
+    size_t ptables_per_page = VMM_PAGE_SIZE / PTABLE_SIZE(PTABLE_LV0);
+    size_t table_coverage = VMM_PAGE_SIZE * PTABLE_ENTITY_COUNT(PTABLE_LV0);
+    uintptr_t ptable_serve_vaddr_start = (vaddr / (table_coverage * ptables_per_page)) * (table_coverage * ptables_per_page);
+
+    ptable_entity_t* ptable_desc = vm_lookup(active_address_space->pdir, PTABLE_LV_TOP, vaddr);
+    uintptr_t ptables_paddr = PAGE_START(vm_ptable_entity_get_frame(ptable_desc, PTABLE_LV_TOP));
+    bool last_owner = vm_unref_page_paddr(ptables_paddr);
+
+    for (uintptr_t i = 0, pvaddr = ptable_serve_vaddr_start; i < ptables_per_page; i++, pvaddr += table_coverage) {
+        ptable_entity_t* ptable_desc_c = vm_lookup(active_address_space->pdir, PTABLE_LV_TOP, pvaddr);
+        if (!vm_ptable_entity_is_present(ptable_desc_c, PTABLE_LV_TOP)) {
+            continue;
+        }
+
+        if (last_owner) {
+            vm_ptable_entity_rm_mmu_flags(ptable_desc_c, PTABLE_LV_TOP, MMU_FLAG_COW);
+#ifdef TABLE_LEVEL_WRITE_PROTECTION
+            vm_ptable_entity_set_mmu_flags(ptable_desc_c, PTABLE_LV_TOP, MMU_FLAG_PERM_WRITE);
+#endif
+        } else {
+            vm_ptable_entity_invalidate(ptable_desc_c, PTABLE_LV_TOP);
+        }
+    }
+
+    return last_owner ? 0 : -EBUSY;
+}
+
 static int vm_pspace_free_ptable_locked(uintptr_t vaddr)
 {
     // TODO: Free ptable and free page functions should be reimplemented with usage of level.
@@ -228,15 +274,18 @@ static int vm_pspace_free_ptable_locked(uintptr_t vaddr)
         return -EACCES;
     }
 
-    if (vmm_is_copy_on_write(vaddr)) {
-        return -EFAULT;
-    }
-
     ptable_entity_t* ptable_desc = vm_lookup(active_address_space->pdir, PTABLE_LV_TOP, vaddr);
     if (!vm_ptable_entity_is_present(ptable_desc, PTABLE_LV_TOP)) {
         return -EFAULT;
     }
 
+    if (vmm_is_copy_on_write(vaddr)) {
+        int err = vm_pspace_leave_cow_ptables_locked(vaddr);
+        if (err) {
+            return err;
+        }
+    }
+
     // Entering allocated state, since table is alloacted but not valid.
     // Allocated state will remove TABLE_DESC_PRESENT flag.
     uintptr_t frame = vm_ptable_entity_get_frame(ptable_desc, PTABLE_LV_TOP);
@@ -258,7 +307,7 @@ static int vm_pspace_free_ptable_locked(uintptr_t vaddr)
     // Check if it is possible to delete the whole page of tables.
     for (uintptr_t i = 0, pvaddr = ptable_serve_vaddr_start; i < ptables_per_page; i++, pvaddr += table_coverage) {
         ptable_entity_t* ptable_desc_c = vm_lookup(active_address_space->pdir, PTABLE_LV_TOP, pvaddr);
-        if (vm_ptable_entity_is_present(ptable_desc, PTABLE_LV_TOP)) {
+        if (vm_ptable_entity_is_present(ptable_desc_c, PTABLE_LV_TOP)) {
             return 0;
         }
     }
@@ -14,7 +14,11 @@
 #include <mem/kmemzone.h>
 #include <mem/swapfile.h>
 #include <mem/vm_alloc.h>
+#include <mem/vm_asid.h>
+#include <mem/vm_kmap.h>
+#include <mem/vm_lru.h>
 #include <mem/vm_pspace.h>
+#include <mem/vm_zero.h>
 #include <mem/vmm.h>
 #include <platform/generic/cpu.h>
 #include <platform/generic/system.h>
@@ -47,7 +51,7 @@ static bool _vmm_create_kernel_ptables();
 static bool _vmm_map_kernel();
 
 int vmm_resolve_copy_on_write(uintptr_t vaddr);
-static int _vmm_copy_page_to_resolve_cow(uintptr_t vaddr, ptable_entity_t* old_page_desc);
+static int _vmm_share_page_to_resolve_cow(uintptr_t vaddr, ptable_entity_t* old_page_desc);
 
 static bool _vmm_is_page_swapped_entity(ptable_entity_t* page_desc);
 static bool _vmm_is_page_swapped(uintptr_t vaddr);
@@ -226,8 +230,9 @@ int vmm_setup(boot_args_t* args)
     kmemzone_init_stage2();
     kmalloc_init();
 
-    // After kmalloc is set up, we can allocate dynarr for zones.
-    dynarr_init_of_size(memzone_t, &_vmm_kernel_address_space.zones, 4);
+    // After kmalloc is set up, we can allocate zones.
+    memzone_init_cache();
+    memzone_init_zones(&_vmm_kernel_address_space);
     vmm_init_setup_finished = 1;
     return 0;
 }
@@ -449,6 +454,7 @@ int vmm_unmap_page_locked_impl(uintptr_t vaddr)
  */
 
 extern int vmm_alloc_page_locked(uintptr_t vaddr, mmu_flags_t mmu_flags);
+int vmm_alloc_page_no_fill_locked_impl(uintptr_t vaddr, mmu_flags_t mmu_flags);
 
 /**
  * @brief Marks both page tables as COW.
@@ -458,6 +464,12 @@ static void _vmm_tables_set_cow(size_t table_index, ptable_entity_t* cur, ptable
     vm_ptable_entity_set_mmu_flags(cur, lv, MMU_FLAG_COW);
     vm_ptable_entity_set_mmu_flags(new, lv, MMU_FLAG_COW);
 
+#ifdef TABLE_LEVEL_WRITE_PROTECTION
+    // Pages are write-protected by the table descriptors, leaf entries are
+    // left as is until the tables are split.
+    vm_ptable_entity_rm_mmu_flags(cur, lv, MMU_FLAG_PERM_WRITE);
+    vm_ptable_entity_rm_mmu_flags(new, lv, MMU_FLAG_PERM_WRITE);
+#else
     // Marking all pages as not-writable to handle COW. Later will restore using zones data.
     ptable_t* ptable = vm_pspace_get_nth_active_ptable(table_index, lower_level(lv));
     for (int i = 0; i < PTABLE_ENTITY_COUNT(lower_level(lv)); i++) {
@@ -466,15 +478,45 @@ static void _vmm_tables_set_cow(size_t table_index, ptable_entity_t* cur, ptable
             vm_ptable_entity_rm_mmu_flags(page, lower_level(lv), MMU_FLAG_PERM_WRITE);
         }
     }
+#endif
+}
+
+#ifdef TABLE_LEVEL_WRITE_PROTECTION
+/**
+ * @brief Removes write permission from pages of shared ptables, since they
+ * are going to be shared with the tables of the splitting address space.
+ */
+static void _vmm_write_protect_shared_ptables(ptable_t* root_ptable, ptable_entity_t* group_table_desc)
+{
+    const size_t ptables_per_page = VMM_PAGE_SIZE / PTABLE_SIZE(PTABLE_LV0);
+    for (int ptable_idx = 0; ptable_idx < ptables_per_page; ptable_idx++) {
+        if (!vm_ptable_entity_is_present(&group_table_desc[ptable_idx], PTABLE_LV_TOP)) {
+            continue;
+        }
+
+        for (int page_idx = 0; page_idx < PTABLE_ENTITY_COUNT(PTABLE_LV0); page_idx++) {
+            ptable_entity_t* page_desc = &root_ptable->entities[ptable_idx * PTABLE_ENTITY_COUNT(PTABLE_LV0) + page_idx];
+            if (vm_ptable_entity_is_present(page_desc, PTABLE_LV0)) {
+                vm_ptable_entity_rm_mmu_flags(page_desc, PTABLE_LV0, MMU_FLAG_PERM_WRITE);
+            }
+        }
+    }
+}
+#endif
+
+static inline bool _vmm_zone_is_private(memzone_t* zone)
+{
+    return !TEST_FLAG(zone->type, ZONE_TYPE_DEVICE) && !TEST_FLAG(zone->type, ZONE_TYPE_MAPPED_FILE_SHAREDLY);
 }
 
 /**
- * @brief Copies data from one page to another to resolve CoW
- * for an active address space.
+ * @brief Maps the page of the old ptables to the new ones to resolve CoW
+ * for an active address space. Private pages stay shared and read-only,
+ * they are copied on the first write.
  *
  * @note Only to resolve CoW.
  */
-static int _vmm_copy_page_to_resolve_cow(uintptr_t vaddr, ptable_entity_t* old_page_desc)
+static int _vmm_share_page_to_resolve_cow(uintptr_t vaddr, ptable_entity_t* old_page_desc)
 {
     vm_address_space_t* active_address_space = vmm_get_active_address_space();
     if (!active_address_space) {
@@ -487,30 +529,50 @@ static int _vmm_copy_page_to_resolve_cow(uintptr_t vaddr, ptable_entity_t* old_p
         return -EFAULT;
     }
 
-    if (TEST_FLAG(zone->type, ZONE_TYPE_DEVICE) || TEST_FLAG(zone->type, ZONE_TYPE_MAPPED_FILE_SHAREDLY)) {
-        uintptr_t old_page_paddr = vm_ptable_entity_get_frame(old_page_desc, PTABLE_LV0);
+    uintptr_t old_page_paddr = vm_ptable_entity_get_frame(old_page_desc, PTABLE_LV0);
+    if (TEST_FLAG(zone->type, ZONE_TYPE_DEVICE)) {
         return vmm_map_page_locked(vaddr, old_page_paddr, zone->mmu_flags);
     }
 
-    vmm_alloc_page_locked(vaddr, zone->mmu_flags);
-
-    /* Mapping the old page to do a copy */
-    kmemzone_t tmp_zone = kmemzone_new(VMM_PAGE_SIZE);
-    uintptr_t old_page_vaddr = (uintptr_t)tmp_zone.start;
-    uintptr_t old_page_paddr = vm_ptable_entity_get_frame(old_page_desc, PTABLE_LV0);
-    int err = vmm_map_page_locked(old_page_vaddr, old_page_paddr, MMU_FLAG_PERM_READ);
-    if (err) {
-        return err;
+    vm_ref_page_paddr(old_page_paddr);
+    if (TEST_FLAG(zone->type, ZONE_TYPE_MAPPED_FILE_SHAREDLY)) {
+        return vmm_map_page_locked(vaddr, old_page_paddr, zone->mmu_flags);
     }
+    return vmm_map_page_locked(vaddr, old_page_paddr, zone->mmu_flags & ~MMU_FLAG_PERM_WRITE);
+}
+
+/**
+ * @brief Drops pages of ptables which were left by all address spaces
+ * sharing them.
+ */
+static void _vmm_free_cow_ptables_pages(ptable_t* src_ptable, ptable_entity_t* orig_table_desc, uintptr_t table_start)
+{
+    vm_address_space_t* active_address_space = vmm_get_active_address_space();
+    const size_t ptables_per_page = VMM_PAGE_SIZE / PTABLE_SIZE(PTABLE_LV0);
+    for (int ptable_idx = 0; ptable_idx < ptables_per_page; ptable_idx++) {
+        if (!vm_ptable_entity_is_present(&orig_table_desc[ptable_idx], PTABLE_LV_TOP)) {
+            continue;
+        }
+
+        for (int page_idx = 0; page_idx < PTABLE_ENTITY_COUNT(PTABLE_LV0); page_idx++) {
+            size_t offset_in_table_set = ptable_idx * PTABLE_ENTITY_COUNT(PTABLE_LV0) + page_idx;
+            uintptr_t page_vaddr = table_start + (offset_in_table_set * VMM_PAGE_SIZE);
+            ptable_entity_t* page_desc = &src_ptable->entities[offset_in_table_set];
+            if (_vmm_is_page_swapped_entity(page_desc)) {
+                swapfile_rem_ref(vm_ptable_entity_get_frame(page_desc, PTABLE_LV0) >> PAGE_DESC_FRAME_OFFSET);
+                continue;
+            }
 
-    // We don't need to check if there is a problem with cow, since this is a special copy function
-    // to resolve cow. So, we know that pages were created recently. Checking cow here would cause an
-    // ub, since table has not been setup correctly yet.
-    memcpy((void*)vaddr, (void*)old_page_vaddr, VMM_PAGE_SIZE);
+            if (!vm_ptable_entity_is_present(page_desc, PTABLE_LV0)) {
+                continue;
+            }
 
-    vmm_unmap_page_locked(old_page_vaddr);
-    kmemzone_free(tmp_zone);
-    return 0;
+            memzone_t* zone = memzone_find(active_address_space, page_vaddr);
+            if (zone && !TEST_FLAG(zone->type, ZONE_TYPE_DEVICE)) {
+                vm_free_page_paddr(vm_ptable_entity_get_frame(page_desc, PTABLE_LV0));
+            }
+        }
+    }
 }
 
 static bool vmm_is_copy_on_write_impl(uintptr_t vaddr, ptable_lv_t lv)
@@ -539,6 +601,69 @@ bool vmm_is_copy_on_write(uintptr_t vaddr)
     return vmm_is_copy_on_write_impl(vaddr, PTABLE_LV_TOP);
 }
 
+/**
+ * @brief Checks if a page of an active address space is left read-only
+ *        after fork, while its zone is writable.
+ *
+ * @param vaddr The virtual address to examine.
+ * @return Boolean, showing if the page should be resolved before writing.
+ */
+bool vmm_is_page_copy_on_write(uintptr_t vaddr)
+{
+    if (vmm_is_copy_on_write(vaddr)) {
+        return false;
+    }
+
+    ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
+    if (!page_desc || !vm_ptable_entity_is_present(page_desc, PTABLE_LV0)) {
+        return false;
+    }
+
+    if (TEST_FLAG(vm_arch_to_mmu_flags(page_desc, PTABLE_LV0), MMU_FLAG_PERM_WRITE)) {
+        return false;
+    }
+
+    memzone_t* zone = memzone_find(vmm_get_active_address_space(), vaddr);
+    return zone && TEST_FLAG(zone->mmu_flags, MMU_FLAG_PERM_WRITE);
+}
+
+/**
+ * @brief Resolves CoW of a page for an active address space. The last
+ *        owner takes the page as is, others copy it.
+ */
+int vmm_resolve_page_copy_on_write(uintptr_t vaddr)
+{
+    vaddr = ROUND_FLOOR(vaddr, VMM_PAGE_SIZE);
+    memzone_t* zone = memzone_find(vmm_get_active_address_space(), vaddr);
+    if (!zone) {
+        return -EFAULT;
+    }
+
+    ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
+    uintptr_t old_page_paddr = vm_ptable_entity_get_frame(page_desc, PTABLE_LV0);
+    if (!_vmm_zone_is_private(zone) || vm_page_paddr_refs(old_page_paddr) == 1) {
+        vm_ptable_entity_set_mmu_flags(page_desc, PTABLE_LV0, MMU_FLAG_PERM_WRITE);
+        system_flush_all_cpus_tlb_entry(vaddr);
+        vm_lru_add_mapped_page(zone, vaddr);
+        return 0;
+    }
+
+    int err = vmm_alloc_page_no_fill_locked_impl(vaddr, zone->mmu_flags);
+    if (err) {
+        return err;
+    }
+
+    /* Mapping the old page to do a copy */
+    void* old_page = vm_kmap_atomic(old_page_paddr, VM_KMAP_SLOT_SRC);
+    memcpy((void*)vaddr, old_page, VMM_PAGE_SIZE);
+    vm_kunmap_atomic(old_page, VM_KMAP_SLOT_SRC);
+
+    system_flush_all_cpus_tlb_entry(vaddr);
+    vm_free_page_paddr(old_page_paddr);
+    vm_lru_add_mapped_page(zone, vaddr);
+    return 0;
+}
+
 /**
  * @brief Resolves CoW for an active address space.
  */
@@ -552,6 +677,26 @@ int vmm_resolve_copy_on_write(uintptr_t vaddr)
     size_t table_coverage = VMM_PAGE_SIZE * PTABLE_ENTITY_COUNT(lower_level(lv));
     uintptr_t ptable_serve_vaddr_start = (vaddr / (table_coverage * ptables_per_page)) * (table_coverage * ptables_per_page);
 
+    // Other address spaces have already left the ptables, so they are taken as is.
+    // Pages are still read-only and are resolved one by one on writing.
+    uintptr_t old_ptables_paddr = PAGE_START(vm_ptable_entity_get_frame(vm_get_entity(vaddr, entity_lv), entity_lv));
+    ptable_entity_t* group_table_desc = vm_get_entity(ptable_serve_vaddr_start, entity_lv);
+    if (vm_page_paddr_refs(old_ptables_paddr) == 1) {
+        for (int it = 0; it < ptables_per_page; it++) {
+            if (vm_ptable_entity_is_present(&group_table_desc[it], entity_lv)) {
+                vm_ptable_entity_rm_mmu_flags(&group_table_desc[it], entity_lv, MMU_FLAG_COW);
+#ifdef TABLE_LEVEL_WRITE_PROTECTION
+                vm_ptable_entity_set_mmu_flags(&group_table_desc[it], entity_lv, MMU_FLAG_PERM_WRITE);
+#endif
+            }
+        }
+#ifdef TABLE_LEVEL_WRITE_PROTECTION
+        // Translations cached while the tables were write-protected are dropped.
+        system_flush_whole_tlb();
+#endif
+        return 0;
+    }
+
     // Copying old ptables which cover the full page. See a comment above vmm_allocate_ptable.
     kmemzone_t src_ptable_zone;
     int err = 0;
@@ -564,6 +709,9 @@ int vmm_resolve_copy_on_write(uintptr_t vaddr)
 
     ptable_t* src_ptable = (ptable_t*)src_ptable_zone.ptr;
     ptable_t* root_ptable = (ptable_t*)PAGE_START((uintptr_t)vm_get_table(vaddr, lower_level(lv)));
+#ifdef TABLE_LEVEL_WRITE_PROTECTION
+    _vmm_write_protect_shared_ptables(root_ptable, group_table_desc);
+#endif
     memcpy(src_ptable, root_ptable, VMM_PAGE_SIZE);
 
     // Saving descriptors of original ptables
@@ -609,13 +757,19 @@ int vmm_resolve_copy_on_write(uintptr_t vaddr)
                 continue;
             }
 
-            err = _vmm_copy_page_to_resolve_cow(page_vaddr, page_desc);
+            err = _vmm_share_page_to_resolve_cow(page_vaddr, page_desc);
             if (err) {
                 return err;
             }
         }
     }
 
+    // Another owner could leave at the same time, the last one frees the tables.
+    if (vm_unref_page_paddr(old_ptables_paddr)) {
+        _vmm_free_cow_ptables_pages(src_ptable, orig_table_desc, table_start);
+        vm_free_ptables_to_cover_page(old_ptables_paddr);
+    }
+
     return vm_free_mapped_zone(src_ptable_zone);
 }
 
@@ -684,13 +838,18 @@ int vmm_restore_swapped_page_locked_impl(uintptr_t vaddr)
     return 0;
 }
 
-int vmm_swap_page_impl(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t vaddr)
+// Copies the page to the swapfile through a kmap window, returns the id of its slot.
+static int _vmm_store_page_to_swapfile_locked(uintptr_t paddr)
 {
-    vm_address_space_t* active_address_space = vmm_get_active_address_space();
-    spinlock_acquire(&active_address_space->lock);
+    void* page = vm_kmap_atomic(paddr, VM_KMAP_SLOT_SRC);
+    int id = swapfile_store((uintptr_t)page);
+    vm_kunmap_atomic(page, VM_KMAP_SLOT_SRC);
+    return id;
+}
 
+int vmm_swap_page_locked_impl(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t vaddr)
+{
     if (!zone) {
-        spinlock_release(&active_address_space->lock);
         return -EINVAL;
     }
 
@@ -699,34 +858,23 @@ int vmm_swap_page_impl(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t va
         swap_mode = zone->ops->swap_page_mode(zone, vaddr);
     }
 
-    if (swap_mode == SWAP_NOT_ALLOWED) {
-        spinlock_release(&active_address_space->lock);
+    // The zero page is shared by everyone and there is nothing to free.
+    if (swap_mode == SWAP_NOT_ALLOWED || vm_is_zero_page_paddr(vm_ptable_entity_get_frame(page_desc, PTABLE_LV0))) {
         return -EPERM;
     }
 
-    kmemzone_t tmp_zone = kmemzone_new(VMM_PAGE_SIZE);
-    uintptr_t old_page_vaddr = (uintptr_t)tmp_zone.start;
-    uintptr_t old_page_paddr = vm_ptable_entity_get_frame(page_desc, PTABLE_LV0);
-    int err = vmm_map_page_locked(old_page_vaddr, old_page_paddr, MMU_FLAG_PERM_READ);
-    if (err) {
-        spinlock_release(&active_address_space->lock);
-        return err;
-    }
-
+    // Dropped pages are loaded again by the zone on the next fault.
     int new_frame = 0;
     if (swap_mode == SWAP_TO_DEV) {
-        new_frame = swapfile_store(old_page_vaddr);
+        new_frame = _vmm_store_page_to_swapfile_locked(vm_ptable_entity_get_frame(page_desc, PTABLE_LV0));
         if (new_frame < 0) {
-            vmm_unmap_page_locked(old_page_vaddr);
-            kmemzone_free(tmp_zone);
-            spinlock_release(&active_address_space->lock);
-            return -1;
+            return new_frame;
         }
     }
 
 #ifdef VMM_DEBUG_SWAP
     uint32_t checksum = 0;
-    uint32_t* old_page_vaddr = (uint32_t*)PAGE_START(old_page_vaddr);
+    uint32_t* old_page_vaddr = (uint32_t*)PAGE_START(vaddr);
     for (int i = 0; i < VMM_PAGE_SIZE / 4; i++) {
         checksum ^= old_page_vaddr[i];
     }
@@ -737,10 +885,6 @@ int vmm_swap_page_impl(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t va
     vm_ptable_entity_invalidate(page_desc, PTABLE_LV0);
     vm_ptable_entity_set_frame(page_desc, PTABLE_LV0, new_frame << PAGE_DESC_FRAME_OFFSET);
     system_flush_all_cpus_tlb_entry(vaddr);
-
-    vmm_unmap_page_locked(old_page_vaddr);
-    kmemzone_free(tmp_zone);
-    spinlock_release(&active_address_space->lock);
     return 0;
 }
 
@@ -790,11 +934,19 @@ int vmm_fill_up_forked_address_space(vm_address_space_t* new_aspace)
     }
     vm_pspace_gen(new_aspace->pdir);
 
+    // Ptables are shared now, every page of them gets a reference for the new owner.
+    uintptr_t last_ptables_paddr = 0;
     for (int i = 0; i < PTABLE_TOP_KERNEL_OFFSET; i++) {
         ptable_entity_t* act_ptable_desc = &active_address_space->pdir->entities[i];
         if (vm_ptable_entity_is_present(act_ptable_desc, PTABLE_LV_TOP)) {
             ptable_entity_t* new_ptable_desc = &new_aspace->pdir->entities[i];
             _vmm_tables_set_cow(i, act_ptable_desc, new_ptable_desc, PTABLE_LV_TOP);
+
+            uintptr_t ptables_paddr = PAGE_START(vm_ptable_entity_get_frame(act_ptable_desc, PTABLE_LV_TOP));
+            if (ptables_paddr != last_ptables_paddr) {
+                vm_ref_page_paddr(ptables_paddr);
+                last_ptables_paddr = ptables_paddr;
+            }
         }
     }
 
@@ -844,6 +996,10 @@ int vmm_tune_page_locked_impl(uintptr_t vaddr, mmu_flags_t mmu_flags)
     ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
     if (vm_ptable_entity_is_present(page_desc, PTABLE_LV0)) {
         uintptr_t frame = vm_ptable_entity_get_frame(page_desc, PTABLE_LV0);
+        if (vm_is_zero_page_paddr(frame)) {
+            // The zero page stays read-only, a private page is given on write.
+            mmu_flags &= ~MMU_FLAG_PERM_WRITE;
+        }
         vm_ptable_entity_set_default_flags(page_desc, PTABLE_LV0);
         vm_ptable_entity_set_mmu_flags(page_desc, PTABLE_LV0, mmu_flags);
         vm_ptable_entity_set_frame(page_desc, PTABLE_LV0, frame);
@@ -889,7 +1045,7 @@ int vmm_switch_address_space_locked_impl(vm_address_space_t* vm_aspace)
         return 0;
     }
     THIS_CPU->active_address_space = vm_aspace;
-    system_set_pdir((uintptr_t)_vmm_convert_vaddr2paddr((uintptr_t)vm_aspace->pdir), 0x0);
+    vm_asid_switch(vm_aspace, (uintptr_t)_vmm_convert_vaddr2paddr((uintptr_t)vm_aspace->pdir), 0x0);
     system_enable_interrupts();
     return 0;
 }
@@ -19,12 +19,24 @@
 #include <platform/generic/system.h>
 
 uintptr_t vm_pspace_paddr_zone_offset = 0x0;
+uintptr_t vm_pspace_paddr_zone_start = 0x0;
 
 void* paddr_to_vaddr(uintptr_t paddr)
 {
     return (void*)(vm_pspace_paddr_zone_offset + (uintptr_t)paddr);
 }
 
+// Only x86 maps physical RAM as cached, other platforms use kmap windows.
+void* vm_kmap_direct_impl(uintptr_t paddr)
+{
+#ifdef __x86_64__
+    if (paddr - vm_pspace_paddr_zone_start < (1ull << 30)) {
+        return paddr_to_vaddr(paddr);
+    }
+#endif
+    return NULL;
+}
+
 void vm_pspace_init(boot_args_t* args)
 {
 }
@@ -16,7 +16,11 @@
 #include <mem/memzone.h>
 #include <mem/swapfile.h>
 #include <mem/vm_alloc.h>
+#include <mem/vm_asid.h>
+#include <mem/vm_kmap.h>
+#include <mem/vm_lru.h>
 #include <mem/vm_pspace.h>
+#include <mem/vm_zero.h>
 #include <mem/vmm.h>
 #include <platform/generic/cpu.h>
 #include <platform/generic/cpuinfo.h>
@@ -53,7 +57,9 @@ static void vmm_setup_paddr_mapped_location(boot_args_t* args)
     uintptr_t paddr = ROUND_FLOOR(args->paddr, 1 << 30);
 
     extern uintptr_t vm_pspace_paddr_zone_offset;
+    extern uintptr_t vm_pspace_paddr_zone_start;
     vm_pspace_paddr_zone_offset = vaddr - paddr;
+    vm_pspace_paddr_zone_start = paddr;
 }
 
 static void vmm_setup_kasan()
@@ -123,7 +129,13 @@ static void vmm_create_kernel_ptables(boot_args_t* args)
     // Note: This area is marked as uncached, since VIVT caches could break translation,
     // since code could change content of a transation table and changes will stuck
     // in VIVT caches and could be not evicted in some scenarios.
+    // x86 caches are physically tagged, so the area is cached there and serves
+    // as a direct map for frame copies.
+#ifdef __x86_64__
+    vm_map_kernel_huge_page_1gb(KERNEL_PADDR_BASE, args->paddr, MMU_FLAG_PERM_WRITE | MMU_FLAG_PERM_READ);
+#else
     vm_map_kernel_huge_page_1gb(KERNEL_PADDR_BASE, args->paddr, MMU_FLAG_PERM_WRITE | MMU_FLAG_PERM_READ | MMU_FLAG_UNCACHED);
+#endif
 
 // Debug mapping, should be removed.
 #ifdef __aarch64__
@@ -150,8 +162,9 @@ int vmm_setup(boot_args_t* args)
     kmemzone_init_stage2();
     kmalloc_init();
 
-    // After kmalloc is set up, we can allocate dynarr for zones.
-    dynarr_init_of_size(memzone_t, &_vmm_kernel_address_space.zones, 4);
+    // After kmalloc is set up, we can allocate zones.
+    memzone_init_cache();
+    memzone_init_zones(&_vmm_kernel_address_space);
     vmm_init_setup_finished = 1;
     return 0;
 }
@@ -162,6 +175,15 @@ int vmm_setup_secondary_cpu() { return -1; }
  * VMM MAP PAGES
  */
 
+// Kernel space is shared by all address spaces, so its pages are kept in TLB on switches.
+static inline mmu_flags_t _vmm_leaf_mmu_flags(uintptr_t vaddr, mmu_flags_t mmu_flags)
+{
+    if (IS_KERNEL_VADDR(vaddr)) {
+        mmu_flags |= MMU_FLAG_GLOBAL;
+    }
+    return mmu_flags;
+}
+
 static int _vmm_map_page_locked_lv0(ptable_t* ptable, uintptr_t vaddr, uintptr_t paddr, mmu_flags_t mmu_flags, ptable_lv_t lv)
 {
     if (!ptable) {
@@ -170,7 +192,7 @@ static int _vmm_map_page_locked_lv0(ptable_t* ptable, uintptr_t vaddr, uintptr_t
 
     ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
     vm_ptable_entity_set_default_flags(page_desc, PTABLE_LV0);
-    vm_ptable_entity_set_mmu_flags(page_desc, PTABLE_LV0, mmu_flags | MMU_FLAG_PERM_READ);
+    vm_ptable_entity_set_mmu_flags(page_desc, PTABLE_LV0, _vmm_leaf_mmu_flags(vaddr, mmu_flags | MMU_FLAG_PERM_READ));
     vm_ptable_entity_set_frame(page_desc, PTABLE_LV0, paddr);
 
 #ifdef VMM_DEBUG
@@ -189,7 +211,7 @@ static int _vmm_map_huge_page_locked_lv(ptable_t* ptable, uintptr_t vaddr, uintp
 
     ptable_entity_t* page_desc = vm_get_entity(vaddr, lv);
     vm_ptable_entity_set_default_flags(page_desc, lv);
-    vm_ptable_entity_set_mmu_flags(page_desc, lv, mmu_flags | MMU_FLAG_PERM_READ | MMU_FLAG_HUGE_PAGE);
+    vm_ptable_entity_set_mmu_flags(page_desc, lv, _vmm_leaf_mmu_flags(vaddr, mmu_flags | MMU_FLAG_PERM_READ | MMU_FLAG_HUGE_PAGE));
     vm_ptable_entity_set_frame(page_desc, lv, paddr);
 
 #ifdef VMM_DEBUG
@@ -313,8 +335,12 @@ int vmm_tune_page_locked_impl(uintptr_t vaddr, mmu_flags_t mmu_flags)
     ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
     if (vm_ptable_entity_is_present(page_desc, PTABLE_LV0)) {
         uintptr_t frame = vm_ptable_entity_get_frame(page_desc, PTABLE_LV0);
+        if (vm_is_zero_page_paddr(frame)) {
+            // The zero page stays read-only, a private page is given on write.
+            mmu_flags &= ~MMU_FLAG_PERM_WRITE;
+        }
         vm_ptable_entity_set_default_flags(page_desc, PTABLE_LV0);
-        vm_ptable_entity_set_mmu_flags(page_desc, PTABLE_LV0, mmu_flags);
+        vm_ptable_entity_set_mmu_flags(page_desc, PTABLE_LV0, _vmm_leaf_mmu_flags(vaddr, mmu_flags));
         vm_ptable_entity_set_frame(page_desc, PTABLE_LV0, frame);
     } else {
         vmm_alloc_page_locked(vaddr, mmu_flags);
@@ -356,6 +382,12 @@ int vmm_alloc_page_no_fill_locked_impl(uintptr_t vaddr, mmu_flags_t mmu_flags)
  */
 
 bool vmm_is_copy_on_write(uintptr_t vaddr) { return false; }
+bool vmm_is_page_copy_on_write(uintptr_t vaddr) { return false; }
+
+int vmm_resolve_page_copy_on_write(uintptr_t vaddr)
+{
+    return 0;
+}
 
 /**
  * @brief Resolves CoW for an active address space if needed.
@@ -379,7 +411,7 @@ int vmm_restore_swapped_page_locked_impl(uintptr_t vaddr)
     return -1;
 }
 
-int vmm_swap_page_impl(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t vaddr)
+int vmm_swap_page_locked_impl(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t vaddr)
 {
     return -1;
 }
@@ -421,7 +453,7 @@ int vmm_fill_up_new_address_space(vm_address_space_t* new_aspace)
     return 0;
 }
 
-static int _vmm_copy_of_aspace(ptable_t* old, ptable_t* new, uintptr_t vaddr, ptable_lv_t lv)
+static int _vmm_copy_of_aspace(vm_address_space_t* new_aspace, ptable_t* old, ptable_t* new, uintptr_t vaddr, ptable_lv_t lv)
 {
     uintptr_t vaddrstart = vaddr;
 
@@ -445,11 +477,19 @@ static int _vmm_copy_of_aspace(ptable_t* old, ptable_t* new, uintptr_t vaddr, pt
                     continue;
                 }
 
+                // The zero page is read-only, so it's shared instead of copying.
+                if (vm_is_zero_page_paddr(old_page_paddr)) {
+                    new->entities[i] = old->entities[i];
+                    vaddrstart += VMM_PAGE_SIZE;
+                    continue;
+                }
+
                 uintptr_t new_child_page_paddr = vm_alloc_page_paddr();
-                memcpy(paddr_to_vaddr(new_child_page_paddr), paddr_to_vaddr(old_page_paddr), VMM_PAGE_SIZE);
+                vm_kmap_copy_frame(new_child_page_paddr, old_page_paddr);
 
                 new->entities[i] = old->entities[i];
                 vm_ptable_entity_set_frame(&new->entities[i], lv, new_child_page_paddr);
+                vm_lru_add(new_child_page_paddr, new_aspace, vaddrstart);
 
 #ifdef VMM_DEBUG
                 log("Copy page[%d] %zx to %zx", i, old_page_paddr, new_child_page_paddr);
@@ -482,7 +522,7 @@ static int _vmm_copy_of_aspace(ptable_t* old, ptable_t* new, uintptr_t vaddr, pt
 #ifdef VMM_DEBUG
                 log("Copy table [%d] %zx to %zx", lv, old_ptable_paddr, new_child_ptable_paddr);
 #endif
-                _vmm_copy_of_aspace(paddr_to_vaddr(old_ptable_paddr), paddr_to_vaddr(new_child_ptable_paddr), vaddrstart, lowerlv);
+                _vmm_copy_of_aspace(new_aspace, paddr_to_vaddr(old_ptable_paddr), paddr_to_vaddr(new_child_ptable_paddr), vaddrstart, lowerlv);
             } else {
                 vm_ptable_entity_invalidate(&new->entities[i], lv);
             }
@@ -503,7 +543,7 @@ int vmm_fill_up_forked_address_space(vm_address_space_t* new_aspace)
 #endif
 
     // TODO: Implement CoW.
-    _vmm_copy_of_aspace(active_address_space->pdir, new_aspace->pdir, 0x0, PTABLE_LV_TOP);
+    _vmm_copy_of_aspace(new_aspace, active_address_space->pdir, new_aspace->pdir, 0x0, PTABLE_LV_TOP);
     system_flush_whole_tlb();
     spinlock_release(&active_address_space->lock);
     return 0;
@@ -539,8 +579,7 @@ int vmm_switch_address_space_locked_impl(vm_address_space_t* vm_aspace)
         return 0;
     }
     THIS_CPU->active_address_space = vm_aspace;
-    system_set_pdir(_vmm_convert_vaddr2paddr((uintptr_t)vm_aspace->pdir), _vmm_kernel_pdir1_paddr);
-    system_flush_whole_tlb();
+    vm_asid_switch(vm_aspace, _vmm_convert_vaddr2paddr((uintptr_t)vm_aspace->pdir), _vmm_kernel_pdir1_paddr);
     system_enable_interrupts();
     return 0;
 }
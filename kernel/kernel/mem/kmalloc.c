@@ -13,6 +13,7 @@
 #include <libkern/log.h>
 #include <mem/kmalloc.h>
 #include <mem/kmemzone.h>
+#include <mem/slab.h>
 
 struct kmalloc_header {
     size_t len;
@@ -25,6 +26,16 @@ static size_t _kmalloc_bitmap_len = 0;
 static uint8_t* _kmalloc_bitmap;
 static bitmap_t bitmap;
 
+// Small allocations are served by size-classed slab caches.
+static const size_t _kmalloc_class_sizes[KMALLOC_CLASSES_COUNT] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 };
+static const char* _kmalloc_class_names[KMALLOC_CLASSES_COUNT] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64", "kmalloc-96",
+    "kmalloc-128", "kmalloc-192", "kmalloc-256", "kmalloc-384", "kmalloc-512"
+};
+static kmem_cache_t _kmalloc_caches[KMALLOC_CLASSES_COUNT];
+static uint8_t _kmalloc_class_of[KMALLOC_MAX_CLASS_SIZE / 16 + 1];
+static bool _kmalloc_caches_ready = false;
+
 static inline uintptr_t kmalloc_to_vaddr(int start)
 {
     uintptr_t vaddr = (uintptr_t)_kmalloc_zone.start + start * KMALLOC_BLOCK_SIZE;
@@ -50,15 +61,57 @@ static void _kmalloc_init_bitmap()
     bitmap_set_range(bitmap, kmalloc_to_index((uintptr_t)_kmalloc_bitmap), blocks_needed);
 }
 
+static void _kmalloc_init_caches()
+{
+    kmem_slab_init();
+
+    int class = 0;
+    for (int i = 0; i <= KMALLOC_MAX_CLASS_SIZE / 16; i++) {
+        while (_kmalloc_class_sizes[class] < i * 16) {
+            class++;
+        }
+        _kmalloc_class_of[i] = class;
+    }
+
+    for (int i = 0; i < KMALLOC_CLASSES_COUNT; i++) {
+        kmem_cache_init(&_kmalloc_caches[i], _kmalloc_class_names[i], _kmalloc_class_sizes[i]);
+    }
+    _kmalloc_caches_ready = true;
+}
+
+// Returns the usable size, which is the size class for slab objects.
+static size_t _kmalloc_size_of(void* ptr)
+{
+    kmem_cache_t* cache = kmem_cache_of(ptr);
+    if (cache) {
+        return cache->obj_size;
+    }
+
+    size_t len = ((kmalloc_header_t*)ptr)[-1].len - sizeof(kmalloc_header_t);
+#ifdef KASAN_ENABLED
+    len -= 16;
+#endif
+    return len;
+}
+
 void kmalloc_init()
 {
     spinlock_init(&_kmalloc_lock);
     _kmalloc_zone = kmemzone_new(KMALLOC_SPACE_SIZE);
     _kmalloc_init_bitmap();
+    _kmalloc_init_caches();
 }
 
 void* kmalloc(size_t size)
 {
+    if (_kmalloc_caches_ready && size <= KMALLOC_MAX_CLASS_SIZE) {
+        kmem_cache_t* cache = &_kmalloc_caches[_kmalloc_class_of[(size + 15) / 16]];
+        void* res = kmem_cache_alloc_sized(cache, size);
+        if (res) {
+            return res;
+        }
+    }
+
     spinlock_acquire(&_kmalloc_lock);
     size_t alloc_size = size;
 #ifdef KASAN_ENABLED
@@ -118,6 +171,12 @@ void kfree(void* ptr)
         return;
     }
 
+    kmem_cache_t* cache = kmem_cache_of(ptr);
+    if (cache) {
+        kmem_cache_free(cache, ptr);
+        return;
+    }
+
     kmalloc_header_t* sptr = (kmalloc_header_t*)ptr;
 
 #ifdef KASAN_ENABLED
@@ -149,7 +208,7 @@ void kfree_aligned(void* ptr)
 
 void* krealloc(void* ptr, size_t new_size)
 {
-    size_t old_size = ((kmalloc_header_t*)ptr)[-1].len;
+    size_t old_size = _kmalloc_size_of(ptr);
     if (old_size == new_size) {
         return ptr;
     }
@@ -159,7 +218,14 @@ void* krealloc(void* ptr, size_t new_size)
         return 0;
     }
 
-    memcpy(new_area, ptr, new_size > old_size ? new_size : old_size);
+#ifdef KASAN_ENABLED
+    // Only the size class of slab objects is known, so the tail could be poisoned.
+    kasan_disable();
+#endif
+    memcpy(new_area, ptr, min(new_size, old_size));
+#ifdef KASAN_ENABLED
+    kasan_enable();
+#endif
     kfree(ptr);
 
     return new_area;
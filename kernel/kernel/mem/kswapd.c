@@ -6,144 +6,241 @@
  * found in the LICENSE file.
  */
 
-#include <fs/vfs.h>
+#include <libkern/atomic.h>
 #include <libkern/bits/errno.h>
 #include <libkern/log.h>
 #include <mem/kswapd.h>
+#include <mem/memzone.h>
+#include <mem/pmm.h>
 #include <mem/swapfile.h>
+#include <mem/vm_alloc.h>
+#include <mem/vm_lru.h>
+#include <mem/vm_pspace.h>
 #include <mem/vmm.h>
+#include <platform/generic/cpu.h>
+#include <platform/generic/system.h>
 #include <syscalls/handlers.h>
 #include <tasking/tasking.h>
+#include <tasking/wait_queue.h>
 
 // #define KSWAPD_DEBUG
 #define KSWAPD_SLEEPTIME (3) // seconds.
-#define KSWAPD_SWAP_PER_PID_THRESHOLD (2)
-#define KSWAPD_SWAP_PER_RUN_THRESHOLD (4)
-
-static kmemzone_t _mapzone;
-static uintptr_t _mmaped_ptable;
-static int moved_out_pages_per_run = 0;
-static int moved_out_pages_per_pid = 0;
-static int faild_pages = 0;
-static int last_pid = 0, last_pti = 0;
-extern proc_t proc[MAX_PROCESS_COUNT];
-
-static int map_ptable(ptable_entity_t* ptable_desc)
-{
-    uintptr_t ptable_paddr = PAGE_START((uintptr_t)vm_ptable_entity_get_frame(ptable_desc, PTABLE_LV1));
-    if (_mmaped_ptable == ptable_paddr) {
-        return 0;
-    }
+#define KSWAPD_RECLAIM_BATCH (SWAPFILE_BATCH_PAGES) // Every reclaimed page could take a place in the batch.
 
-    int err = vmm_map_page(_mapzone.start, ptable_paddr, MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE);
-    if (err) {
-        return err;
-    }
+static wait_queue_t _kswapd_queue;
+static int _kswapd_woken;
 
-    _mmaped_ptable = ptable_paddr;
-    return 0;
+enum KSWAPD_VERDICTS {
+    KSWAPD_RECLAIMED,
+    KSWAPD_ACTIVATE,
+    KSWAPD_DEACTIVATE,
+    KSWAPD_KEEP, // The page could not be examined now, it's rotated.
+    KSWAPD_FORGET, // The page could not be reclaimed at all.
+};
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static bool _kswapd_has_work(thread_t* thread)
+{
+    return pmm_is_below_low_watermark();
 }
 
-inline static void after_page_swap()
+// Called by allocations below the low watermark, so the queue is notified once per pass.
+static void _kswapd_wakeup()
 {
-    moved_out_pages_per_run++;
-    moved_out_pages_per_pid++;
-    faild_pages = 0;
+    if (atomic_exchange(&_kswapd_woken, true)) {
+        return;
+    }
+    wait_queue_notify_all(&_kswapd_queue);
 }
 
-static void do_sleep()
+static void _kswapd_sleep()
 {
-    moved_out_pages_per_run = 0;
     timespec_t ts;
     ts.tv_sec = KSWAPD_SLEEPTIME;
+    ts.tv_nsec = 0;
     ksys2(SYS_NANOSLEEP, &ts, NULL);
 }
 
-static int find_victim(proc_t* p, ptable_t* pdir)
+// TLB entries are flushed only on the current cpu, so address spaces run by others are skipped.
+static bool _kswapd_is_used_by_other_cpus(vm_address_space_t* aspace)
 {
-    spinlock_acquire(&p->address_space->lock);
-    ptable_t* ptable_map_zone = (ptable_t*)_mapzone.ptr;
-    const size_t ptables_per_page = VMM_PAGE_SIZE / PTABLE_SIZE(PTABLE_LV0);
-    const size_t table_coverage = VMM_PAGE_SIZE * PTABLE_ENTITY_COUNT(PTABLE_LV0);
-
-    for (int pti = last_pti; pti < PTABLE_TOP_KERNEL_OFFSET; pti += ptables_per_page, last_pti += ptables_per_page) {
-        ptable_entity_t* ptable_desc = &pdir->entities[pti];
-        if (!vm_ptable_entity_is_present(ptable_desc, PTABLE_LV1)) {
-            continue;
+    for (int i = 0; i < MAX_CPU_CNT; i++) {
+        if (i != system_cpu_id() && cpus[i].active_address_space == aspace) {
+            return true;
         }
+    }
+    return false;
+}
 
-        map_ptable(ptable_desc);
-        for (int ptii = 0; ptii < ptables_per_page; ptii++) {
-            for (int pgi = 0; pgi < PTABLE_ENTITY_COUNT(PTABLE_LV0); pgi++) {
-                ptable_entity_t* ppage_desc = &ptable_map_zone[ptii].entities[pgi];
-                if (!vm_ptable_entity_is_present(ppage_desc, PTABLE_LV0)) {
-                    continue;
-                }
+/**
+ * @brief Examines the page in its address space, which is active and locked.
+ *        A page which was accessed since the last pass is promoted, a cold
+ *        one is deactivated or moved out if reclaim is set.
+ */
+static int _kswapd_visit_page_locked(vm_lru_victim_t* victim, bool reclaim)
+{
+    uintptr_t vaddr = victim->vaddr;
 
-                uintptr_t victim_vaddr = table_coverage * (pti + ptii) + VMM_PAGE_SIZE * pgi;
-                memzone_t* zone = memzone_find(p->address_space, victim_vaddr);
-#ifdef KSWAPD_DEBUG
-                log("[kswapd] (pid %d) Find victim at %zx", p->pid, victim_vaddr);
-#endif
-                // Should not allow preemption at vmm_swap_page(), since it holds _vmm_lock.
-                // Context switch could freeze cpu, since it would be not be possible to switch
-                // address space. _vmm_lock might need to be replaced with per address space lock.
-                system_disable_interrupts();
-                int err = vmm_swap_page(ppage_desc, zone, victim_vaddr);
-                system_enable_interrupts();
-                if (err) {
-                    faild_pages++;
-                    if (faild_pages > 6) {
-                        spinlock_release(&p->address_space->lock);
-                        faild_pages = 0;
-                        return 0;
-                    }
-                    continue;
-                }
-                after_page_swap();
-                if (moved_out_pages_per_pid >= KSWAPD_SWAP_PER_PID_THRESHOLD) {
-                    spinlock_release(&p->address_space->lock);
-                    return 0;
-                }
-            }
-        }
+    // Pages of ptables shared after fork are mapped by several address spaces.
+    if (vmm_is_copy_on_write(vaddr)) {
+        return KSWAPD_KEEP;
     }
 
-    spinlock_release(&p->address_space->lock);
-    return 0;
+    ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
+    if (!vm_ptable_entity_is_present(page_desc, PTABLE_LV0) || vm_ptable_entity_get_frame(page_desc, PTABLE_LV0) != victim->paddr) {
+        return KSWAPD_FORGET;
+    }
+
+    if (vm_page_paddr_refs(victim->paddr) > 1) {
+        return KSWAPD_FORGET;
+    }
+
+    if (vm_ptable_entity_test_and_clear_accessed(page_desc, PTABLE_LV0)) {
+        // The cleared bit should be seen by the cpu on the next access.
+        system_flush_local_tlb_entry(vaddr);
+        return KSWAPD_ACTIVATE;
+    }
+
+    if (!reclaim) {
+        return KSWAPD_DEACTIVATE;
+    }
+
+    memzone_t* zone = memzone_find(victim->aspace, vaddr);
+    if (!zone) {
+        return KSWAPD_FORGET;
+    }
+
+    int err = vmm_swap_page_locked(page_desc, zone, vaddr);
+    if (err == -EPERM) {
+        return KSWAPD_FORGET;
+    }
+    return err ? KSWAPD_KEEP : KSWAPD_RECLAIMED;
 }
 
-void kswapd()
+static int _kswapd_visit_page(vm_lru_victim_t* victim, bool reclaim)
 {
-    _mapzone = kmemzone_new(VMM_PAGE_SIZE);
+    vm_address_space_t* aspace = victim->aspace;
+    int verdict = KSWAPD_KEEP;
+
+    // The address space is switched, so nothing else should run on this cpu meanwhile.
+    system_disable_interrupts();
+    if (!spinlock_try_acquire(&aspace->lock)) {
+        system_enable_interrupts();
+        return KSWAPD_KEEP;
+    }
+
+    if (!_kswapd_is_used_by_other_cpus(aspace)) {
+        vm_address_space_t* prev_aspace = vmm_get_active_address_space();
+        vmm_switch_address_space_locked(aspace);
+        verdict = _kswapd_visit_page_locked(victim, reclaim);
+        vmm_switch_address_space_locked(prev_aspace);
+    }
+
+    spinlock_release(&aspace->lock);
+    system_enable_interrupts();
+    return verdict;
+}
+
+static void _kswapd_settle_page(vm_lru_victim_t* victim, int verdict, int list)
+{
+    switch (verdict) {
+    case KSWAPD_ACTIVATE:
+        vm_lru_putback(victim->paddr, VM_LRU_ACTIVE);
+        break;
+    case KSWAPD_DEACTIVATE:
+        vm_lru_putback(victim->paddr, VM_LRU_INACTIVE);
+        break;
+    case KSWAPD_KEEP:
+        vm_lru_putback(victim->paddr, list);
+        break;
+    case KSWAPD_FORGET:
+        vm_lru_del(victim->paddr);
+        break;
+    default:
+        // A reclaimed page has left the LRU when it was freed.
+        break;
+    }
+
+    // Could be the last reference if the process has exited meanwhile.
+    vm_address_space_free(victim->aspace);
+}
+
+// Keeps the inactive list at least as long as the active one.
+static void _kswapd_balance_lists()
+{
+    size_t to_scan = vm_lru_count(VM_LRU_ACTIVE);
+    while (to_scan-- && vm_lru_count(VM_LRU_INACTIVE) < vm_lru_count(VM_LRU_ACTIVE)) {
+        vm_lru_victim_t victim;
+        if (!vm_lru_isolate(VM_LRU_ACTIVE, &victim)) {
+            return;
+        }
+
+        int verdict = _kswapd_visit_page(&victim, false);
+        _kswapd_settle_page(&victim, verdict, VM_LRU_ACTIVE);
+    }
+}
+
+/**
+ * @brief Reclaims up to nr_pages from the tail of the inactive list.
+ *        Every page is examined at most once per call. Swapped out pages
+ *        are written in one batch in the background.
+ *
+ * @return The number of reclaimed pages.
+ */
+static int _kswapd_shrink(int nr_pages)
+{
+    int reclaimed = 0;
+    _kswapd_balance_lists();
+    swapfile_begin_batch();
+
+    size_t to_scan = vm_lru_count(VM_LRU_INACTIVE);
+    while (to_scan-- && reclaimed < nr_pages) {
+        vm_lru_victim_t victim;
+        if (!vm_lru_isolate(VM_LRU_INACTIVE, &victim)) {
+            break;
+        }
+
+        int verdict = _kswapd_visit_page(&victim, true);
+        _kswapd_settle_page(&victim, verdict, VM_LRU_INACTIVE);
+        if (verdict == KSWAPD_RECLAIMED) {
+            reclaimed++;
+        }
+    }
+    swapfile_submit_batch();
 
-    for (;;) {
-        if (pmm_get_free_space_in_kb() * 4 >= pmm_get_ram_in_kb()) {
 #ifdef KSWAPD_DEBUG
-            log("[kswapd] Skip pass, %d free of %d, <75%% busy", pmm_get_free_space_in_kb(), pmm_get_ram_in_kb());
+    log("[kswapd] Reclaimed %d pages, %zu active, %zu inactive", reclaimed, vm_lru_count(VM_LRU_ACTIVE), vm_lru_count(VM_LRU_INACTIVE));
 #endif
-            goto sleep;
-        }
+    return reclaimed;
+}
 
-        proc_t* p;
-        for (int i = last_pid; i < tasking_get_proc_count(); i++, last_pid++) {
-            p = &proc[i];
-            if (p->is_kthread) {
-                continue;
-            }
+/**
+ * API FUNCTIONS
+ */
 
-            if (p->status == PROC_ALIVE) {
-                find_victim(p, p->address_space->pdir);
-            }
-            last_pti = 0;
-            moved_out_pages_per_pid = 0;
-            if (moved_out_pages_per_run >= KSWAPD_SWAP_PER_RUN_THRESHOLD) {
-                goto sleep;
+/**
+ * kswapd sleeps until free memory drops below the low watermark and then
+ * reclaims cold pages until the high watermark is reached.
+ */
+void kswapd()
+{
+    wait_queue_init(&_kswapd_queue);
+    _kswapd_woken = false;
+    pmm_set_low_memory_handler(_kswapd_wakeup);
+
+    for (;;) {
+        init_wait_queue_blocker(RUNNING_THREAD, &_kswapd_queue, _kswapd_has_work);
+        atomic_store(&_kswapd_woken, false);
+
+        while (!pmm_is_above_high_watermark()) {
+            if (!_kswapd_shrink(KSWAPD_RECLAIM_BATCH)) {
+                // Nothing could be reclaimed now, pages are given a chance to become cold.
+                _kswapd_sleep();
+                break;
             }
         }
-        last_pid = 0;
-
-    sleep:
-        do_sleep();
     }
-}
\ No newline at end of file
+}
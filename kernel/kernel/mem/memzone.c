@@ -10,8 +10,126 @@
 #include <libkern/bits/errno.h>
 #include <libkern/log.h>
 #include <mem/kmalloc.h>
+#include <mem/slab.h>
 #include <tasking/proc.h>
 
+static kmem_cache_t* _memzone_cache;
+
+/**
+ * ZONES TREE
+ */
+
+static inline memzone_t* _memzone_of(rb_node_t* node)
+{
+    return rb_entry(node, memzone_t, node);
+}
+
+static inline uintptr_t _memzone_end(memzone_t* zone)
+{
+    return zone->vaddr + zone->len;
+}
+
+static void _memzone_augment(rb_node_t* node)
+{
+    memzone_t* zone = _memzone_of(node);
+    size_t subtree_gap = zone->gap;
+    if (node->left) {
+        subtree_gap = max(subtree_gap, _memzone_of(node->left)->subtree_gap);
+    }
+    if (node->right) {
+        subtree_gap = max(subtree_gap, _memzone_of(node->right)->subtree_gap);
+    }
+    zone->subtree_gap = subtree_gap;
+}
+
+static bool _memzone_less(rb_node_t* a, rb_node_t* b)
+{
+    return _memzone_of(a)->vaddr < _memzone_of(b)->vaddr;
+}
+
+// The gap of a zone depends on the previous one, so it's recomputed when neighbours change.
+static void _memzone_update_gap(rb_tree_t* zones, rb_node_t* node)
+{
+    if (!node) {
+        return;
+    }
+
+    memzone_t* zone = _memzone_of(node);
+    rb_node_t* prev = rb_prev(node);
+    zone->gap = zone->vaddr - (prev ? _memzone_end(_memzone_of(prev)) : 0);
+    rb_augment_propagate(zones, node);
+}
+
+static void _memzone_insert(rb_tree_t* zones, memzone_t* zone)
+{
+    zone->gap = 0;
+    rb_insert(zones, &zone->node, _memzone_less);
+    _memzone_update_gap(zones, &zone->node);
+    _memzone_update_gap(zones, rb_next(&zone->node));
+}
+
+static void _memzone_erase(rb_tree_t* zones, memzone_t* zone)
+{
+    rb_node_t* next = rb_next(&zone->node);
+    rb_erase(zones, &zone->node);
+    _memzone_update_gap(zones, next);
+}
+
+// Returns the last zone which starts not after addr.
+static memzone_t* _memzone_floor(rb_tree_t* zones, uintptr_t addr)
+{
+    memzone_t* res = NULL;
+    rb_node_t* node = zones->root;
+    while (node) {
+        memzone_t* zone = _memzone_of(node);
+        if (addr < zone->vaddr) {
+            node = node->left;
+        } else {
+            res = zone;
+            node = node->right;
+        }
+    }
+    return res;
+}
+
+// Returns the zone with the lowest gap of at least len bytes before it.
+static memzone_t* _memzone_lowest_gap(rb_tree_t* zones, size_t len)
+{
+    rb_node_t* node = zones->root;
+    if (!node || _memzone_of(node)->subtree_gap < len) {
+        return NULL;
+    }
+
+    for (;;) {
+        if (node->left && _memzone_of(node->left)->subtree_gap >= len) {
+            node = node->left;
+        } else if (_memzone_of(node)->gap >= len) {
+            return _memzone_of(node);
+        } else {
+            node = node->right;
+        }
+    }
+}
+
+// Returns the zone with the highest gap of at least len bytes before it.
+static memzone_t* _memzone_highest_gap(rb_tree_t* zones, size_t len)
+{
+    rb_node_t* node = zones->root;
+    if (!node || _memzone_of(node)->subtree_gap < len) {
+        return NULL;
+    }
+
+    for (;;) {
+        if (node->right && _memzone_of(node->right)->subtree_gap >= len) {
+            node = node->right;
+        } else if (_memzone_of(node)->gap >= len) {
+            return _memzone_of(node);
+        } else {
+            node = node->left;
+        }
+    }
+}
+
 /**
  * PROC ZONING
  */
@@ -28,53 +146,41 @@ static inline bool _pzones_intersect(size_t start1, size_t size1, size_t start2,
     return (start1 <= start2 && start2 <= end1) || (start1 <= end2 && end2 <= end1) || (start2 <= start1 && start1 <= end2) || (start2 <= end1 && end1 <= end2);
 }
 
-static inline bool _proc_can_fixup_zone(vm_address_space_t* vm_aspace, size_t* start_ptr, int* len_ptr)
-{
-    size_t zones_count = vm_aspace->zones.size;
-
-    for (size_t i = 0; i < zones_count; i++) {
-        memzone_t* zone = (memzone_t*)dynarr_get(&vm_aspace->zones, i);
-        if (_pzones_intersect(*start_ptr, *len_ptr, zone->vaddr, zone->len)) {
-            if (*start_ptr >= zone->vaddr) {
-                int move = (zone->vaddr + zone->len) - (*start_ptr);
-                *start_ptr += move;
-                *len_ptr -= move;
-            } else {
-                int move = (*start_ptr + *len_ptr) - zone->vaddr;
-                *len_ptr -= move;
-            }
-
-            if (*len_ptr <= 0) {
-                return false;
-            }
-        }
-    }
-
-    return true;
-}
-
 static inline bool _proc_can_add_zone(vm_address_space_t* vm_aspace, size_t start, size_t len)
 {
     if (start + len < start || !IS_USER_VADDR(start + len - 1)) {
         return false;
     }
 
-    size_t zones_count = vm_aspace->zones.size;
-    for (size_t i = 0; i < zones_count; i++) {
-        memzone_t* zone = (memzone_t*)dynarr_get(&vm_aspace->zones, i);
-        if (_pzones_intersect(start, len, zone->vaddr, zone->len)) {
-            return false;
-        }
+    // Zones do not overlap, so only the last one starting inside the range could intersect it.
+    memzone_t* zone = _memzone_floor(&vm_aspace->zones, start + len - 1);
+    if (zone && _pzones_intersect(start, len, zone->vaddr, zone->len)) {
+        return false;
     }
 
     return true;
 }
 
-static inline void _proc_swap_zones(memzone_t* one, memzone_t* two)
+void memzone_init_cache()
+{
+    _memzone_cache = kmem_cache_create("memzone", sizeof(memzone_t));
+}
+
+void memzone_init_zones(vm_address_space_t* vm_aspace)
+{
+    rb_tree_init_augmented(&vm_aspace->zones, _memzone_augment);
+    vm_aspace->last_zone = NULL;
+}
+
+// Releases memory of zones, files are left as is.
+void memzone_free_all(vm_address_space_t* vm_aspace)
 {
-    memzone_t tmp = *one;
-    *one = *two;
-    *two = tmp;
+    vm_aspace->last_zone = NULL;
+    while (!rb_empty(&vm_aspace->zones)) {
+        memzone_t* zone = _memzone_of(vm_aspace->zones.root);
+        rb_erase(&vm_aspace->zones, &zone->node);
+        kmem_cache_free(_memzone_cache, zone);
+    }
 }
 
 memzone_t* memzone_split(vm_address_space_t* vm_aspace, memzone_t* zone, uintptr_t addr)
@@ -99,10 +205,12 @@ memzone_t* memzone_split(vm_address_space_t* vm_aspace, memzone_t* zone, uintptr
 
     size_t old_len = zone->len;
     zone->len = orig_zone_len;
+    _memzone_update_gap(&vm_aspace->zones, rb_next(&zone->node));
 
     memzone_t* new_zone = memzone_new(vm_aspace, addr, new_zone_len);
     if (!new_zone) {
         zone->len = old_len;
+        _memzone_update_gap(&vm_aspace->zones, rb_next(&zone->node));
         return NULL;
     }
 
@@ -117,22 +225,23 @@ memzone_t* memzone_new(vm_address_space_t* vm_aspace, size_t start, size_t len)
         len += VMM_PAGE_SIZE - (len % VMM_PAGE_SIZE);
     }
 
-    memzone_t new_zone = { 0 };
-    new_zone.vaddr = start;
-    new_zone.len = len;
-    new_zone.type = 0;
-    new_zone.mmu_flags = MMU_FLAG_NONPRIV;
-    new_zone.ops = NULL;
-
     if (!_proc_can_add_zone(vm_aspace, start, len)) {
         return NULL;
     }
 
-    if (!dynarr_push(&vm_aspace->zones, &new_zone)) {
+    memzone_t* new_zone = kmem_cache_alloc(_memzone_cache);
+    if (!new_zone) {
         return NULL;
     }
 
-    return (memzone_t*)dynarr_get(&vm_aspace->zones, vm_aspace->zones.size - 1);
+    memset(new_zone, 0, sizeof(memzone_t));
+    new_zone->vaddr = start;
+    new_zone->len = len;
+    new_zone->type = 0;
+    new_zone->mmu_flags = MMU_FLAG_NONPRIV;
+    new_zone->ops = NULL;
+    _memzone_insert(&vm_aspace->zones, new_zone);
+    return new_zone;
 }
 
 memzone_t* memzone_new_random(vm_address_space_t* vm_aspace, size_t len)
@@ -141,29 +250,15 @@ memzone_t* memzone_new_random(vm_address_space_t* vm_aspace, size_t len)
         len += VMM_PAGE_SIZE - (len % VMM_PAGE_SIZE);
     }
 
-    size_t min_start = USER_HIGH;
-    size_t zones_count = vm_aspace->zones.size;
-
-    /* Check if we can put it at the beginning */
-    memzone_t* ret = memzone_new(vm_aspace, 0, len);
-    if (ret) {
-        return ret;
-    }
-
-    for (size_t i = 0; i < zones_count; i++) {
-        memzone_t* zone = (memzone_t*)dynarr_get(&vm_aspace->zones, i);
-        if (_proc_can_add_zone(vm_aspace, zone->vaddr + zone->len, len)) {
-            if (min_start > zone->vaddr + zone->len) {
-                min_start = zone->vaddr + zone->len;
-            }
-        }
-    }
-
-    if (min_start == USER_HIGH) {
-        return NULL;
+    /* Check if we can put it at the beginning or between zones */
+    memzone_t* zone = _memzone_lowest_gap(&vm_aspace->zones, len);
+    if (zone) {
+        return memzone_new(vm_aspace, zone->vaddr - zone->gap, len);
     }
 
-    return memzone_new(vm_aspace, min_start, len);
+    /* Otherwise the zone goes after the last one */
+    rb_node_t* last = rb_last(&vm_aspace->zones);
+    return memzone_new(vm_aspace, last ? _memzone_end(_memzone_of(last)) : 0, len);
 }
 
 memzone_t* memzone_new_random_backward(vm_address_space_t* vm_aspace, size_t len)
@@ -172,43 +267,26 @@ memzone_t* memzone_new_random_backward(vm_address_space_t* vm_aspace, size_t len
         len += VMM_PAGE_SIZE - (len % VMM_PAGE_SIZE);
     }
 
-    size_t zones_count = vm_aspace->zones.size;
-
     /* Check if we can put it at the end */
     memzone_t* ret = memzone_new(vm_aspace, USER_HIGH - len + 1, len);
     if (ret) {
         return ret;
     }
 
-    size_t max_end = 0;
-
-    for (size_t i = 0; i < zones_count; i++) {
-        memzone_t* zone = (memzone_t*)dynarr_get(&vm_aspace->zones, i);
-        if (_proc_can_add_zone(vm_aspace, zone->vaddr - len, len)) {
-            if (max_end < zone->vaddr) {
-                max_end = zone->vaddr;
-            }
-        }
-    }
-
-    if (max_end == 0) {
+    memzone_t* zone = _memzone_highest_gap(&vm_aspace->zones, len);
+    if (!zone) {
         return NULL;
     }
 
-    return memzone_new(vm_aspace, max_end - len, len);
+    return memzone_new(vm_aspace, zone->vaddr - len, len);
 }
 
-memzone_t* memzone_find_no_proc(dynamic_array_t* zones, size_t addr)
+memzone_t* memzone_find_no_proc(rb_tree_t* zones, size_t addr)
 {
-    size_t zones_count = zones->size;
-
-    for (size_t i = 0; i < zones_count; i++) {
-        memzone_t* zone = (memzone_t*)dynarr_get(zones, i);
-        if (zone->vaddr <= addr && addr < zone->vaddr + zone->len) {
-            return zone;
-        }
+    memzone_t* zone = _memzone_floor(zones, addr);
+    if (zone && addr < zone->vaddr + zone->len) {
+        return zone;
     }
-
     return NULL;
 }
 
@@ -217,42 +295,56 @@ memzone_t* memzone_find(vm_address_space_t* vm_aspace, size_t addr)
     if (!vm_aspace) {
         return NULL;
     }
-    return memzone_find_no_proc(&vm_aspace->zones, addr);
+
+    memzone_t* zone = vm_aspace->last_zone;
+    if (zone && zone->vaddr <= addr && addr < zone->vaddr + zone->len) {
+        return zone;
+    }
+
+    zone = memzone_find_no_proc(&vm_aspace->zones, addr);
+    if (zone) {
+        vm_aspace->last_zone = zone;
+    }
+    return zone;
 }
 
-int memzone_free_no_proc(dynamic_array_t* zones, memzone_t* givzone)
+int memzone_free_no_proc(rb_tree_t* zones, memzone_t* givzone)
 {
-    size_t zones_count = zones->size;
-
-    for (size_t i = 0; i < zones_count; i++) {
-        memzone_t* zone = (memzone_t*)dynarr_get(zones, i);
-        if (givzone == zone) {
-            if (givzone->file) {
-                file_put(givzone->file);
-            }
-            _proc_swap_zones(zone, dynarr_get(zones, zones_count - 1));
-            dynarr_pop(zones);
-            return 0;
-        }
+    if (!givzone->node.parent && zones->root != &givzone->node) {
+        return -EALREADY;
     }
 
-    return -EALREADY;
+    if (givzone->file) {
+        file_put(givzone->file);
+    }
+    _memzone_erase(zones, givzone);
+    kmem_cache_free(_memzone_cache, givzone);
+    return 0;
 }
 
 int memzone_free(vm_address_space_t* vm_aspace, memzone_t* givzone)
 {
+    if (vm_aspace->last_zone == givzone) {
+        vm_aspace->last_zone = NULL;
+    }
     return memzone_free_no_proc(&vm_aspace->zones, givzone);
 }
 
 int memzone_copy(vm_address_space_t* to_vm_aspace, vm_address_space_t* from_vm_aspace)
 {
-    for (int i = 0; i < from_vm_aspace->zones.size; i++) {
-        memzone_t* zone_to_copy = (memzone_t*)dynarr_get(&from_vm_aspace->zones, i);
+    for (rb_node_t* node = rb_first(&from_vm_aspace->zones); node; node = rb_next(node)) {
+        memzone_t* zone_to_copy = _memzone_of(node);
+        memzone_t* zone = kmem_cache_alloc(_memzone_cache);
+        if (!zone) {
+            return -ENOMEM;
+        }
+
+        *zone = *zone_to_copy;
         if (zone_to_copy->file) {
             file_duplicate(zone_to_copy->file); // For the copied zone.
         }
-        dynarr_push(&to_vm_aspace->zones, zone_to_copy);
+        _memzone_insert(&to_vm_aspace->zones, zone);
     }
 
     return 0;
-}
\ No newline at end of file
+}
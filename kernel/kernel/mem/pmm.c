@@ -7,10 +7,16 @@
  */
 
 #include <algo/bitmap.h>
+#include <libkern/atomic.h>
 #include <libkern/libkern.h>
 #include <libkern/lock.h>
 #include <libkern/log.h>
+#include <libkern/platform.h>
+#include <mem/kmemzone.h>
 #include <mem/pmm.h>
+#include <mem/vmm.h>
+#include <platform/generic/cpu.h>
+#include <platform/generic/system.h>
 
 #define DEBUG_PMM
 
@@ -19,6 +25,8 @@ static void _pmm_allocate_mat();
 
 static pmm_state_t pmm_state;
 static spinlock_t _pmm_global_lock;
+static pmm_pcp_t _pmm_pcps[MAX_CPU_CNT];
+static pmm_low_memory_handler_t _pmm_low_memory_handler;
 
 static inline void* _pmm_block_id_to_ptr(size_t value)
 {
@@ -56,7 +64,7 @@ void _pmm_mark_used_region(size_t region_start, size_t region_len)
     size_t block_id = region_start / PMM_BLOCK_SIZE;
     size_t blocks_len = region_len / PMM_BLOCK_SIZE;
 
-    pmm_state.used_blocks -= blocks_len;
+    pmm_state.used_blocks += blocks_len;
 
     bitmap_set_range(pmm_state.mat, block_id, blocks_len);
 }
@@ -119,6 +127,141 @@ void pmm_setup(boot_args_t* boot_args)
     _pmm_init_from_desc(boot_args);
 }
 
+/**
+ * BUDDY ALLOCATOR
+ */
+
+#define pmm_frame(id) (&pmm_state.buddy.frames[id])
+
+static inline bool _pmm_block_is_used(size_t block_id)
+{
+    return (pmm_state.mat.data[block_id / 8] >> (block_id % 8)) & 1;
+}
+
+static inline int _pmm_order_for(size_t count)
+{
+    int order = 0;
+    while ((1ul << order) < count) {
+        order++;
+    }
+    return order;
+}
+
+static void _pmm_buddy_push(uint32_t block_id, int order)
+{
+    pmm_buddy_t* buddy = &pmm_state.buddy;
+    pmm_frame_t* frame = pmm_frame(block_id);
+    frame->order = order;
+    frame->prev = PMM_FRAME_NONE;
+    frame->next = buddy->free_lists[order];
+    if (frame->next != PMM_FRAME_NONE) {
+        pmm_frame(frame->next)->prev = block_id;
+    }
+    buddy->free_lists[order] = block_id;
+    buddy->free_counts[order]++;
+}
+
+static void _pmm_buddy_remove(uint32_t block_id)
+{
+    pmm_buddy_t* buddy = &pmm_state.buddy;
+    pmm_frame_t* frame = pmm_frame(block_id);
+    if (frame->prev != PMM_FRAME_NONE) {
+        pmm_frame(frame->prev)->next = frame->next;
+    } else {
+        buddy->free_lists[frame->order] = frame->next;
+    }
+    if (frame->next != PMM_FRAME_NONE) {
+        pmm_frame(frame->next)->prev = frame->prev;
+    }
+    buddy->free_counts[frame->order]--;
+    frame->order = PMM_FRAME_USED;
+}
+
+static void _pmm_buddy_free_chunk(uint32_t block_id, int order)
+{
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy_id = block_id ^ (1u << order);
+        if (buddy_id + (1u << order) > pmm_state.max_blocks || pmm_frame(buddy_id)->order != order) {
+            break;
+        }
+        _pmm_buddy_remove(buddy_id);
+        block_id = min(block_id, buddy_id);
+        order++;
+    }
+    _pmm_buddy_push(block_id, order);
+}
+
+// Splits the range into naturally aligned chunks, so any range could be freed.
+static void _pmm_buddy_free_range(uint32_t block_id, size_t count)
+{
+    while (count) {
+        int order = 0;
+        while (order < PMM_MAX_ORDER && !(block_id & (1u << order)) && (2ul << order) <= count) {
+            order++;
+        }
+        _pmm_buddy_free_chunk(block_id, order);
+        block_id += (1u << order);
+        count -= (1ul << order);
+    }
+}
+
+// Chunks over the max order are built of adjacent max order chunks, it's a rare and slow path.
+static int _pmm_buddy_alloc_huge(size_t count)
+{
+    size_t chunks = (count + (1u << PMM_MAX_ORDER) - 1) >> PMM_MAX_ORDER;
+    for (uint32_t id = pmm_state.buddy.free_lists[PMM_MAX_ORDER]; id != PMM_FRAME_NONE; id = pmm_frame(id)->next) {
+        size_t found = 1;
+        while (found < chunks) {
+            uint32_t next_id = id + (found << PMM_MAX_ORDER);
+            if (next_id >= pmm_state.max_blocks || pmm_frame(next_id)->order != PMM_MAX_ORDER) {
+                break;
+            }
+            found++;
+        }
+
+        if (found == chunks) {
+            for (size_t i = 0; i < chunks; i++) {
+                _pmm_buddy_remove(id + (i << PMM_MAX_ORDER));
+            }
+            _pmm_buddy_free_range(id + count, (chunks << PMM_MAX_ORDER) - count);
+            return id;
+        }
+    }
+    return -1;
+}
+
+static int _pmm_buddy_alloc(size_t count, int min_order)
+{
+    int order = max(_pmm_order_for(count), min_order);
+    if (order > PMM_MAX_ORDER) {
+        // Huge chunks are aligned by the max order only.
+        return _pmm_buddy_alloc_huge(count);
+    }
+
+    int cur_order = order;
+    while (cur_order <= PMM_MAX_ORDER && pmm_state.buddy.free_lists[cur_order] == PMM_FRAME_NONE) {
+        cur_order++;
+    }
+    if (cur_order > PMM_MAX_ORDER) {
+        return -1;
+    }
+
+    uint32_t block_id = pmm_state.buddy.free_lists[cur_order];
+    _pmm_buddy_remove(block_id);
+    while (cur_order > order) {
+        cur_order--;
+        _pmm_buddy_push(block_id + (1u << cur_order), cur_order);
+    }
+
+    // Only the requested blocks are taken, the tail goes back.
+    _pmm_buddy_free_range(block_id + count, (1ul << order) - count);
+    return block_id;
+}
+
+/**
+ * MAT ALLOCATOR
+ */
+
 static void* pmm_alloc_blocks(size_t count)
 {
     int block_id = bitmap_find_space(pmm_state.mat, count);
@@ -126,7 +269,7 @@ static void* pmm_alloc_blocks(size_t count)
         return NULL;
     }
     bitmap_set_range(pmm_state.mat, block_id, count);
-    pmm_state.used_blocks += count;
+    atomic_add(&pmm_state.used_blocks, count);
     return _pmm_block_id_to_ptr(block_id);
 }
 
@@ -138,19 +281,34 @@ static void* pmm_alloc_blocks_aligned(size_t count, size_t align)
     }
 
     bitmap_set_range(pmm_state.mat, block_id, count);
-    pmm_state.used_blocks += count;
+    atomic_add(&pmm_state.used_blocks, count);
     return _pmm_block_id_to_ptr(block_id);
 }
 
 static int pmm_free_blocks(size_t block_id, size_t count)
 {
-    pmm_state.used_blocks -= count;
+    atomic_add(&pmm_state.used_blocks, -count);
     return bitmap_unset_range(pmm_state.mat, block_id, count);
 }
 
+static void* pmm_buddy_alloc_blocks(size_t count, int min_order)
+{
+    int block_id = _pmm_buddy_alloc(count, min_order);
+    if (block_id < 0) {
+        return NULL;
+    }
+
+    bitmap_set_range(pmm_state.mat, block_id, count);
+    atomic_add(&pmm_state.used_blocks, count);
+    return _pmm_block_id_to_ptr(block_id);
+}
+
 void* pmm_alloc_locked(size_t size)
 {
     size_t block_count = (size + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+    if (pmm_state.buddy.ready) {
+        return pmm_buddy_alloc_blocks(block_count, 0);
+    }
     return pmm_alloc_blocks(block_count);
 }
 
@@ -158,6 +316,10 @@ void* pmm_alloc_aligned_locked(size_t size, size_t align)
 {
     size_t block_count = (size + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
     size_t block_align = (align + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+    if (pmm_state.buddy.ready) {
+        // Buddy chunks are naturally aligned to their size.
+        return pmm_buddy_alloc_blocks(block_count, _pmm_order_for(block_align));
+    }
     if (block_align == 1) {
         return pmm_alloc_blocks(block_count);
     }
@@ -168,33 +330,193 @@ int pmm_free_locked(void* block, size_t size)
 {
     size_t block_id = _pmm_ptr_to_block_id(block);
     size_t block_count = (size + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+    if (pmm_state.buddy.ready) {
+        _pmm_buddy_free_range(block_id, block_count);
+    }
     return pmm_free_blocks(block_id, block_count);
 }
 
-void* pmm_alloc(size_t size)
+/**
+ * PER-CPU CACHES
+ */
+
+static inline bool _pmm_pcp_fits(size_t size, size_t align)
+{
+    size_t block_count = (size + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+    return pmm_state.buddy.ready && block_count == PMM_PCP_BLOCKS && align <= PMM_PCP_BLOCKS * PMM_BLOCK_SIZE;
+}
+
+// Called with interrupts disabled, takes a batch under one lock acquisition.
+static void _pmm_pcp_refill(pmm_pcp_t* pcp)
 {
     spinlock_acquire(&_pmm_global_lock);
-    void* res = pmm_alloc_locked(size);
+    while (pcp->count < PMM_PCP_BATCH) {
+        int block_id = _pmm_buddy_alloc(PMM_PCP_BLOCKS, ctz32(PMM_PCP_BLOCKS));
+        if (block_id < 0) {
+            break;
+        }
+        bitmap_set_range(pmm_state.mat, block_id, PMM_PCP_BLOCKS);
+        pcp->blocks[pcp->count++] = block_id;
+    }
     spinlock_release(&_pmm_global_lock);
-    return res;
+    pcp->stat_refills++;
 }
 
-void* pmm_alloc_aligned(size_t size, size_t align)
+// Gives the coldest batch back, the hot ones are at the top.
+static void _pmm_pcp_drain(pmm_pcp_t* pcp)
 {
     spinlock_acquire(&_pmm_global_lock);
-    void* res = pmm_alloc_aligned_locked(size, align);
+    for (int i = 0; i < PMM_PCP_BATCH; i++) {
+        _pmm_buddy_free_range(pcp->blocks[i], PMM_PCP_BLOCKS);
+        bitmap_unset_range(pmm_state.mat, pcp->blocks[i], PMM_PCP_BLOCKS);
+    }
     spinlock_release(&_pmm_global_lock);
+
+    pcp->count -= PMM_PCP_BATCH;
+    memmove(pcp->blocks, &pcp->blocks[PMM_PCP_BATCH], pcp->count * sizeof(uint32_t));
+    pcp->stat_drains++;
+}
+
+static void* _pmm_pcp_alloc()
+{
+    system_disable_interrupts();
+    pmm_pcp_t* pcp = &_pmm_pcps[system_cpu_id()];
+    if (pcp->count) {
+        pcp->stat_hits++;
+    } else {
+        pcp->stat_misses++;
+        _pmm_pcp_refill(pcp);
+        if (!pcp->count) {
+            system_enable_interrupts();
+            return NULL;
+        }
+    }
+
+    uint32_t block_id = pcp->blocks[--pcp->count];
+    system_enable_interrupts();
+    atomic_add(&pmm_state.used_blocks, PMM_PCP_BLOCKS);
+    return _pmm_block_id_to_ptr(block_id);
+}
+
+static void _pmm_pcp_free(uint32_t block_id)
+{
+    system_disable_interrupts();
+    pmm_pcp_t* pcp = &_pmm_pcps[system_cpu_id()];
+    if (pcp->count == PMM_PCP_SIZE) {
+        _pmm_pcp_drain(pcp);
+    }
+    pcp->blocks[pcp->count++] = block_id;
+    pcp->stat_frees++;
+    system_enable_interrupts();
+    atomic_add(&pmm_state.used_blocks, -PMM_PCP_BLOCKS);
+}
+
+// The handler is called on every allocation below the watermark, it should be cheap.
+static inline void _pmm_check_low_watermark()
+{
+    pmm_low_memory_handler_t handler = _pmm_low_memory_handler;
+    if (handler && pmm_is_below_low_watermark()) {
+        handler();
+    }
+}
+
+void* pmm_alloc(size_t size)
+{
+    void* res;
+    if (_pmm_pcp_fits(size, PMM_BLOCK_SIZE)) {
+        res = _pmm_pcp_alloc();
+    } else {
+        spinlock_acquire(&_pmm_global_lock);
+        res = pmm_alloc_locked(size);
+        spinlock_release(&_pmm_global_lock);
+    }
+
+    _pmm_check_low_watermark();
+    return res;
+}
+
+void* pmm_alloc_aligned(size_t size, size_t align)
+{
+    void* res;
+    if (_pmm_pcp_fits(size, align)) {
+        res = _pmm_pcp_alloc();
+    } else {
+        spinlock_acquire(&_pmm_global_lock);
+        res = pmm_alloc_aligned_locked(size, align);
+        spinlock_release(&_pmm_global_lock);
+    }
+
+    _pmm_check_low_watermark();
     return res;
 }
 
 int pmm_free(void* block, size_t size)
 {
+    // Cached chunks are naturally aligned, so they could serve aligned requests.
+    size_t block_id = _pmm_ptr_to_block_id(block);
+    if (_pmm_pcp_fits(size, PMM_BLOCK_SIZE) && !(block_id % PMM_PCP_BLOCKS)) {
+        _pmm_pcp_free(block_id);
+        return 0;
+    }
+
     spinlock_acquire(&_pmm_global_lock);
     int res = pmm_free_locked(block, size);
     spinlock_release(&_pmm_global_lock);
     return res;
 }
 
+void pmm_setup_buddy()
+{
+    pmm_buddy_t* buddy = &pmm_state.buddy;
+    size_t frames_size = ROUND_CEIL(pmm_state.max_blocks * sizeof(pmm_frame_t), VMM_PAGE_SIZE);
+
+    spinlock_acquire(&_pmm_global_lock);
+    uintptr_t frames_paddr = (uintptr_t)pmm_alloc_aligned_locked(frames_size, VMM_PAGE_SIZE);
+    spinlock_release(&_pmm_global_lock);
+    if (!frames_paddr) {
+        log_warn("PMM: No space for buddy frames, keeping MAT allocator");
+        return;
+    }
+
+    kmemzone_t zone = kmemzone_new(frames_size);
+    vmm_map_pages(zone.start, frames_paddr, frames_size / VMM_PAGE_SIZE, MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE);
+    buddy->frames = (pmm_frame_t*)zone.start;
+
+    spinlock_acquire(&_pmm_global_lock);
+    for (int i = 0; i <= PMM_MAX_ORDER; i++) {
+        buddy->free_lists[i] = PMM_FRAME_NONE;
+        buddy->free_counts[i] = 0;
+    }
+    for (size_t i = 0; i < pmm_state.max_blocks; i++) {
+        buddy->frames[i].shares = 0;
+        buddy->frames[i].order = PMM_FRAME_USED;
+    }
+
+    size_t free_blocks = 0;
+    for (size_t i = 0; i < pmm_state.max_blocks;) {
+        if (_pmm_block_is_used(i)) {
+            i++;
+            continue;
+        }
+
+        size_t start = i;
+        while (i < pmm_state.max_blocks && !_pmm_block_is_used(i)) {
+            i++;
+        }
+        _pmm_buddy_free_range(start, i - start);
+        free_blocks += i - start;
+    }
+
+    pmm_state.used_blocks = pmm_state.max_blocks - free_blocks;
+    pmm_state.low_watermark = pmm_state.max_blocks / PMM_LOW_WATERMARK_DIV;
+    pmm_state.high_watermark = pmm_state.max_blocks / PMM_HIGH_WATERMARK_DIV;
+    buddy->ready = true;
+    spinlock_release(&_pmm_global_lock);
+#ifdef DEBUG_PMM
+    log("PMM: Buddy allocator is set up, %zu free blocks", free_blocks);
+#endif
+}
+
 size_t pmm_get_ram_size()
 {
     return pmm_state.ram_size;
@@ -230,6 +552,66 @@ size_t pmm_get_free_space_in_kb()
     return pmm_get_free_blocks() * (PMM_BLOCK_SIZE / 1024);
 }
 
+bool pmm_is_below_low_watermark()
+{
+    return pmm_get_free_blocks() < pmm_state.low_watermark;
+}
+
+bool pmm_is_above_high_watermark()
+{
+    return pmm_get_free_blocks() >= pmm_state.high_watermark;
+}
+
+// Sets a function which is called by allocations when free memory drops below the low watermark.
+void pmm_set_low_memory_handler(pmm_low_memory_handler_t handler)
+{
+    _pmm_low_memory_handler = handler;
+}
+
+/**
+ * REFERENCE COUNTING
+ *
+ * An allocated block has one owner. Owners which share it (e.g. pages after
+ * fork) take references, the block is freed by the last one. Only the first
+ * block of an allocation is counted.
+ */
+
+void pmm_ref(void* block)
+{
+    ASSERT(pmm_state.buddy.ready);
+    atomic_add(&pmm_frame(_pmm_ptr_to_block_id(block))->shares, 1);
+}
+
+// Drops a reference, returns true if the caller was the last owner.
+bool pmm_unref(void* block)
+{
+    if (!pmm_state.buddy.ready) {
+        return true;
+    }
+
+    uint32_t* shares = &pmm_frame(_pmm_ptr_to_block_id(block))->shares;
+    uint32_t cur = atomic_load(shares);
+    while (cur) {
+        if (atomic_compare_exchange(shares, &cur, cur - 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t pmm_refs(void* block)
+{
+    if (!pmm_state.buddy.ready) {
+        return 1;
+    }
+    return atomic_load(&pmm_frame(_pmm_ptr_to_block_id(block))->shares) + 1;
+}
+
+const pmm_pcp_t* pmm_get_pcp(int cpu_id)
+{
+    return &_pmm_pcps[cpu_id];
+}
+
 const pmm_state_t* pmm_get_state()
 {
     return &pmm_state;
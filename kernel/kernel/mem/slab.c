@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <libkern/kasan.h>
+#include <libkern/libkern.h>
+#include <libkern/lock.h>
+#include <libkern/log.h>
+#include <mem/kmalloc.h>
+#include <mem/kmemzone.h>
+#include <mem/slab.h>
+#include <platform/generic/system.h>
+
+#define KMEM_KASAN_REDZONE_SIZE 16
+
+static spinlock_t _kmem_slab_lock;
+static kmemzone_t _kmem_slab_zone;
+static uintptr_t _kmem_slab_next;
+static kmem_slab_t* _kmem_slab_free_list;
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static inline kmem_slab_t* _kmem_slab_of(void* obj)
+{
+    return (kmem_slab_t*)ROUND_FLOOR((uintptr_t)obj, KMEM_SLAB_SIZE);
+}
+
+// Free objects are poisoned, so the freelist is accessed with KASAN disabled.
+static inline void* _kmem_obj_next(void* obj)
+{
+#ifdef KASAN_ENABLED
+    kasan_disable();
+    void* next = *(void**)obj;
+    kasan_enable();
+    return next;
+#else
+    return *(void**)obj;
+#endif
+}
+
+static inline void _kmem_obj_set_next(void* obj, void* next)
+{
+#ifdef KASAN_ENABLED
+    kasan_disable();
+    *(void**)obj = next;
+    kasan_enable();
+#else
+    *(void**)obj = next;
+#endif
+}
+
+static void _kmem_slab_list_add(kmem_slab_t** list, kmem_slab_t* slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static void _kmem_slab_list_remove(kmem_slab_t** list, kmem_slab_t* slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = NULL;
+}
+
+static kmem_slab_t* _kmem_slab_new(kmem_cache_t* cache)
+{
+    bool fresh = false;
+    spinlock_acquire(&_kmem_slab_lock);
+    kmem_slab_t* slab = _kmem_slab_free_list;
+    if (slab) {
+        _kmem_slab_free_list = slab->next;
+    } else if (_kmem_slab_next < _kmem_slab_zone.start + _kmem_slab_zone.len) {
+        slab = (kmem_slab_t*)_kmem_slab_next;
+        _kmem_slab_next += KMEM_SLAB_SIZE;
+        fresh = true;
+    }
+    spinlock_release(&_kmem_slab_lock);
+
+    if (!slab) {
+        return NULL;
+    }
+
+    // Slabs are never unmapped, so this is done only once for every slab.
+    if (fresh) {
+        vmm_ensure_writing_to_active_address_space((uintptr_t)slab, KMEM_SLAB_SIZE);
+    }
+
+    uintptr_t objs = (uintptr_t)slab + cache->objs_offset;
+#ifdef KASAN_ENABLED
+    kasan_poison(objs, cache->objs_per_slab * cache->slot_size, KASAN_FREED_OBJECT);
+#endif
+
+    slab->cache = cache;
+    slab->prev = slab->next = NULL;
+    slab->inuse = 0;
+    slab->freelist = NULL;
+    for (int i = cache->objs_per_slab - 1; i >= 0; i--) {
+        void* obj = (void*)(objs + i * cache->slot_size);
+        _kmem_obj_set_next(obj, slab->freelist);
+        slab->freelist = obj;
+    }
+    return slab;
+}
+
+static void _kmem_slab_release(kmem_slab_t* slab)
+{
+    spinlock_acquire(&_kmem_slab_lock);
+    slab->cache = NULL;
+    slab->next = _kmem_slab_free_list;
+    _kmem_slab_free_list = slab;
+    spinlock_release(&_kmem_slab_lock);
+}
+
+static void _kmem_cache_put_obj_locked(kmem_cache_t* cache, void* obj)
+{
+    kmem_slab_t* slab = _kmem_slab_of(obj);
+    if (!slab->freelist) {
+        _kmem_slab_list_add(&cache->partial, slab);
+    }
+
+    _kmem_obj_set_next(obj, slab->freelist);
+    slab->freelist = obj;
+    slab->inuse--;
+
+    // One empty slab is kept to not bounce on the boundary.
+    if (!slab->inuse && (slab->prev || slab->next)) {
+        _kmem_slab_list_remove(&cache->partial, slab);
+        _kmem_slab_release(slab);
+        cache->stat_slabs--;
+    }
+}
+
+// Called with interrupts disabled.
+static void _kmem_cache_refill(kmem_cache_t* cache, kmem_cpu_cache_t* cpu_cache)
+{
+    spinlock_acquire(&cache->lock);
+    while (cpu_cache->count < KMEM_CPU_CACHE_BATCH) {
+        kmem_slab_t* slab = cache->partial;
+        if (!slab) {
+            spinlock_release(&cache->lock);
+            slab = _kmem_slab_new(cache);
+            spinlock_acquire(&cache->lock);
+            if (!slab) {
+                break;
+            }
+            _kmem_slab_list_add(&cache->partial, slab);
+            cache->stat_slabs++;
+            continue;
+        }
+
+        void* obj = slab->freelist;
+        slab->freelist = _kmem_obj_next(obj);
+        slab->inuse++;
+        if (!slab->freelist) {
+            _kmem_slab_list_remove(&cache->partial, slab);
+        }
+        cpu_cache->objs[cpu_cache->count++] = obj;
+    }
+    spinlock_release(&cache->lock);
+}
+
+// Called with interrupts disabled, gives the coldest batch back to slabs.
+static void _kmem_cache_drain(kmem_cache_t* cache, kmem_cpu_cache_t* cpu_cache)
+{
+    spinlock_acquire(&cache->lock);
+    for (int i = 0; i < KMEM_CPU_CACHE_BATCH; i++) {
+        _kmem_cache_put_obj_locked(cache, cpu_cache->objs[i]);
+    }
+    spinlock_release(&cache->lock);
+
+    cpu_cache->count -= KMEM_CPU_CACHE_BATCH;
+    memmove(cpu_cache->objs, &cpu_cache->objs[KMEM_CPU_CACHE_BATCH], cpu_cache->count * sizeof(void*));
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+void kmem_slab_init()
+{
+    spinlock_init(&_kmem_slab_lock);
+    _kmem_slab_zone = kmemzone_new(KMEM_SLAB_SPACE_SIZE);
+    _kmem_slab_next = _kmem_slab_zone.start;
+    _kmem_slab_free_list = NULL;
+}
+
+void kmem_cache_init(kmem_cache_t* cache, const char* name, size_t size)
+{
+    memset(cache, 0, sizeof(kmem_cache_t));
+    spinlock_init(&cache->lock);
+    cache->name = name;
+    cache->obj_size = size;
+
+    size_t slot_size = ROUND_CEIL(max(size, sizeof(void*)), 8);
+#ifdef KASAN_ENABLED
+    slot_size += KMEM_KASAN_REDZONE_SIZE;
+#endif
+    cache->slot_size = slot_size;
+    cache->objs_offset = ROUND_CEIL(sizeof(kmem_slab_t), 8);
+    cache->objs_per_slab = (KMEM_SLAB_SIZE - cache->objs_offset) / slot_size;
+    ASSERT(cache->objs_per_slab);
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, size_t size)
+{
+    kmem_cache_t* cache = kmalloc(sizeof(kmem_cache_t));
+    kmem_cache_init(cache, name, size);
+    return cache;
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache)
+{
+    return kmem_cache_alloc_sized(cache, cache->obj_size);
+}
+
+/**
+ * Allocates an object of the cache, while only size bytes of it are
+ * accessible with KASAN. Used by kmalloc to keep redzones precise.
+ */
+void* kmem_cache_alloc_sized(kmem_cache_t* cache, size_t size)
+{
+    ASSERT(size <= cache->obj_size);
+
+    system_disable_interrupts();
+    kmem_cpu_cache_t* cpu_cache = &cache->cpus[system_cpu_id()];
+    if (!cpu_cache->count) {
+        _kmem_cache_refill(cache, cpu_cache);
+    }
+
+    void* obj = NULL;
+    if (cpu_cache->count) {
+        obj = cpu_cache->objs[--cpu_cache->count];
+    }
+    system_enable_interrupts();
+
+    if (!obj) {
+        return NULL;
+    }
+
+#ifdef KASAN_ENABLED
+    kasan_poison((uintptr_t)obj, cache->slot_size, KASAN_KMALLOC_REDZONE);
+    if (size) {
+        kasan_poison_kmalloc((uintptr_t)obj, size);
+    }
+#endif
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj)
+{
+    if (!obj) {
+        DEBUG_ASSERT("NULL at kmem_cache_free");
+        return;
+    }
+    ASSERT(_kmem_slab_of(obj)->cache == cache);
+
+#ifdef KASAN_ENABLED
+    kasan_poison((uintptr_t)obj, cache->slot_size, KASAN_FREED_OBJECT);
+#endif
+
+    system_disable_interrupts();
+    kmem_cpu_cache_t* cpu_cache = &cache->cpus[system_cpu_id()];
+    if (cpu_cache->count == KMEM_CPU_CACHE_SIZE) {
+        _kmem_cache_drain(cache, cpu_cache);
+    }
+    cpu_cache->objs[cpu_cache->count++] = obj;
+    system_enable_interrupts();
+}
+
+// Returns the cache which owns the object, or NULL if it's not a slab object.
+kmem_cache_t* kmem_cache_of(void* ptr)
+{
+    uintptr_t addr = (uintptr_t)ptr;
+    if (addr < _kmem_slab_zone.start || addr >= _kmem_slab_zone.start + _kmem_slab_zone.len) {
+        return NULL;
+    }
+    return _kmem_slab_of(ptr)->cache;
+}
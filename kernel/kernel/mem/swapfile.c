@@ -8,15 +8,318 @@
 
 #include <fs/vfs.h>
 #include <libkern/bits/errno.h>
+#include <libkern/lock.h>
 #include <libkern/log.h>
 #include <mem/swapfile.h>
+#include <mem/vm_alloc.h>
+#include <mem/zswap.h>
 #include <platform/generic/cpu.h>
+#include <platform/generic/system.h>
+#include <tasking/sched.h>
+#include <tasking/tasking.h>
+#include <tasking/wait_queue.h>
 
 static file_t* _swapfile = NULL;
-static int _nextid = 0;
+
+// Slot ids start from 1, since 0 in a page table entry means that nothing is swapped.
+// The lock is taken with interrupts disabled, since kswapd stores pages with them disabled.
+static spinlock_t _swapfile_lock;
+static uint32_t _swapfile_used_map[SWAPFILE_MAX_SLOTS / 32];
+static uint16_t _swapfile_refs[SWAPFILE_MAX_SLOTS];
+static size_t _swapfile_used_slots = 0;
+static size_t _swapfile_next_cluster = 0;
+static int _swapfile_next_slot = 0;
+
+static swapfile_batch_t _swapfile_batches[SWAPFILE_WRITEBACK_BATCHES];
+static swapfile_batch_t* _swapfile_filling_batch = NULL;
+static uint32_t _swapfile_next_seq = 0;
+static wait_queue_t _swapfile_writeback_queue;
+static wait_queue_t _swapfile_free_batch_queue;
+
+// Readahead is done by one loader at a time, its lock is taken before the swapfile one.
+static spinlock_t _swapfile_ra_lock;
+static kmemzone_t _swapfile_ra_buf;
+static int _swapfile_ra_start = -1;
+static uint32_t _swapfile_ra_valid = 0; // Guarded by the swapfile lock.
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static inline int _swapfile_slot_of(int id)
+{
+    int slot = id - 1;
+    if (slot < 0 || slot >= SWAPFILE_MAX_SLOTS) {
+        return -1;
+    }
+    return slot;
+}
+
+static inline bool _swapfile_slot_is_used(int slot)
+{
+    return (_swapfile_used_map[slot / 32] >> (slot % 32)) & 1;
+}
+
+static inline void _swapfile_take_slot_locked(int slot)
+{
+    _swapfile_used_map[slot / 32] |= (1u << (slot % 32));
+    _swapfile_refs[slot] = 1;
+    _swapfile_used_slots++;
+    _swapfile_next_slot = (slot + 1) % SWAPFILE_MAX_SLOTS;
+}
+
+/**
+ * Slots are taken one after another while they are free, so a batch is
+ * likely to be written in one run. Otherwise a slot is taken from the
+ * cluster of 32 slots where the last one was found. Full clusters are
+ * skipped by one comparison.
+ */
+static int _swapfile_alloc_slot_locked()
+{
+    if (!_swapfile_slot_is_used(_swapfile_next_slot)) {
+        int slot = _swapfile_next_slot;
+        _swapfile_take_slot_locked(slot);
+        return slot;
+    }
+
+    const size_t clusters = SWAPFILE_MAX_SLOTS / 32;
+    for (size_t i = 0; i < clusters; i++) {
+        size_t cluster = (_swapfile_next_cluster + i) % clusters;
+        uint32_t used = _swapfile_used_map[cluster];
+        if (used == 0xffffffff) {
+            continue;
+        }
+
+        int slot = cluster * 32 + __builtin_ctz(~used);
+        _swapfile_take_slot_locked(slot);
+        _swapfile_next_cluster = cluster;
+        return slot;
+    }
+    return -1;
+}
+
+static void _swapfile_free_slot_locked(int slot)
+{
+    _swapfile_used_map[slot / 32] &= ~(1u << (slot % 32));
+    _swapfile_refs[slot] = 0;
+    _swapfile_used_slots--;
+#ifdef ZSWAP_ENABLED
+    zswap_invalidate(slot);
+#endif
+
+    if (_swapfile_ra_start >= 0 && slot >= _swapfile_ra_start && slot < _swapfile_ra_start + SWAPFILE_READAHEAD_PAGES) {
+        _swapfile_ra_valid &= ~(1u << (slot - _swapfile_ra_start));
+    }
+}
+
+// Returns the page of a batch which is not written yet, the newest copy wins.
+static void* _swapfile_find_in_batches_locked(int slot)
+{
+    void* res = NULL;
+    uint32_t res_seq = 0;
+    for (int i = 0; i < SWAPFILE_WRITEBACK_BATCHES; i++) {
+        swapfile_batch_t* batch = &_swapfile_batches[i];
+        if (batch->state == SWAPFILE_BATCH_FREE || (res && batch->seq < res_seq)) {
+            continue;
+        }
+
+        for (int j = batch->count - 1; j >= 0; j--) {
+            if (batch->slots[j] == slot) {
+                res = batch->buf.ptr + j * VMM_PAGE_SIZE;
+                res_seq = batch->seq;
+                break;
+            }
+        }
+    }
+    return res;
+}
+
+static inline bool _swapfile_batch_has_room_locked()
+{
+    return _swapfile_filling_batch && _swapfile_filling_batch->count < SWAPFILE_BATCH_PAGES;
+}
+
+static void _swapfile_add_to_batch_locked(int slot, void* page)
+{
+    swapfile_batch_t* batch = _swapfile_filling_batch;
+    memcpy(batch->buf.ptr + batch->count * VMM_PAGE_SIZE, page, VMM_PAGE_SIZE);
+    batch->slots[batch->count++] = slot;
+}
+
+#ifdef ZSWAP_ENABLED
+// Objects of the full pool are moved to the batch one by one, until the page fits or the batch is full.
+static bool _swapfile_store_compressed_locked(int slot, void* page)
+{
+    int err = zswap_store(slot, page);
+    while (err == -ENOSPC && _swapfile_batch_has_room_locked()) {
+        swapfile_batch_t* batch = _swapfile_filling_batch;
+        int old_slot = zswap_writeback(batch->buf.ptr + batch->count * VMM_PAGE_SIZE);
+        if (old_slot < 0) {
+            return false;
+        }
+        batch->slots[batch->count++] = old_slot;
+        err = zswap_store(slot, page);
+    }
+    return !err;
+}
+
+static inline int _swapfile_load_compressed_locked(int slot, void* page)
+{
+    return zswap_load(slot, page);
+}
+
+static inline bool _swapfile_is_compressed_locked(int slot)
+{
+    return zswap_contains(slot);
+}
+#else
+static inline bool _swapfile_store_compressed_locked(int slot, void* page)
+{
+    return false;
+}
+
+static inline int _swapfile_load_compressed_locked(int slot, void* page)
+{
+    return -ENOENT;
+}
+
+static inline bool _swapfile_is_compressed_locked(int slot)
+{
+    return false;
+}
+#endif
+
+static inline void _swapfile_read(void* buf, int slot, size_t count)
+{
+    data_access_type_t prev_access_type = THIS_CPU->data_access_type;
+    THIS_CPU->data_access_type = DATA_ACCESS_KERNEL;
+    _swapfile->ops->read(_swapfile, buf, slot * VMM_PAGE_SIZE, count * VMM_PAGE_SIZE);
+    THIS_CPU->data_access_type = prev_access_type;
+}
+
+static inline void _swapfile_write(void* buf, int slot, size_t count)
+{
+    data_access_type_t prev_access_type = THIS_CPU->data_access_type;
+    THIS_CPU->data_access_type = DATA_ACCESS_KERNEL;
+    _swapfile->ops->write(_swapfile, buf, slot * VMM_PAGE_SIZE, count * VMM_PAGE_SIZE);
+    THIS_CPU->data_access_type = prev_access_type;
+}
+
+static inline bool _swapfile_is_on_disk_locked(int slot)
+{
+    return _swapfile_slot_is_used(slot) && !_swapfile_find_in_batches_locked(slot) && !_swapfile_is_compressed_locked(slot);
+}
+
+/**
+ * @brief Reads the aligned window of slots around the slot. Slots which
+ *        are free or still in batches have stale data on the disk, they
+ *        are not marked as valid. Slots are checked before the read too:
+ *        a batch written during the read could leave its old data in the
+ *        buffer, while it's not found in batches after the read. Slots
+ *        freed during the read are dropped by _swapfile_free_slot_locked().
+ */
+static void _swapfile_readahead_locked(int slot)
+{
+    int start = ROUND_FLOOR(slot, SWAPFILE_READAHEAD_PAGES);
+
+    system_disable_interrupts();
+    spinlock_acquire(&_swapfile_lock);
+    _swapfile_ra_start = start;
+    _swapfile_ra_valid = 0;
+    for (int i = 0; i < SWAPFILE_READAHEAD_PAGES; i++) {
+        if (_swapfile_is_on_disk_locked(start + i)) {
+            _swapfile_ra_valid |= (1u << i);
+        }
+    }
+    spinlock_release(&_swapfile_lock);
+    system_enable_interrupts();
+
+    _swapfile_read(_swapfile_ra_buf.ptr, start, SWAPFILE_READAHEAD_PAGES);
+
+    system_disable_interrupts();
+    spinlock_acquire(&_swapfile_lock);
+    for (int i = 0; i < SWAPFILE_READAHEAD_PAGES; i++) {
+        if (!_swapfile_is_on_disk_locked(start + i)) {
+            _swapfile_ra_valid &= ~(1u << i);
+        }
+    }
+    spinlock_release(&_swapfile_lock);
+    system_enable_interrupts();
+}
+
+static bool _swapfile_has_free_batch(thread_t* thread)
+{
+    for (int i = 0; i < SWAPFILE_WRITEBACK_BATCHES; i++) {
+        if (_swapfile_batches[i].state == SWAPFILE_BATCH_FREE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static swapfile_batch_t* _swapfile_oldest_writeback_batch()
+{
+    swapfile_batch_t* res = NULL;
+    system_disable_interrupts();
+    spinlock_acquire(&_swapfile_lock);
+    for (int i = 0; i < SWAPFILE_WRITEBACK_BATCHES; i++) {
+        swapfile_batch_t* batch = &_swapfile_batches[i];
+        if (batch->state == SWAPFILE_BATCH_WRITEBACK && (!res || batch->seq < res->seq)) {
+            res = batch;
+        }
+    }
+    spinlock_release(&_swapfile_lock);
+    system_enable_interrupts();
+    return res;
+}
+
+static bool _swapfile_has_writeback(thread_t* thread)
+{
+    return _swapfile_oldest_writeback_batch();
+}
+
+// Writes runs of consecutive slots in one request each.
+static void _swapfile_write_batch(swapfile_batch_t* batch)
+{
+    int run_start = 0;
+    for (int i = 1; i <= batch->count; i++) {
+        if (i < batch->count && batch->slots[i] == batch->slots[i - 1] + 1) {
+            continue;
+        }
+
+        _swapfile_write(batch->buf.ptr + run_start * VMM_PAGE_SIZE, batch->slots[run_start], i - run_start);
+        run_start = i;
+    }
+}
+
+/**
+ * API FUNCTIONS
+ */
 
 int swapfile_init()
 {
+    spinlock_init(&_swapfile_lock);
+    spinlock_init(&_swapfile_ra_lock);
+    wait_queue_init(&_swapfile_writeback_queue);
+    wait_queue_init(&_swapfile_free_batch_queue);
+
+    for (int i = 0; i < SWAPFILE_WRITEBACK_BATCHES; i++) {
+        swapfile_batch_t* batch = &_swapfile_batches[i];
+        batch->state = SWAPFILE_BATCH_FREE;
+        batch->count = 0;
+        if (vm_alloc_mapped_zone(SWAPFILE_BATCH_PAGES * VMM_PAGE_SIZE, VMM_PAGE_SIZE, &batch->buf, MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE)) {
+            return -ENOMEM;
+        }
+    }
+    if (vm_alloc_mapped_zone(SWAPFILE_READAHEAD_PAGES * VMM_PAGE_SIZE, VMM_PAGE_SIZE, &_swapfile_ra_buf, MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE)) {
+        return -ENOMEM;
+    }
+#ifdef ZSWAP_ENABLED
+    if (zswap_init()) {
+        log_warn("Swap: No space for the compressed cache");
+    }
+#endif
+
     path_t vfspth;
     if (vfs_resolve_path("/var", &vfspth) < 0) {
         // Instead of panicing we can create the dir here.
@@ -35,52 +338,231 @@ int swapfile_init()
     return 0;
 }
 
+// Called when a page table entry pointing to the slot is copied, e.g. after fork.
 int swapfile_new_ref(int id)
 {
-    return 0;
+    int slot = _swapfile_slot_of(id);
+    if (slot < 0) {
+        return -EINVAL;
+    }
+
+    int err = 0;
+    system_disable_interrupts();
+    spinlock_acquire(&_swapfile_lock);
+    if (!_swapfile_refs[slot] || _swapfile_refs[slot] == 0xffff) {
+        err = -EINVAL;
+    } else {
+        _swapfile_refs[slot]++;
+    }
+    spinlock_release(&_swapfile_lock);
+    system_enable_interrupts();
+    return err;
 }
 
+// The slot is reused once the last entry pointing to it is loaded or freed.
 int swapfile_rem_ref(int id)
 {
-    return 0;
+    int slot = _swapfile_slot_of(id);
+    if (slot < 0) {
+        return -EINVAL;
+    }
+
+    int err = 0;
+    system_disable_interrupts();
+    spinlock_acquire(&_swapfile_lock);
+    if (!_swapfile_refs[slot]) {
+        err = -EINVAL;
+    } else if (--_swapfile_refs[slot] == 0) {
+        _swapfile_free_slot_locked(slot);
+    }
+    spinlock_release(&_swapfile_lock);
+    system_enable_interrupts();
+    return err;
 }
 
+/**
+ * @brief Loads the slot to the page at vaddr. The page is taken from the
+ *        compressed cache or a batch if it's not written yet, otherwise
+ *        neighbouring slots are read together with it, since they are
+ *        likely to be needed soon.
+ */
 int swapfile_load(uintptr_t vaddr, int id)
 {
     if (!_swapfile) {
         return -ENODEV;
     }
 
-    if (id > _nextid) {
+    int slot = _swapfile_slot_of(id);
+    if (slot < 0 || !_swapfile_refs[slot]) {
         return -ENOENT;
     }
 
-    data_access_type_t prev_access_type = THIS_CPU->data_access_type;
-    THIS_CPU->data_access_type = DATA_ACCESS_KERNEL;
-
-    size_t offset = (id - 1) * VMM_PAGE_SIZE;
-    _swapfile->ops->read(_swapfile, (void*)PAGE_START(vaddr), offset, VMM_PAGE_SIZE);
+    void* page = (void*)PAGE_START(vaddr);
+    spinlock_acquire(&_swapfile_ra_lock);
+    system_disable_interrupts();
+    spinlock_acquire(&_swapfile_lock);
+    int err = _swapfile_load_compressed_locked(slot, page);
+    if (err == -ENOENT) {
+        void* src = _swapfile_find_in_batches_locked(slot);
+        if (src) {
+            memcpy(page, src, VMM_PAGE_SIZE);
+            err = 0;
+        }
+    }
+    spinlock_release(&_swapfile_lock);
+    system_enable_interrupts();
 
-    THIS_CPU->data_access_type = prev_access_type;
+    if (err == -ENOENT) {
+        int ra_index = slot - _swapfile_ra_start;
+        bool cached = _swapfile_ra_start >= 0 && ra_index >= 0 && ra_index < SWAPFILE_READAHEAD_PAGES && ((_swapfile_ra_valid >> ra_index) & 1);
+        if (!cached) {
+            _swapfile_readahead_locked(slot);
+            ra_index = slot - _swapfile_ra_start;
+        }
+        memcpy(page, _swapfile_ra_buf.ptr + ra_index * VMM_PAGE_SIZE, VMM_PAGE_SIZE);
+        err = 0;
+    }
+    spinlock_release(&_swapfile_ra_lock);
 
+    if (err) {
+        return err;
+    }
     swapfile_rem_ref(id);
     return 0;
 }
 
+/**
+ * @brief Compresses the page to the cache or copies it to the filling
+ *        batch if it's poorly compressible. The batch also takes pages
+ *        written back from the full cache.
+ *
+ * @return The id of the slot, or an error if there is no space.
+ */
 int swapfile_store(uintptr_t vaddr)
 {
     if (!_swapfile) {
         return -ENODEV;
     }
 
-    data_access_type_t prev_access_type = THIS_CPU->data_access_type;
-    THIS_CPU->data_access_type = DATA_ACCESS_KERNEL;
+    void* page = (void*)PAGE_START(vaddr);
+    system_disable_interrupts();
+    spinlock_acquire(&_swapfile_lock);
+    int slot = _swapfile_alloc_slot_locked();
+    if (slot < 0) {
+        spinlock_release(&_swapfile_lock);
+        system_enable_interrupts();
+        return -ENOSPC;
+    }
 
-    _swapfile->ops->write(_swapfile, (void*)PAGE_START(vaddr), _nextid * VMM_PAGE_SIZE, VMM_PAGE_SIZE);
-    _nextid++;
+    bool stored = _swapfile_store_compressed_locked(slot, page);
+    if (!stored && _swapfile_batch_has_room_locked()) {
+        _swapfile_add_to_batch_locked(slot, page);
+        stored = true;
+    }
 
-    THIS_CPU->data_access_type = prev_access_type;
+    if (!stored) {
+        _swapfile_free_slot_locked(slot);
+    }
+    spinlock_release(&_swapfile_lock);
+    system_enable_interrupts();
+    return stored ? slot + 1 : -EAGAIN;
+}
+
+// Waits for a free batch, which takes pages stored until it's submitted.
+void swapfile_begin_batch()
+{
+    if (!_swapfile) {
+        return;
+    }
+
+    for (;;) {
+        system_disable_interrupts();
+        spinlock_acquire(&_swapfile_lock);
+        if (_swapfile_filling_batch) {
+            spinlock_release(&_swapfile_lock);
+            system_enable_interrupts();
+            return;
+        }
+
+        for (int i = 0; i < SWAPFILE_WRITEBACK_BATCHES; i++) {
+            swapfile_batch_t* batch = &_swapfile_batches[i];
+            if (batch->state == SWAPFILE_BATCH_FREE) {
+                batch->state = SWAPFILE_BATCH_FILLING;
+                batch->count = 0;
+                batch->seq = _swapfile_next_seq++;
+                _swapfile_filling_batch = batch;
+                break;
+            }
+        }
+        spinlock_release(&_swapfile_lock);
+        system_enable_interrupts();
+
+        if (_swapfile_filling_batch) {
+            return;
+        }
+        init_wait_queue_blocker(RUNNING_THREAD, &_swapfile_free_batch_queue, _swapfile_has_free_batch);
+    }
+}
+
+// Hands the filling batch to kswapflusherd, its pages are still served until it's written.
+void swapfile_submit_batch()
+{
+    system_disable_interrupts();
+    spinlock_acquire(&_swapfile_lock);
+    swapfile_batch_t* batch = _swapfile_filling_batch;
+    if (!batch) {
+        spinlock_release(&_swapfile_lock);
+        system_enable_interrupts();
+        return;
+    }
+
+    _swapfile_filling_batch = NULL;
+    batch->state = batch->count ? SWAPFILE_BATCH_WRITEBACK : SWAPFILE_BATCH_FREE;
+    spinlock_release(&_swapfile_lock);
+    system_enable_interrupts();
 
-    swapfile_new_ref(_nextid);
-    return _nextid;
-}
\ No newline at end of file
+    if (batch->state == SWAPFILE_BATCH_WRITEBACK) {
+        wait_queue_notify_all(&_swapfile_writeback_queue);
+    }
+}
+
+void kswapflusherd()
+{
+    // Data access type is per cpu, so the thread stays on one cpu while it writes.
+    sched_setaffinity(RUNNING_THREAD, 1u << system_cpu_id());
+
+    for (;;) {
+        init_wait_queue_blocker(RUNNING_THREAD, &_swapfile_writeback_queue, _swapfile_has_writeback);
+
+        swapfile_batch_t* batch = _swapfile_oldest_writeback_batch();
+        if (!batch) {
+            continue;
+        }
+
+        _swapfile_write_batch(batch);
+
+        system_disable_interrupts();
+        spinlock_acquire(&_swapfile_lock);
+        batch->state = SWAPFILE_BATCH_FREE;
+        batch->count = 0;
+        spinlock_release(&_swapfile_lock);
+        system_enable_interrupts();
+        wait_queue_notify_all(&_swapfile_free_batch_queue);
+    }
+}
+
+size_t swapfile_get_total_in_kb()
+{
+    if (!_swapfile) {
+        return 0;
+    }
+    return SWAPFILE_MAX_SLOTS * (VMM_PAGE_SIZE / 1024);
+}
+
+size_t swapfile_get_free_in_kb()
+{
+    if (!_swapfile) {
+        return 0;
+    }
+    return (SWAPFILE_MAX_SLOTS - _swapfile_used_slots) * (VMM_PAGE_SIZE / 1024);
+}
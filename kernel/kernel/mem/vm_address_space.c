@@ -6,9 +6,12 @@
  * found in the LICENSE file.
  */
 
+#include <libkern/atomic.h>
 #include <libkern/bits/errno.h>
 #include <mem/kmalloc.h>
+#include <mem/memzone.h>
 #include <mem/vm_address_space.h>
+#include <mem/vm_lru.h>
 #include <tasking/proc.h>
 
 vm_address_space_t* vm_address_space_alloc()
@@ -21,14 +24,22 @@ vm_address_space_t* vm_address_space_alloc()
     memset(res, 0, sizeof(vm_address_space_t));
     res->count = 1;
     spinlock_init(&res->lock);
-    if (dynarr_init(memzone_t, &res->zones) != 0) {
-        kfree(res);
-        return NULL;
-    }
-
+    memzone_init_zones(res);
     return res;
 }
 
+// Takes a reference unless the address space is already being freed.
+bool vm_address_space_try_get(vm_address_space_t* aspace)
+{
+    int cur = atomic_load(&aspace->count);
+    while (cur > 0) {
+        if (atomic_compare_exchange(&aspace->count, &cur, cur + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 int vm_address_space_free(vm_address_space_t* old)
 {
     if (!old) {
@@ -39,10 +50,11 @@ int vm_address_space_free(vm_address_space_t* old)
         return -EPERM;
     }
 
-    old->count--;
-    if (old->count == 0) {
+    // Address spaces are shared with vfork() children.
+    if (atomic_add(&old->count, -1) == 0) {
         vmm_free_address_space(old);
-        dynarr_clear(&old->zones);
+        vm_lru_forget_address_space(old);
+        memzone_free_all(old);
         kfree(old);
     }
 
@@ -9,7 +9,9 @@
 #include <libkern/bits/errno.h>
 #include <mem/pmm.h>
 #include <mem/vm_alloc.h>
+#include <mem/vm_lru.h>
 #include <mem/vm_pspace.h>
+#include <mem/vm_zero.h>
 #include <mem/vmm.h>
 
 uintptr_t vm_alloc_pdir_paddr()
@@ -37,9 +39,38 @@ uintptr_t vm_alloc_page_paddr()
     return (uintptr_t)pmm_alloc_aligned(VMM_PAGE_SIZE, VMM_PAGE_SIZE);
 }
 
+// The page could be shared between address spaces, it's freed by the last owner.
 void vm_free_page_paddr(uintptr_t addr)
 {
-    pmm_free((void*)addr, VMM_PAGE_SIZE);
+    if (vm_unref_page_paddr(addr)) {
+        vm_lru_del(addr);
+        pmm_free((void*)addr, VMM_PAGE_SIZE);
+    }
+}
+
+// The zero page is never freed, so it's not reference counted. Shared pages
+// leave the LRU, since kswapd could unmap them only from one owner.
+void vm_ref_page_paddr(uintptr_t addr)
+{
+    if (vm_is_zero_page_paddr(addr)) {
+        return;
+    }
+    pmm_ref((void*)addr);
+    vm_lru_del(addr);
+}
+
+// Returns true if the caller was the last owner and should free the page.
+bool vm_unref_page_paddr(uintptr_t addr)
+{
+    if (vm_is_zero_page_paddr(addr)) {
+        return false;
+    }
+    return pmm_unref((void*)addr);
+}
+
+uint32_t vm_page_paddr_refs(uintptr_t addr)
+{
+    return pmm_refs((void*)addr);
 }
 
 int vm_alloc_mapped_zone(size_t size, size_t alignment, kmemzone_t* kmemzone, mmu_flags_t flags)
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <libkern/lock.h>
+#include <mem/vm_asid.h>
+#include <platform/generic/cpu.h>
+#include <platform/generic/system.h>
+
+/**
+ * ASIDs are given out in generations. Within a generation every ASID
+ * belongs to one address space, so its entries could be kept in TLB.
+ * Once ASIDs are over, a new generation starts: every cpu flushes its
+ * TLB before loading the next address space and address spaces take
+ * new ASIDs on their next switch. ASIDs of freed address spaces are
+ * reused in the next generation only.
+ *
+ * Entries are flushed only on the cpu which changes a table, so every
+ * address space keeps a mask of cpus which have run it with its ASID.
+ * A cpu keeps the entries of the ASID only if no other cpu has run the
+ * address space since the ASID was given out, otherwise it flushes the
+ * ASID when the address space is loaded.
+ */
+
+#define VM_ASID_FIRST (1) // ASID 0 is used at boot and is reserved for switches on arm32.
+
+static spinlock_t _vm_asid_lock;
+static int _vm_asid_count = 0;
+static int _vm_asid_next = VM_ASID_FIRST;
+static uint32_t _vm_asid_generation = 1;
+static bool _vm_asid_flush_pending[MAX_CPU_CNT];
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static void _vm_asid_new_generation_locked()
+{
+    _vm_asid_generation++;
+    if (!_vm_asid_generation) {
+        // Generation 0 is never current, so new address spaces take an ASID.
+        _vm_asid_generation++;
+    }
+    _vm_asid_next = VM_ASID_FIRST;
+    for (int i = 0; i < MAX_CPU_CNT; i++) {
+        _vm_asid_flush_pending[i] = true;
+    }
+}
+
+static void _vm_asid_alloc_locked(vm_address_space_t* vm_aspace)
+{
+    if (_vm_asid_next >= _vm_asid_count) {
+        _vm_asid_new_generation_locked();
+    }
+    vm_aspace->asid = _vm_asid_next++;
+    vm_aspace->asid_generation = _vm_asid_generation;
+    vm_aspace->asid_cpus = 0;
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+void vm_asid_init()
+{
+    spinlock_init(&_vm_asid_lock);
+    _vm_asid_count = system_setup_asids();
+    system_flush_tlb_all_asids();
+}
+
+// Entries cached before ASIDs were set up are dropped, since their ASID could be given out.
+void vm_asid_setup_secondary_cpu()
+{
+    system_setup_asids();
+    system_flush_tlb_all_asids();
+}
+
+/**
+ * @brief Loads tables of the address space to the current cpu. Should be
+ *        called with interrupts disabled.
+ */
+void vm_asid_switch(vm_address_space_t* vm_aspace, uintptr_t pdir0, uintptr_t pdir1)
+{
+    if (!_vm_asid_count) {
+        system_set_pdir(pdir0, pdir1);
+        return;
+    }
+
+    int cpu = system_cpu_id();
+    uint32_t cpu_mask = 1u << cpu;
+    spinlock_acquire(&_vm_asid_lock);
+    if (vm_aspace->asid_generation != _vm_asid_generation) {
+        // A new ASID has no entries cached on any cpu.
+        _vm_asid_alloc_locked(vm_aspace);
+    }
+    bool flush_asid = vm_aspace->asid_cpus && vm_aspace->asid_cpus != cpu_mask;
+    vm_aspace->asid_cpus |= cpu_mask;
+
+    bool flush_all = _vm_asid_flush_pending[cpu];
+    _vm_asid_flush_pending[cpu] = false;
+    int asid = vm_aspace->asid;
+    spinlock_release(&_vm_asid_lock);
+
+    if (flush_all) {
+        system_flush_tlb_all_asids();
+    }
+    system_set_pdir_asid(pdir0, pdir1, asid, flush_asid && !flush_all);
+}
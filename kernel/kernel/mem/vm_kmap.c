@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <libkern/kassert.h>
+#include <libkern/libkern.h>
+#include <mem/kmemzone.h>
+#include <mem/pmm.h>
+#include <mem/vm_kmap.h>
+#include <mem/vmm.h>
+#include <platform/generic/cpu.h>
+#include <platform/generic/system.h>
+
+static kmemzone_t _vm_kmap_zone;
+
+extern void* vm_kmap_direct_impl(uintptr_t paddr);
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static inline uintptr_t _vm_kmap_slot_vaddr(int slot)
+{
+    return _vm_kmap_zone.start + (system_cpu_id() * VM_KMAP_SLOTS_PER_CPU + slot) * VMM_PAGE_SIZE;
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+void vm_kmap_init()
+{
+    _vm_kmap_zone = kmemzone_new(MAX_CPU_CNT * VM_KMAP_SLOTS_PER_CPU * VMM_PAGE_SIZE);
+    ASSERT(_vm_kmap_zone.start);
+
+    // Windows are mapped once, so their ptables are allocated now and cpus
+    // never race to allocate them later. Ptables are kept after unmapping.
+    uintptr_t paddr = (uintptr_t)pmm_alloc_aligned(VMM_PAGE_SIZE, VMM_PAGE_SIZE);
+    ASSERT(paddr);
+    for (uintptr_t vaddr = _vm_kmap_zone.start; vaddr < _vm_kmap_zone.start + _vm_kmap_zone.len; vaddr += VMM_PAGE_SIZE) {
+        vmm_map_page(vaddr, paddr, MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE);
+        vmm_unmap_page(vaddr);
+    }
+    pmm_free((void*)paddr, VMM_PAGE_SIZE);
+}
+
+/**
+ * @brief Maps the frame to the window of the current cpu. Interrupts stay
+ *        disabled until the window is unmapped, so the thread is not moved
+ *        to another cpu and the window is not reused meanwhile.
+ */
+void* vm_kmap_atomic(uintptr_t paddr, int slot)
+{
+    void* direct = vm_kmap_direct_impl(paddr);
+    if (direct) {
+        return direct;
+    }
+
+    system_disable_interrupts();
+    uintptr_t vaddr = _vm_kmap_slot_vaddr(slot);
+    vmm_map_page_locked(vaddr, paddr, MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE);
+    return (void*)vaddr;
+}
+
+void vm_kunmap_atomic(void* ptr, int slot)
+{
+    uintptr_t vaddr = _vm_kmap_slot_vaddr(slot);
+    if ((uintptr_t)ptr != vaddr) {
+        return;
+    }
+
+    vmm_unmap_page_locked(vaddr);
+    system_enable_interrupts();
+}
+
+void vm_kmap_copy_frame(uintptr_t dst_paddr, uintptr_t src_paddr)
+{
+    void* src = vm_kmap_atomic(src_paddr, VM_KMAP_SLOT_SRC);
+    void* dst = vm_kmap_atomic(dst_paddr, VM_KMAP_SLOT_DST);
+    memcpy(dst, src, VMM_PAGE_SIZE);
+    vm_kunmap_atomic(dst, VM_KMAP_SLOT_DST);
+    vm_kunmap_atomic(src, VM_KMAP_SLOT_SRC);
+}
+
+void vm_kmap_zero_frame(uintptr_t paddr)
+{
+    void* dst = vm_kmap_atomic(paddr, VM_KMAP_SLOT_DST);
+    memset(dst, 0, VMM_PAGE_SIZE);
+    vm_kunmap_atomic(dst, VM_KMAP_SLOT_DST);
+}
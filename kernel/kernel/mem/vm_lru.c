@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <libkern/kassert.h>
+#include <libkern/libkern.h>
+#include <libkern/lock.h>
+#include <libkern/log.h>
+#include <mem/pmm.h>
+#include <mem/vm_alloc.h>
+#include <mem/vm_lru.h>
+#include <mem/vm_pspace.h>
+#include <mem/vm_zero.h>
+#include <mem/vmm.h>
+#include <platform/generic/system.h>
+
+struct vm_lru_list {
+    uint32_t head;
+    uint32_t tail;
+    size_t count;
+};
+typedef struct vm_lru_list vm_lru_list_t;
+
+// Lists are guarded by one lock, which is taken after the lock of an address space.
+static spinlock_t _vm_lru_lock;
+static vm_lru_page_t* _vm_lru_pages;
+static size_t _vm_lru_pages_count;
+static uintptr_t _vm_lru_ram_offset;
+static vm_lru_list_t _vm_lru_lists[VM_LRU_ISOLATED + 1];
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static inline bool _vm_lru_page_id(uintptr_t paddr, uint32_t* id)
+{
+    if (!_vm_lru_pages || paddr < _vm_lru_ram_offset) {
+        return false;
+    }
+
+    size_t res = (paddr - _vm_lru_ram_offset) / VMM_PAGE_SIZE;
+    if (res >= _vm_lru_pages_count) {
+        return false;
+    }
+    *id = res;
+    return true;
+}
+
+static inline uintptr_t _vm_lru_page_paddr(uint32_t id)
+{
+    return _vm_lru_ram_offset + (uintptr_t)id * VMM_PAGE_SIZE;
+}
+
+static inline bool _vm_lru_is_list(int list)
+{
+    return list == VM_LRU_ACTIVE || list == VM_LRU_INACTIVE;
+}
+
+static void _vm_lru_push_head(uint32_t id, int list)
+{
+    vm_lru_list_t* lru = &_vm_lru_lists[list];
+    vm_lru_page_t* page = &_vm_lru_pages[id];
+    page->list = list;
+    page->prev = VM_LRU_NONE_PAGE;
+    page->next = lru->head;
+    if (lru->head != VM_LRU_NONE_PAGE) {
+        _vm_lru_pages[lru->head].prev = id;
+    } else {
+        lru->tail = id;
+    }
+    lru->head = id;
+    lru->count++;
+}
+
+static void _vm_lru_unlink(uint32_t id)
+{
+    vm_lru_page_t* page = &_vm_lru_pages[id];
+    vm_lru_list_t* lru = &_vm_lru_lists[page->list];
+    if (!_vm_lru_is_list(page->list)) {
+        lru->count--;
+        page->list = VM_LRU_NONE;
+        return;
+    }
+
+    if (page->prev != VM_LRU_NONE_PAGE) {
+        _vm_lru_pages[page->prev].next = page->next;
+    } else {
+        lru->head = page->next;
+    }
+    if (page->next != VM_LRU_NONE_PAGE) {
+        _vm_lru_pages[page->next].prev = page->prev;
+    } else {
+        lru->tail = page->prev;
+    }
+    page->prev = page->next = VM_LRU_NONE_PAGE;
+    page->list = VM_LRU_NONE;
+    lru->count--;
+}
+
+static void _vm_lru_drop_locked(uint32_t id)
+{
+    vm_lru_page_t* page = &_vm_lru_pages[id];
+    if (page->list == VM_LRU_NONE) {
+        return;
+    }
+
+    _vm_lru_unlink(id);
+    page->aspace->lru_pages--;
+    page->aspace = NULL;
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+void vm_lru_init()
+{
+    spinlock_init(&_vm_lru_lock);
+    for (int i = 0; i <= VM_LRU_ISOLATED; i++) {
+        _vm_lru_lists[i].head = _vm_lru_lists[i].tail = VM_LRU_NONE_PAGE;
+        _vm_lru_lists[i].count = 0;
+    }
+
+    const pmm_state_t* pmm = pmm_get_state();
+    size_t count = (pmm_get_max_blocks() * pmm_get_block_size()) / VMM_PAGE_SIZE;
+    kmemzone_t zone;
+    int err = vm_alloc_mapped_zone(count * sizeof(vm_lru_page_t), VMM_PAGE_SIZE, &zone, MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE);
+    if (err) {
+        log_warn("LRU: No space for page data, reclaim is disabled");
+        return;
+    }
+
+    vm_lru_page_t* pages = (vm_lru_page_t*)zone.ptr;
+    for (size_t i = 0; i < count; i++) {
+        pages[i].next = pages[i].prev = VM_LRU_NONE_PAGE;
+        pages[i].list = VM_LRU_NONE;
+        pages[i].aspace = NULL;
+        pages[i].vaddr = 0;
+    }
+
+    _vm_lru_ram_offset = pmm->ram_offset;
+    _vm_lru_pages_count = count;
+    _vm_lru_pages = pages;
+}
+
+/**
+ * @brief Puts a page to the head of the active list. A page which is
+ *        already on the LRU just gets the new owner.
+ */
+void vm_lru_add(uintptr_t paddr, vm_address_space_t* aspace, uintptr_t vaddr)
+{
+    uint32_t id;
+    paddr = PAGE_START(paddr);
+    if (!_vm_lru_page_id(paddr, &id) || vm_is_zero_page_paddr(paddr) || vm_page_paddr_refs(paddr) > 1) {
+        return;
+    }
+
+    system_disable_interrupts();
+    spinlock_acquire(&_vm_lru_lock);
+    vm_lru_page_t* page = &_vm_lru_pages[id];
+    if (page->list != VM_LRU_NONE) {
+        page->aspace->lru_pages--;
+    }
+    if (_vm_lru_is_list(page->list)) {
+        _vm_lru_unlink(id);
+    }
+
+    page->aspace = aspace;
+    page->vaddr = PAGE_START(vaddr);
+    aspace->lru_pages++;
+    if (page->list == VM_LRU_NONE) {
+        _vm_lru_push_head(id, VM_LRU_ACTIVE);
+    }
+    spinlock_release(&_vm_lru_lock);
+    system_enable_interrupts();
+}
+
+// Adds the page mapped at vaddr of the active address space, if it could be reclaimed.
+void vm_lru_add_mapped_page(memzone_t* zone, uintptr_t vaddr)
+{
+    if (!zone || TEST_FLAG(zone->type, ZONE_TYPE_DEVICE) || TEST_FLAG(zone->type, ZONE_TYPE_MAPPED_FILE_SHAREDLY)) {
+        return;
+    }
+
+    ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
+    if (!vm_ptable_entity_is_present(page_desc, PTABLE_LV0)) {
+        return;
+    }
+    vm_lru_add(vm_ptable_entity_get_frame(page_desc, PTABLE_LV0), vmm_get_active_address_space(), vaddr);
+}
+
+// Called when the page is freed or becomes shared, an isolated page is not put back then.
+void vm_lru_del(uintptr_t paddr)
+{
+    uint32_t id;
+    if (!_vm_lru_page_id(PAGE_START(paddr), &id)) {
+        return;
+    }
+
+    system_disable_interrupts();
+    spinlock_acquire(&_vm_lru_lock);
+    _vm_lru_drop_locked(id);
+    spinlock_release(&_vm_lru_lock);
+    system_enable_interrupts();
+}
+
+/**
+ * @brief Drops pages which are still owned by a freed address space. These
+ *        are pages of ptables shared after fork, which outlive the owner.
+ */
+void vm_lru_forget_address_space(vm_address_space_t* aspace)
+{
+    system_disable_interrupts();
+    spinlock_acquire(&_vm_lru_lock);
+    for (size_t id = 0; id < _vm_lru_pages_count && aspace->lru_pages; id++) {
+        if (_vm_lru_pages[id].aspace == aspace) {
+            _vm_lru_drop_locked(id);
+        }
+    }
+    spinlock_release(&_vm_lru_lock);
+    system_enable_interrupts();
+}
+
+/**
+ * @brief Takes the page from the tail of the list. Pages of address spaces
+ *        which are being freed are skipped, they leave the LRU soon.
+ *
+ * @return True if the victim is filled, its address space is referenced.
+ */
+bool vm_lru_isolate(int list, vm_lru_victim_t* victim)
+{
+    ASSERT(_vm_lru_is_list(list));
+    bool found = false;
+
+    system_disable_interrupts();
+    spinlock_acquire(&_vm_lru_lock);
+    vm_lru_list_t* lru = &_vm_lru_lists[list];
+    for (size_t tries = lru->count; tries && !found; tries--) {
+        uint32_t id = lru->tail;
+        vm_lru_page_t* page = &_vm_lru_pages[id];
+        _vm_lru_unlink(id);
+        if (!vm_address_space_try_get(page->aspace)) {
+            _vm_lru_push_head(id, list);
+            continue;
+        }
+
+        page->list = VM_LRU_ISOLATED;
+        _vm_lru_lists[VM_LRU_ISOLATED].count++;
+        victim->paddr = _vm_lru_page_paddr(id);
+        victim->aspace = page->aspace;
+        victim->vaddr = page->vaddr;
+        found = true;
+    }
+    spinlock_release(&_vm_lru_lock);
+    system_enable_interrupts();
+    return found;
+}
+
+// Puts an isolated page to the head of the list, unless it was freed meanwhile.
+void vm_lru_putback(uintptr_t paddr, int list)
+{
+    uint32_t id;
+    ASSERT(_vm_lru_is_list(list));
+    if (!_vm_lru_page_id(paddr, &id)) {
+        return;
+    }
+
+    system_disable_interrupts();
+    spinlock_acquire(&_vm_lru_lock);
+    if (_vm_lru_pages[id].list == VM_LRU_ISOLATED) {
+        _vm_lru_unlink(id);
+        _vm_lru_push_head(id, list);
+    }
+    spinlock_release(&_vm_lru_lock);
+    system_enable_interrupts();
+}
+
+size_t vm_lru_count(int list)
+{
+    return _vm_lru_lists[list].count;
+}
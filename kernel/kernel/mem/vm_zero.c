@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <libkern/atomic.h>
+#include <libkern/kassert.h>
+#include <libkern/libkern.h>
+#include <libkern/lock.h>
+#include <mem/pmm.h>
+#include <mem/vm_alloc.h>
+#include <mem/vm_kmap.h>
+#include <mem/vm_zero.h>
+#include <mem/vmm.h>
+#include <syscalls/handlers.h>
+#include <tasking/tasking.h>
+#include <tasking/wait_queue.h>
+
+#define KZEROD_SLEEPTIME (1) // seconds.
+
+static uintptr_t _vm_zero_page;
+
+static spinlock_t _vm_zero_pool_lock;
+static uintptr_t _vm_zero_pool[VM_ZERO_POOL_SIZE];
+static int _vm_zero_pool_count;
+static wait_queue_t _vm_zero_pool_queue;
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static bool _vm_zero_pool_needs_refill(thread_t* thread)
+{
+    return atomic_load(&_vm_zero_pool_count) < VM_ZERO_POOL_LOW;
+}
+
+// Pre-zeroed pages are a cache, they are not kept when memory is low.
+static inline bool _vm_zero_has_spare_memory()
+{
+    return !pmm_is_below_low_watermark();
+}
+
+static bool _vm_zero_pool_put(uintptr_t paddr)
+{
+    bool put = false;
+    spinlock_acquire(&_vm_zero_pool_lock);
+    if (_vm_zero_pool_count < VM_ZERO_POOL_SIZE) {
+        _vm_zero_pool[_vm_zero_pool_count] = paddr;
+        atomic_store(&_vm_zero_pool_count, _vm_zero_pool_count + 1);
+        put = true;
+    }
+    spinlock_release(&_vm_zero_pool_lock);
+    return put;
+}
+
+static void _kzerod_sleep()
+{
+    timespec_t ts;
+    ts.tv_sec = KZEROD_SLEEPTIME;
+    ts.tv_nsec = 0;
+    ksys2(SYS_NANOSLEEP, &ts, NULL);
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+void vm_zero_init()
+{
+    spinlock_init(&_vm_zero_pool_lock);
+    wait_queue_init(&_vm_zero_pool_queue);
+    _vm_zero_pool_count = 0;
+
+    _vm_zero_page = vm_alloc_page_paddr();
+    ASSERT(_vm_zero_page);
+    vm_kmap_zero_frame(_vm_zero_page);
+}
+
+uintptr_t vm_zero_page_paddr()
+{
+    return _vm_zero_page;
+}
+
+bool vm_is_zero_page_paddr(uintptr_t paddr)
+{
+    return PAGE_START(paddr) == _vm_zero_page;
+}
+
+// Returns a zeroed frame, or 0 if the pool is empty and the caller should clear a page itself.
+uintptr_t vm_zero_pool_take()
+{
+    uintptr_t paddr = 0;
+    spinlock_acquire(&_vm_zero_pool_lock);
+    if (_vm_zero_pool_count) {
+        atomic_store(&_vm_zero_pool_count, _vm_zero_pool_count - 1);
+        paddr = _vm_zero_pool[_vm_zero_pool_count];
+    }
+    int count = _vm_zero_pool_count;
+    spinlock_release(&_vm_zero_pool_lock);
+
+    if (count == VM_ZERO_POOL_LOW - 1) {
+        wait_queue_notify_all(&_vm_zero_pool_queue);
+    }
+    return paddr;
+}
+
+void kzerod()
+{
+    for (;;) {
+        init_wait_queue_blocker(RUNNING_THREAD, &_vm_zero_pool_queue, _vm_zero_pool_needs_refill);
+
+        while (atomic_load(&_vm_zero_pool_count) < VM_ZERO_POOL_SIZE) {
+            uintptr_t paddr = 0;
+            if (_vm_zero_has_spare_memory()) {
+                paddr = vm_alloc_page_paddr();
+            }
+            if (!paddr) {
+                _kzerod_sleep();
+                continue;
+            }
+
+            vm_kmap_zero_frame(paddr);
+            if (!_vm_zero_pool_put(paddr)) {
+                vm_free_page_paddr(paddr);
+                break;
+            }
+        }
+    }
+}
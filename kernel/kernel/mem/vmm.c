@@ -15,7 +15,9 @@
 #include <mem/memzone.h>
 #include <mem/swapfile.h>
 #include <mem/vm_alloc.h>
+#include <mem/vm_lru.h>
 #include <mem/vm_pspace.h>
+#include <mem/vm_zero.h>
 #include <mem/vmm.h>
 #include <platform/generic/cpu.h>
 #include <platform/generic/system.h>
@@ -274,7 +276,12 @@ int vm_alloc_user_page_no_fill_locked(memzone_t* zone, uintptr_t vaddr)
     if (!zone) {
         return -ESRCH;
     }
-    return vmm_alloc_page_no_fill_locked(vaddr, zone->mmu_flags);
+
+    int err = vmm_alloc_page_no_fill_locked(vaddr, zone->mmu_flags);
+    if (!err) {
+        vm_lru_add_mapped_page(zone, vaddr);
+    }
+    return err;
 }
 
 int vm_alloc_user_page_locked(memzone_t* zone, uintptr_t vaddr)
@@ -282,7 +289,12 @@ int vm_alloc_user_page_locked(memzone_t* zone, uintptr_t vaddr)
     if (!zone) {
         return -EFAULT;
     }
-    return vmm_alloc_page_locked(vaddr, zone->mmu_flags);
+
+    int err = vmm_alloc_page_locked(vaddr, zone->mmu_flags);
+    if (!err) {
+        vm_lru_add_mapped_page(zone, vaddr);
+    }
+    return err;
 }
 
 /**
@@ -304,19 +316,97 @@ int vm_alloc_page_with_perm(uintptr_t vaddr)
 
 extern int vmm_resolve_copy_on_write(uintptr_t vaddr);
 
+/**
+ * ZERO PAGE FUNCTIONS
+ */
+
+static inline bool _vmm_zone_can_share_zero_page(memzone_t* zone)
+{
+    if (zone->ops && zone->ops->load_page_content) {
+        return false;
+    }
+    return !TEST_FLAG(zone->type, ZONE_TYPE_DEVICE) && !TEST_FLAG(zone->type, ZONE_TYPE_MAPPED_FILE_SHAREDLY);
+}
+
+static bool _vmm_is_zero_page_mapped(uintptr_t vaddr)
+{
+    ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
+    if (!page_desc || !vm_ptable_entity_is_present(page_desc, PTABLE_LV0)) {
+        return false;
+    }
+    return vm_is_zero_page_paddr(vm_ptable_entity_get_frame(page_desc, PTABLE_LV0));
+}
+
+static int _vmm_map_zero_page_locked(memzone_t* zone, uintptr_t vaddr)
+{
+    mmu_flags_t mmu_flags = zone->mmu_flags & ~MMU_FLAG_PERM_WRITE;
+    return vmm_map_page_locked(ROUND_FLOOR(vaddr, VMM_PAGE_SIZE), vm_zero_page_paddr(), mmu_flags);
+}
+
+/**
+ * @brief Maps a zeroed page for vaddr. A pre-zeroed frame is taken from
+ *        the pool if there is one, otherwise the page is cleared here.
+ */
+static int _vmm_alloc_zeroed_user_page_locked(memzone_t* zone, uintptr_t vaddr)
+{
+    uintptr_t paddr = vm_zero_pool_take();
+    if (!paddr) {
+        return vm_alloc_user_page_locked(zone, vaddr);
+    }
+
+    int err = vmm_map_page_locked(ROUND_FLOOR(vaddr, VMM_PAGE_SIZE), paddr, zone->mmu_flags);
+    if (err) {
+        vm_free_page_paddr(paddr);
+        return err;
+    }
+    vm_lru_add_mapped_page(zone, vaddr);
+    return 0;
+}
+
+/**
+ * @brief Gives a private page to vaddr, which is backed by the zero page,
+ *        before the first write to it.
+ */
+static int _vmm_resolve_zero_page_locked(uintptr_t vaddr)
+{
+    memzone_t* zone = vmm_memzone_for_active_address_space(vaddr);
+    if (!zone || !TEST_FLAG(zone->mmu_flags, MMU_FLAG_PERM_WRITE)) {
+        return -EFAULT;
+    }
+
+    int err = _vmm_alloc_zeroed_user_page_locked(zone, vaddr);
+    if (err) {
+        return err;
+    }
+
+    // Other cpus running this address space could still cache the zero page.
+    system_flush_all_cpus_tlb_entry(ROUND_FLOOR(vaddr, VMM_PAGE_SIZE));
+    return 0;
+}
+
 /**
  * VMM CHECK FUNCTIONS
  */
 bool vmm_is_page_swapped(uintptr_t vaddr);
 int vmm_restore_swapped_page_locked(uintptr_t vaddr);
 
+// The content was just read from the backing file, so the page could be dropped until it's written.
+static void _vmm_mark_page_clean_locked(uintptr_t vaddr)
+{
+    ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
+    vm_ptable_entity_clear_dirty(page_desc, PTABLE_LV0);
+    system_flush_all_cpus_tlb_entry(vaddr);
+}
+
 /**
  * @brief Loads an unpresent page. The funciton might create a new page or load
- *        an existing one from drive.
+ *        an existing one from drive. Anonymous pages which are only read
+ *        are backed by the zero page.
  *
  * @param vaddr The virtual address of a page to load.
+ * @param for_write True if the page is about to be written.
  */
-static int vmm_resolve_page_not_present_locked(uintptr_t vaddr)
+static int vmm_resolve_page_not_present_locked(uintptr_t vaddr, bool for_write)
 {
     // CoW should be resolved before calling this function.
     ASSERT(!vmm_is_copy_on_write(vaddr));
@@ -334,18 +424,24 @@ static int vmm_resolve_page_not_present_locked(uintptr_t vaddr)
         return vmm_restore_swapped_page_locked(vaddr);
     }
 
-    int err = vm_alloc_user_page_no_fill_locked(zone, vaddr);
-    if (err) {
-        return err;
+    if (zone->ops && zone->ops->load_page_content) {
+        int err = vm_alloc_user_page_no_fill_locked(zone, vaddr);
+        if (err) {
+            return err;
+        }
+
+        err = zone->ops->load_page_content(zone, vaddr);
+        if (err) {
+            return err;
+        }
+        _vmm_mark_page_clean_locked(vaddr);
+        return 0;
     }
 
-    if (zone->ops && zone->ops->load_page_content) {
-        return zone->ops->load_page_content(zone, vaddr);
-    } else {
-        void* dest = (void*)ROUND_FLOOR(vaddr, VMM_PAGE_SIZE);
-        memset(dest, 0, VMM_PAGE_SIZE);
+    if (!for_write && _vmm_zone_can_share_zero_page(zone)) {
+        return _vmm_map_zero_page_locked(zone, vaddr);
     }
-    return 0;
+    return _vmm_alloc_zeroed_user_page_locked(zone, vaddr);
 }
 
 static int _vmm_ensure_write_to_page_locked(uintptr_t vaddr)
@@ -358,7 +454,21 @@ static int _vmm_ensure_write_to_page_locked(uintptr_t vaddr)
     }
 
     if (!vmm_is_page_present(vaddr)) {
-        int err = vmm_resolve_page_not_present_locked(vaddr);
+        int err = vmm_resolve_page_not_present_locked(vaddr, true);
+        if (err) {
+            return err;
+        }
+    }
+
+    if (IS_USER_VADDR(vaddr) && _vmm_is_zero_page_mapped(vaddr)) {
+        int err = _vmm_resolve_zero_page_locked(vaddr);
+        if (err) {
+            return err;
+        }
+    }
+
+    if (IS_USER_VADDR(vaddr) && vmm_is_page_copy_on_write(vaddr)) {
+        int err = vmm_resolve_page_copy_on_write(vaddr);
         if (err) {
             return err;
         }
@@ -399,7 +509,22 @@ static int _vmm_ensure_write_to_page(uintptr_t vaddr)
     // Take lock only if page is not available.
     if (!vmm_is_page_present(vaddr)) {
         spinlock_acquire(&active_address_space->lock);
-        int err = vmm_resolve_page_not_present_locked(vaddr);
+        int err = vmm_resolve_page_not_present_locked(vaddr, true);
+        spinlock_release(&active_address_space->lock);
+        if (err) {
+            return err;
+        }
+    }
+
+    // Zones are looked up to find pages shared after fork, so the lock is needed.
+    if (IS_USER_VADDR(vaddr)) {
+        int err = 0;
+        spinlock_acquire(&active_address_space->lock);
+        if (_vmm_is_zero_page_mapped(vaddr)) {
+            err = _vmm_resolve_zero_page_locked(vaddr);
+        } else if (vmm_is_page_copy_on_write(vaddr)) {
+            err = vmm_resolve_page_copy_on_write(vaddr);
+        }
         spinlock_release(&active_address_space->lock);
         if (err) {
             return err;
@@ -452,7 +577,7 @@ void vmm_ensure_writing_to_active_address_space(uintptr_t dest_vaddr, size_t len
 static int _vmm_ensure_read_from_page_locked(uintptr_t vaddr)
 {
     if (!vmm_is_page_present(vaddr)) {
-        int err = vmm_resolve_page_not_present_locked(vaddr);
+        int err = vmm_resolve_page_not_present_locked(vaddr, false);
         if (err) {
             return err;
         }
@@ -483,7 +608,7 @@ static int _vmm_ensure_read_from_page(uintptr_t vaddr)
 
     if (!vmm_is_page_present(vaddr)) {
         spinlock_acquire(&active_address_space->lock);
-        int err = vmm_resolve_page_not_present_locked(vaddr);
+        int err = vmm_resolve_page_not_present_locked(vaddr, false);
         spinlock_release(&active_address_space->lock);
         if (err) {
             return err;
@@ -554,7 +679,7 @@ static void* _vmm_bring_to_kernel_space(void* data, size_t length)
 
 extern bool vmm_is_page_swapped_impl(uintptr_t vaddr);
 extern int vmm_restore_swapped_page_locked_impl(uintptr_t vaddr);
-extern int vmm_swap_page_impl(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t vaddr);
+extern int vmm_swap_page_locked_impl(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t vaddr);
 
 bool vmm_is_page_swapped(uintptr_t vaddr)
 {
@@ -566,9 +691,24 @@ int vmm_restore_swapped_page_locked(uintptr_t vaddr)
     return vmm_restore_swapped_page_locked_impl(vaddr);
 }
 
-int vmm_swap_page(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t vaddr)
+/**
+ * @brief Checks if the page of the active address space was written since
+ *        its content was loaded. Pages are reported dirty when the platform
+ *        does not track writes.
+ */
+bool vmm_is_page_dirty(uintptr_t vaddr)
+{
+    ptable_entity_t* page_desc = vm_get_entity(vaddr, PTABLE_LV0);
+    return vm_ptable_entity_is_dirty(page_desc, PTABLE_LV0);
+}
+
+/**
+ * @brief Moves the page out of memory. Should be called for the active
+ *        address space with its lock held.
+ */
+int vmm_swap_page_locked(ptable_entity_t* page_desc, memzone_t* zone, uintptr_t vaddr)
 {
-    return vmm_swap_page_impl(page_desc, zone, vaddr);
+    return vmm_swap_page_locked_impl(page_desc, zone, vaddr);
 }
 
 /**
@@ -692,7 +832,7 @@ void vmm_copy_to_address_space(vm_address_space_t* vm_aspace, void* src, uintptr
  * PAGE FAULT FUNCTIONS
  */
 
-static int _vmm_on_page_not_present_locked(uintptr_t vaddr)
+static int _vmm_on_page_not_present_locked(uintptr_t vaddr, bool for_write)
 {
     if (vmm_is_page_present(vaddr)) {
         return 0;
@@ -706,7 +846,7 @@ static int _vmm_on_page_not_present_locked(uintptr_t vaddr)
         }
     }
 
-    return vmm_resolve_page_not_present_locked(vaddr);
+    return vmm_resolve_page_not_present_locked(vaddr, for_write);
 }
 
 static int _vmm_pf_on_writing_locked(uintptr_t vaddr)
@@ -721,6 +861,20 @@ static int _vmm_pf_on_writing_locked(uintptr_t vaddr)
         visited++;
     }
 
+    if (IS_USER_VADDR(vaddr) && _vmm_is_zero_page_mapped(vaddr)) {
+        int err = _vmm_resolve_zero_page_locked(vaddr);
+        if (err) {
+            return err;
+        }
+        visited++;
+    } else if (IS_USER_VADDR(vaddr) && vmm_is_page_copy_on_write(vaddr)) {
+        int err = vmm_resolve_page_copy_on_write(vaddr);
+        if (err) {
+            return err;
+        }
+        visited++;
+    }
+
     if (!visited) {
         return -EFAULT;
     }
@@ -735,7 +889,7 @@ int vmm_page_fault_handler(arch_pf_info_t info, uintptr_t vaddr)
 
     if (TEST_FLAG(pf_info_flags, MMU_PF_INFO_ON_NOT_PRESENT)) {
         spinlock_acquire(&active_address_space->lock);
-        int res = _vmm_on_page_not_present_locked(vaddr);
+        int res = _vmm_on_page_not_present_locked(vaddr, TEST_FLAG(pf_info_flags, MMU_PF_INFO_ON_WRITE));
         spinlock_release(&active_address_space->lock);
         return res;
     }
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifdef ZSWAP_ENABLED
+
+#include <algo/lz4.h>
+#include <libkern/bits/errno.h>
+#include <libkern/libkern.h>
+#include <mem/pmm.h>
+#include <mem/swapfile.h>
+#include <mem/vm_alloc.h>
+#include <mem/zswap.h>
+
+#define ZSWAP_MAX_OBJECT_SIZE (VMM_PAGE_SIZE / 4 * 3) // Worse compressed pages are not worth keeping in memory.
+#define ZSWAP_NO_HANDLE (0) // Chunk 0 of a pool page is the header, so it's never an object.
+
+/**
+ * Every pool page starts with the header. An object takes consecutive
+ * chunks and is referenced by the pool page and its first chunk.
+ */
+struct zswap_page_header {
+    uint64_t used;
+    uint16_t slots[ZSWAP_CHUNKS_PER_PAGE];
+    uint16_t lens[ZSWAP_CHUNKS_PER_PAGE]; // Zero if no object starts at the chunk.
+};
+typedef struct zswap_page_header zswap_page_header_t;
+
+static kmemzone_t _zswap_pages[ZSWAP_MAX_POOL_PAGES];
+static size_t _zswap_pool_pages = 0;
+static size_t _zswap_max_pool_pages = 0;
+static size_t _zswap_writeback_page = 0;
+static uint16_t _zswap_handles[SWAPFILE_MAX_SLOTS];
+
+static size_t _zswap_chunk_size;
+static int _zswap_header_chunks;
+static lz4_wrkmem_t _zswap_wrkmem;
+static kmemzone_t _zswap_buf; // A compressed page is kept here until a place in the pool is found.
+
+static size_t _zswap_stored_pages = 0;
+static size_t _zswap_hits = 0;
+static size_t _zswap_misses = 0;
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static inline zswap_page_header_t* _zswap_header(size_t page)
+{
+    return (zswap_page_header_t*)_zswap_pages[page].ptr;
+}
+
+static inline size_t _zswap_chunks_of(size_t len)
+{
+    return (len + _zswap_chunk_size - 1) / _zswap_chunk_size;
+}
+
+static inline uint64_t _zswap_chunks_mask(int start, size_t count)
+{
+    return ((1ull << count) - 1) << start;
+}
+
+static inline uint16_t _zswap_handle(size_t page, int chunk)
+{
+    return page * ZSWAP_CHUNKS_PER_PAGE + chunk;
+}
+
+static inline void* _zswap_object(uint16_t handle)
+{
+    return _zswap_pages[handle / ZSWAP_CHUNKS_PER_PAGE].ptr + (handle % ZSWAP_CHUNKS_PER_PAGE) * _zswap_chunk_size;
+}
+
+static int _zswap_find_chunks(uint64_t used, size_t count)
+{
+    size_t run = 0;
+    for (int i = 0; i < ZSWAP_CHUNKS_PER_PAGE; i++) {
+        if ((used >> i) & 1) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            return i - count + 1;
+        }
+    }
+    return -1;
+}
+
+static bool _zswap_alloc_pool_page(size_t* page)
+{
+    if (_zswap_pool_pages >= _zswap_max_pool_pages) {
+        return false;
+    }
+
+    for (size_t i = 0; i < ZSWAP_MAX_POOL_PAGES; i++) {
+        if (_zswap_pages[i].ptr) {
+            continue;
+        }
+
+        if (vm_alloc_mapped_zone(VMM_PAGE_SIZE, VMM_PAGE_SIZE, &_zswap_pages[i], MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE)) {
+            _zswap_pages[i].ptr = NULL;
+            return false;
+        }
+
+        zswap_page_header_t* header = _zswap_header(i);
+        memset(header, 0, sizeof(zswap_page_header_t));
+        header->used = _zswap_chunks_mask(0, _zswap_header_chunks);
+        _zswap_pool_pages++;
+        *page = i;
+        return true;
+    }
+    return false;
+}
+
+static void _zswap_free_pool_page(size_t page)
+{
+    vm_free_mapped_zone(_zswap_pages[page]);
+    _zswap_pages[page].ptr = NULL;
+    _zswap_pages[page].len = 0;
+    _zswap_pool_pages--;
+}
+
+// Takes the first run of free chunks which fits the object, the pool grows only if there is none.
+static bool _zswap_alloc_object(size_t len, size_t* page, int* chunk)
+{
+    size_t count = _zswap_chunks_of(len);
+    for (size_t i = 0; i < ZSWAP_MAX_POOL_PAGES; i++) {
+        zswap_page_header_t* header = _zswap_header(i);
+        if (!header) {
+            continue;
+        }
+
+        int start = _zswap_find_chunks(header->used, count);
+        if (start >= 0) {
+            *page = i;
+            *chunk = start;
+            return true;
+        }
+    }
+
+    if (!_zswap_alloc_pool_page(page)) {
+        return false;
+    }
+    *chunk = _zswap_header_chunks;
+    return true;
+}
+
+// The pool page is freed with its last object.
+static void _zswap_free_object(uint16_t handle)
+{
+    size_t page = handle / ZSWAP_CHUNKS_PER_PAGE;
+    int chunk = handle % ZSWAP_CHUNKS_PER_PAGE;
+    zswap_page_header_t* header = _zswap_header(page);
+
+    header->used &= ~_zswap_chunks_mask(chunk, _zswap_chunks_of(header->lens[chunk]));
+    header->lens[chunk] = 0;
+    _zswap_stored_pages--;
+
+    if (header->used == _zswap_chunks_mask(0, _zswap_header_chunks)) {
+        _zswap_free_pool_page(page);
+    }
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+int zswap_init()
+{
+    _zswap_chunk_size = VMM_PAGE_SIZE / ZSWAP_CHUNKS_PER_PAGE;
+    _zswap_header_chunks = _zswap_chunks_of(sizeof(zswap_page_header_t));
+
+    size_t ram_pages = pmm_get_ram_in_kb() / (VMM_PAGE_SIZE / 1024);
+    _zswap_max_pool_pages = min(ram_pages * ZSWAP_MAX_POOL_PERCENT / 100, ZSWAP_MAX_POOL_PAGES);
+    return vm_alloc_mapped_zone(ZSWAP_MAX_OBJECT_SIZE, VMM_PAGE_SIZE, &_zswap_buf, MMU_FLAG_PERM_READ | MMU_FLAG_PERM_WRITE);
+}
+
+/**
+ * @brief Compresses the page to the pool under the slot.
+ *
+ * @return 0 on success, -E2BIG if the page is poorly compressible, or
+ *         -ENOSPC if the pool is full.
+ */
+int zswap_store(int slot, const void* page)
+{
+    if (!_zswap_buf.ptr) {
+        return -ENODEV;
+    }
+
+    zswap_invalidate(slot);
+    int len = lz4_compress(page, VMM_PAGE_SIZE, _zswap_buf.ptr, ZSWAP_MAX_OBJECT_SIZE, &_zswap_wrkmem);
+    if (len < 0) {
+        return -E2BIG;
+    }
+
+    size_t pool_page;
+    int chunk;
+    if (!_zswap_alloc_object(len, &pool_page, &chunk)) {
+        return -ENOSPC;
+    }
+
+    zswap_page_header_t* header = _zswap_header(pool_page);
+    header->used |= _zswap_chunks_mask(chunk, _zswap_chunks_of(len));
+    header->slots[chunk] = slot;
+    header->lens[chunk] = len;
+
+    uint16_t handle = _zswap_handle(pool_page, chunk);
+    memcpy(_zswap_object(handle), _zswap_buf.ptr, len);
+    _zswap_handles[slot] = handle;
+    _zswap_stored_pages++;
+    return 0;
+}
+
+// The object is kept, since the slot could be referenced by other page tables.
+int zswap_load(int slot, void* page)
+{
+    uint16_t handle = _zswap_handles[slot];
+    if (handle == ZSWAP_NO_HANDLE) {
+        _zswap_misses++;
+        return -ENOENT;
+    }
+
+    zswap_page_header_t* header = _zswap_header(handle / ZSWAP_CHUNKS_PER_PAGE);
+    int len = lz4_decompress(_zswap_object(handle), header->lens[handle % ZSWAP_CHUNKS_PER_PAGE], page, VMM_PAGE_SIZE);
+    if (len != VMM_PAGE_SIZE) {
+        return -EIO;
+    }
+    _zswap_hits++;
+    return 0;
+}
+
+bool zswap_contains(int slot)
+{
+    return _zswap_handles[slot] != ZSWAP_NO_HANDLE;
+}
+
+void zswap_invalidate(int slot)
+{
+    uint16_t handle = _zswap_handles[slot];
+    if (handle == ZSWAP_NO_HANDLE) {
+        return;
+    }
+
+    _zswap_free_object(handle);
+    _zswap_handles[slot] = ZSWAP_NO_HANDLE;
+}
+
+/**
+ * @brief Decompresses an object to the page and drops it from the pool.
+ *        Objects are taken from the same pool page until it's empty, so
+ *        every writeback brings the pool closer to freeing a whole page.
+ *
+ * @return The slot of the object, or -ENOENT if the pool is empty.
+ */
+int zswap_writeback(void* page)
+{
+    for (size_t tries = 0; tries < ZSWAP_MAX_POOL_PAGES; tries++) {
+        size_t pool_page = _zswap_writeback_page;
+        zswap_page_header_t* header = _zswap_header(pool_page);
+        for (int chunk = _zswap_header_chunks; header && chunk < ZSWAP_CHUNKS_PER_PAGE; chunk++) {
+            if (!header->lens[chunk]) {
+                continue;
+            }
+
+            int slot = header->slots[chunk];
+            if (lz4_decompress(_zswap_object(_zswap_handle(pool_page, chunk)), header->lens[chunk], page, VMM_PAGE_SIZE) != VMM_PAGE_SIZE) {
+                return -EIO;
+            }
+            zswap_invalidate(slot);
+            return slot;
+        }
+        _zswap_writeback_page = (pool_page + 1) % ZSWAP_MAX_POOL_PAGES;
+    }
+    return -ENOENT;
+}
+
+size_t zswap_get_pool_in_kb()
+{
+    return _zswap_pool_pages * (VMM_PAGE_SIZE / 1024);
+}
+
+size_t zswap_get_stored_in_kb()
+{
+    return _zswap_stored_pages * (VMM_PAGE_SIZE / 1024);
+}
+
+size_t zswap_get_hits()
+{
+    return _zswap_hits;
+}
+
+size_t zswap_get_misses()
+{
+    return _zswap_misses;
+}
+
+#endif
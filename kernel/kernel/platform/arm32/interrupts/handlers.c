@@ -219,4 +219,20 @@ void irq_register_handler(irq_line_t line, irq_priority_t prior, irq_flags_t fla
 {
     _irq_handlers[line] = func;
     gic_descriptor.enable_irq(line, prior, flags, cpu_mask);
-}
\ No newline at end of file
+}
+
+void irq_register_ipi_handler(ipi_t ipi, irq_handler_t func)
+{
+    // IPIs are mapped to SGIs, which have the same ids.
+    if (!gic_descriptor.send_ipi) {
+        return;
+    }
+    irq_register_handler((irq_line_t)ipi, 0, IRQ_FLAG_EDGE_TRIGGERED, func, ALL_CPU_MASK);
+}
+
+void irq_send_ipi(ipi_t ipi, int cpu_mask)
+{
+    if (gic_descriptor.send_ipi) {
+        gic_descriptor.send_ipi(ipi, cpu_mask);
+    }
+}
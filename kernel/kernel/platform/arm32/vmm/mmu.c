@@ -53,6 +53,7 @@ ptable_entity_t vm_mmu_to_arch_flags(mmu_flags_t mmu_flags, ptable_lv_t lv)
         SET_OP(mmu_flags, MMU_FLAG_NONPRIV, arch_page_flags->ap1 = 0b10);
         SET_OP(mmu_flags, MMU_FLAG_PERM_WRITE, arch_page_flags->ap1 |= 0b01);
         SET_OP(mmu_flags, MMU_FLAG_UNCACHED, arch_page_flags->c = 0);
+        SET_OP(mmu_flags, MMU_FLAG_GLOBAL, arch_page_flags->ng = 0);
         return arch_flags;
 
     case PTABLE_LV1:
@@ -84,6 +85,10 @@ mmu_flags_t vm_arch_to_mmu_flags(ptable_entity_t* entity, ptable_lv_t lv)
             mmu_flags |= MMU_FLAG_UNCACHED;
         }
 
+        if (arch_page_flags->one != 0 && arch_page_flags->ng == 0) {
+            mmu_flags |= MMU_FLAG_GLOBAL;
+        }
+
         if (arch_page_flags->ap1 == 0b11) {
             mmu_flags |= MMU_FLAG_NONPRIV | MMU_FLAG_PERM_WRITE;
         } else if (arch_page_flags->ap1 == 0b10) {
@@ -175,6 +180,7 @@ void vm_ptable_entity_set_default_flags(ptable_entity_t* entity, ptable_lv_t lv)
         arch_page_flags->s = 1;
         arch_page_flags->b = 1;
         arch_page_flags->tex = 0b001;
+        arch_page_flags->ng = 1; // Pages are tagged with the ASID of their address space.
         return;
 
     case PTABLE_LV1:
@@ -292,3 +298,20 @@ bool vm_ptable_entity_is_only_allocated(ptable_entity_t* entity, ptable_lv_t lv)
     }
     return vm_ptable_entity_state(entity, lv) == PTABLE_ENTITY_ALLOC;
 }
+
+bool vm_ptable_entity_test_and_clear_accessed(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    // There is no hardware accessed flag, so every page looks cold.
+    return false;
+}
+
+bool vm_ptable_entity_is_dirty(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    // There is no hardware dirty flag, so every page is treated as written.
+    return true;
+}
+
+void vm_ptable_entity_clear_dirty(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    // Nothing to clear, see vm_ptable_entity_is_dirty().
+}
@@ -148,10 +148,7 @@ void fast_irq_handler(trapframe_t* tf)
     // Reimplement this when a proper AIC driver is avail.
     system_disable_interrupts();
     cpu_state_t prev_cpu_state = cpu_enter_kernel_space();
-    arm64_timer_rearm();
-    cpu_tick();
-    timeman_timer_tick();
-    sched_tick();
+    arm64_timer_handler();
     cpu_set_state(prev_cpu_state);
     system_enable_interrupts_only_counter();
 }
@@ -183,4 +180,20 @@ void irq_register_handler(irq_line_t line, irq_priority_t prior, irq_flags_t fla
 {
     _irq_handlers[line] = func;
     gic_descriptor.enable_irq(line, prior, flags, cpu_mask);
-}
\ No newline at end of file
+}
+
+void irq_register_ipi_handler(ipi_t ipi, irq_handler_t func)
+{
+    // IPIs are mapped to SGIs, which have the same ids.
+    if (!gic_descriptor.send_ipi) {
+        return;
+    }
+    irq_register_handler((irq_line_t)ipi, 0, IRQ_FLAG_EDGE_TRIGGERED, func, ALL_CPU_MASK);
+}
+
+void irq_send_ipi(ipi_t ipi, int cpu_mask)
+{
+    if (gic_descriptor.send_ipi) {
+        gic_descriptor.send_ipi(ipi, cpu_mask);
+    }
+}
@@ -49,6 +49,7 @@ static ptable_entity_t terminating_page_common_mmu_to_arch_flags(mmu_flags_t mmu
 
     SET_OP(mmu_flags, MMU_FLAG_NONPRIV, arch_flags |= (0b01 << 6));
     SET_OP_NEG(mmu_flags, MMU_FLAG_PERM_WRITE, arch_flags |= (0b10 << 6));
+    SET_OP_NEG(mmu_flags, MMU_FLAG_GLOBAL, arch_flags |= (1 << 11));
 
     // 0x700 are default flags.
     return arch_flags | 0x700;
@@ -94,6 +95,11 @@ static mmu_flags_t terminating_page_common_arch_to_mmu_flags(ptable_entity_t* en
         mmu_flags |= MMU_FLAG_NONPRIV;
     }
 
+    // Default flags leave nG clear, so only valid entries are treated as global.
+    if (TEST_FLAG(arch_flags, 0b1) && !TEST_FLAG(arch_flags, (1 << 11))) {
+        mmu_flags |= MMU_FLAG_GLOBAL;
+    }
+
     return mmu_flags;
 }
 
@@ -272,3 +278,20 @@ bool vm_ptable_entity_is_only_allocated(ptable_entity_t* entity, ptable_lv_t lv)
     // This is for 32bit systems only.
     return false;
 }
+
+bool vm_ptable_entity_test_and_clear_accessed(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    // The access flag is always set by the kernel, so it carries no information.
+    return false;
+}
+
+bool vm_ptable_entity_is_dirty(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    // There is no hardware dirty flag, so every page is treated as written.
+    return true;
+}
+
+void vm_ptable_entity_clear_dirty(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    // Nothing to clear, see vm_ptable_entity_is_dirty().
+}
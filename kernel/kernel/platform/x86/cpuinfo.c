@@ -40,12 +40,14 @@ void cpuinfo_init()
     SET_FEAT(cpuid_1_0.edx, 0, THIS_CPU->cpufeat |= CPUFEAT_FPU);
     SET_FEAT(cpuid_1_0.edx, 3, THIS_CPU->cpufeat |= CPUFEAT_PSE);
     SET_FEAT(cpuid_1_0.edx, 6, THIS_CPU->cpufeat |= CPUFEAT_PAE);
+    SET_FEAT(cpuid_1_0.edx, 13, THIS_CPU->cpufeat |= CPUFEAT_PGE);
     SET_FEAT(cpuid_1_0.edx, 19, THIS_CPU->cpufeat |= CPUFEAT_CLFSH);
     SET_FEAT(cpuid_1_0.edx, 25, THIS_CPU->cpufeat |= CPUFEAT_SSE);
     SET_FEAT(cpuid_1_0.edx, 26, THIS_CPU->cpufeat |= CPUFEAT_SSE2);
 
     SET_FEAT(cpuid_1_0.ecx, 0, THIS_CPU->cpufeat |= CPUFEAT_SSE3);
     SET_FEAT(cpuid_1_0.ecx, 9, THIS_CPU->cpufeat |= CPUFEAT_SSSE3);
+    SET_FEAT(cpuid_1_0.ecx, 17, THIS_CPU->cpufeat |= CPUFEAT_PCID);
     SET_FEAT(cpuid_1_0.ecx, 19, THIS_CPU->cpufeat |= CPUFEAT_SSE4_1);
     SET_FEAT(cpuid_1_0.ecx, 20, THIS_CPU->cpufeat |= CPUFEAT_SSE4_2);
     SET_FEAT(cpuid_1_0.ecx, 26, THIS_CPU->cpufeat |= CPUFEAT_XSAVE);
@@ -15,9 +15,10 @@
         arch_flags |= af;                        \
     }
 
+// Accessed and dirty bits are set by the cpu, they are kept when permissions change.
 static inline void clear_arch_flags(ptable_entity_t* entity)
 {
-    *entity &= ~((1 << (PAGE_DESC_FRAME_OFFSET)) - 1);
+    *entity &= ~((1 << (PAGE_DESC_FRAME_OFFSET)) - 1) | PAGE_DESC_ACCESSED | PAGE_DESC_DIRTY;
 }
 
 ptable_entity_t vm_mmu_to_arch_flags(mmu_flags_t mmu_flags, ptable_lv_t lv)
@@ -178,3 +179,31 @@ bool vm_ptable_entity_is_only_allocated(ptable_entity_t* entity, ptable_lv_t lv)
     }
     return vm_ptable_entity_state(entity, lv) == PTABLE_ENTITY_ALLOC;
 }
+
+// The cpu sets the bit on every access, it's cleared atomically not to lose a dirty bit set meanwhile.
+bool vm_ptable_entity_test_and_clear_accessed(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    if (!entity) {
+        return false;
+    }
+    ptable_entity_t bit = (lv == PTABLE_LV0) ? PAGE_DESC_ACCESSED : TABLE_DESC_ACCESSED;
+    return __atomic_fetch_and(entity, ~bit, __ATOMIC_RELAXED) & bit;
+}
+
+bool vm_ptable_entity_is_dirty(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    if (!entity) {
+        return true;
+    }
+    ptable_entity_t bit = (lv == PTABLE_LV0) ? PAGE_DESC_DIRTY : TABLE_DESC_DIRTY;
+    return *entity & bit;
+}
+
+void vm_ptable_entity_clear_dirty(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    if (!entity) {
+        return;
+    }
+    ptable_entity_t bit = (lv == PTABLE_LV0) ? PAGE_DESC_DIRTY : TABLE_DESC_DIRTY;
+    __atomic_fetch_and(entity, ~bit, __ATOMIC_RELAXED);
+}
@@ -149,3 +149,13 @@ irq_line_t irqline_from_id(int id)
 {
     return id + IRQ_MASTER_OFFSET;
 }
+
+void irq_register_ipi_handler(ipi_t ipi, irq_handler_t func)
+{
+    // x86 runs on the boot cpu only, so IPIs are not used.
+}
+
+void irq_send_ipi(ipi_t ipi, int cpu_mask)
+{
+    // x86 runs on the boot cpu only, so IPIs are not used.
+}
@@ -11,6 +11,11 @@
 #include <platform/x86/system.h>
 #include <tasking/tasking.h>
 
+#define CR4_PGE (1 << 7)
+#define CR4_PCIDE (1 << 17)
+#define CR3_PCID_NOFLUSH (1ull << 63)
+#define PCID_COUNT (4096)
+
 bool system_can_preempt_kernel()
 {
 #ifdef PREEMPT_KERNEL
@@ -41,6 +46,67 @@ void system_enable_interrupts_only_counter()
     ASSERT(THIS_CPU->int_depth_counter >= 0);
 }
 
+/**
+ * @brief Enables global pages and PCIDs on the cpu. Kernel pages are global,
+ *        so their TLB entries are shared by all PCIDs and survive switches.
+ *
+ * @return The count of PCIDs, or 0 if the cpu can't tag TLB entries.
+ */
+int system_setup_asids()
+{
+#ifdef __x86_64__
+    if (!TEST_FLAG(THIS_CPU->cpufeat, CPUFEAT_PGE)) {
+        return 0;
+    }
+
+    uintptr_t cr4 = read_cr4() | CR4_PGE;
+    bool has_pcid = TEST_FLAG(THIS_CPU->cpufeat, CPUFEAT_PCID);
+    if (has_pcid) {
+        cr4 |= CR4_PCIDE;
+    }
+    write_cr4(cr4);
+    return has_pcid ? PCID_COUNT : 0;
+#else
+    return 0;
+#endif
+}
+
+// The PCID is loaded with CR3, the flag keeps entries cached for it.
+void system_set_pdir_asid(uintptr_t pdir0, uintptr_t pdir1, int asid, bool flush)
+{
+#ifdef __x86_64__
+    uintptr_t cr3 = pdir0 | asid;
+    if (!flush) {
+        cr3 |= CR3_PCID_NOFLUSH;
+    }
+    system_set_pdir(cr3, pdir1);
+#else
+    system_set_pdir(pdir0, pdir1);
+#endif
+}
+
+/**
+ * @brief Drops all TLB entries of the cpu. Reloading CR3 keeps global
+ *        entries and entries of other PCIDs, while toggling CR4.PGE drops
+ *        entries of all PCIDs, including global ones. PCIDs are enabled
+ *        only together with global pages.
+ */
+void system_flush_whole_tlb()
+{
+    uintptr_t cr4 = read_cr4();
+    if (!TEST_FLAG(cr4, CR4_PGE)) {
+        system_set_pdir(read_cr3(), 0x0);
+        return;
+    }
+    write_cr4(cr4 & ~CR4_PGE);
+    write_cr4(cr4);
+}
+
+void system_flush_tlb_all_asids()
+{
+    system_flush_whole_tlb();
+}
+
 void system_cache_clean_and_invalidate(void* addr, size_t size)
 {
     if (!TEST_FLAG(THIS_CPU->cpufeat, CPUFEAT_CLFSH)) {
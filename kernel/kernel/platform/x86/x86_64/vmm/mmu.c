@@ -27,9 +27,10 @@
         op;                           \
     }
 
+// Accessed and dirty bits are set by the cpu, they are kept when permissions change.
 static inline void clear_arch_flags(ptable_entity_t* entity)
 {
-    *entity &= ~((1ull << (FRAME_OFFSET)) - 1);
+    *entity &= ~((1ull << (FRAME_OFFSET)) - 1) | (1ull << 5) | (1ull << 6);
     *entity &= ((1ull << (52)) - 1);
 }
 
@@ -40,6 +41,7 @@ static ptable_entity_t terminating_page_common_mmu_to_arch_flags(mmu_flags_t mmu
     SET_OP(mmu_flags, MMU_FLAG_PERM_WRITE, arch_flags |= (1 << 1));
     SET_OP(mmu_flags, MMU_FLAG_NONPRIV, arch_flags |= (1 << 2));
     SET_OP(mmu_flags, MMU_FLAG_UNCACHED, arch_flags |= (1 << 4));
+    SET_OP(mmu_flags, MMU_FLAG_GLOBAL, arch_flags |= (1 << 8));
 
     return arch_flags;
 }
@@ -81,6 +83,7 @@ static mmu_flags_t terminating_page_common_arch_to_mmu_flags(ptable_entity_t* en
     SET_FLAGS(arch_flags, (1 << 1), mmu_flags, MMU_FLAG_PERM_WRITE);
     SET_FLAGS(arch_flags, (1 << 2), mmu_flags, MMU_FLAG_NONPRIV);
     SET_FLAGS(arch_flags, (1 << 4), mmu_flags, MMU_FLAG_UNCACHED);
+    SET_FLAGS(arch_flags, (1 << 8), mmu_flags, MMU_FLAG_GLOBAL);
 
     return mmu_flags;
 }
@@ -203,4 +206,32 @@ bool vm_ptable_entity_is_only_allocated(ptable_entity_t* entity, ptable_lv_t lv)
 {
     // This is for 32bit systems only.
     return false;
-}
\ No newline at end of file
+}
+
+// The cpu sets the bit on every access, it's cleared atomically not to lose a dirty bit set meanwhile.
+bool vm_ptable_entity_test_and_clear_accessed(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    if (!entity) {
+        return false;
+    }
+    ptable_entity_t bit = (1 << 5);
+    return __atomic_fetch_and(entity, ~bit, __ATOMIC_RELAXED) & bit;
+}
+
+bool vm_ptable_entity_is_dirty(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    if (!entity) {
+        return true;
+    }
+    ptable_entity_t bit = (1 << 6);
+    return *entity & bit;
+}
+
+void vm_ptable_entity_clear_dirty(ptable_entity_t* entity, ptable_lv_t lv)
+{
+    if (!entity) {
+        return;
+    }
+    ptable_entity_t bit = (1 << 6);
+    __atomic_fetch_and(entity, ~bit, __ATOMIC_RELAXED);
+}
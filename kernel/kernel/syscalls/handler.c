@@ -19,6 +19,7 @@ static const void* syscalls[] = {
     [SYS_RESTART_SYSCALL] = sys_restart_syscall,
     [SYS_EXIT] = sys_exit,
     [SYS_FORK] = sys_fork,
+    [SYS_VFORK] = sys_vfork,
     [SYS_READ] = sys_read,
     [SYS_WRITE] = sys_write,
     [SYS_OPEN] = sys_open,
@@ -63,7 +64,14 @@ static const void* syscalls[] = {
     [SYS_FSTAT] = sys_fstat,
     [SYS_FSYNC] = sys_fsync,
     [SYS_SCHED_YIELD] = sys_sched_yield,
+    [SYS_SCHED_SETPARAM] = sys_sched_setparam,
+    [SYS_SCHED_GETPARAM] = sys_sched_getparam,
+    [SYS_SCHED_SETSCHEDULER] = sys_sched_setscheduler,
+    [SYS_SCHED_GETSCHEDULER] = sys_sched_getscheduler,
+    [SYS_SCHED_SETAFFINITY] = sys_sched_setaffinity,
+    [SYS_SCHED_GETAFFINITY] = sys_sched_getaffinity,
     [SYS_UNAME] = sys_uname,
+    [SYS_ALARM] = sys_alarm,
     [SYS_CLOCK_GETTIME] = sys_clock_gettime,
     [SYS_CLOCK_SETTIME] = sys_none,
     [SYS_CLOCK_GETRES] = sys_none,
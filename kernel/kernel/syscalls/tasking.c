@@ -26,6 +26,11 @@ void sys_fork(trapframe_t* tf)
     tasking_fork();
 }
 
+void sys_vfork(trapframe_t* tf)
+{
+    tasking_vfork();
+}
+
 void sys_waitpid(trapframe_t* tf)
 {
     int __user* status = (int __user*)SYSCALL_VAR2(tf);
@@ -111,7 +116,129 @@ void sys_create_thread(trapframe_t* tf)
 
 void sys_sched_yield(trapframe_t* tf)
 {
-    resched();
+    sched_yield();
+}
+
+static proc_t* _sys_sched_get_proc(pid_t pid)
+{
+    if (!pid) {
+        return RUNNING_THREAD->process;
+    }
+    return tasking_get_proc(pid);
+}
+
+static int _sys_sched_set(pid_t pid, int policy, struct sched_param __user* param)
+{
+    struct sched_param kparam;
+    if (!param) {
+        return -EINVAL;
+    }
+    umem_copy_from_user(&kparam, param, sizeof(kparam));
+
+    proc_t* p = _sys_sched_get_proc(pid);
+    if (!p) {
+        return -ESRCH;
+    }
+    if (policy < 0) {
+        policy = p->sched_policy;
+    }
+
+    proc_t* cur = RUNNING_THREAD->process;
+    if (!proc_is_su(cur) && cur->euid != p->euid) {
+        return -EPERM;
+    }
+
+    // Rt threads could starve the rest of the system, so only su sets them up.
+    if (policy != SCHED_OTHER && !proc_is_su(cur)) {
+        return -EPERM;
+    }
+    return sched_setscheduler(p, policy, kparam.sched_priority);
+}
+
+void sys_sched_setscheduler(trapframe_t* tf)
+{
+    int policy = SYSCALL_VAR2(tf);
+    if (policy < 0) {
+        return_with_val(-EINVAL);
+    }
+    return_with_val(_sys_sched_set(SYSCALL_VAR1(tf), policy, (struct sched_param __user*)SYSCALL_VAR3(tf)));
+}
+
+void sys_sched_getscheduler(trapframe_t* tf)
+{
+    proc_t* p = _sys_sched_get_proc(SYSCALL_VAR1(tf));
+    if (!p) {
+        return_with_val(-ESRCH);
+    }
+    return_with_val(p->sched_policy);
+}
+
+void sys_sched_setparam(trapframe_t* tf)
+{
+    return_with_val(_sys_sched_set(SYSCALL_VAR1(tf), -1, (struct sched_param __user*)SYSCALL_VAR2(tf)));
+}
+
+void sys_sched_getparam(trapframe_t* tf)
+{
+    struct sched_param __user* param = (struct sched_param __user*)SYSCALL_VAR2(tf);
+    proc_t* p = _sys_sched_get_proc(SYSCALL_VAR1(tf));
+    if (!p) {
+        return_with_val(-ESRCH);
+    }
+    if (!param) {
+        return_with_val(-EINVAL);
+    }
+
+    struct sched_param kparam = { .sched_priority = p->rt_prio };
+    umem_copy_to_user(param, &kparam, sizeof(kparam));
+    return_with_val(0);
+}
+
+static int _sys_sched_get_affinity_thread(pid_t tid, size_t cpusetsize, thread_t** res)
+{
+    if (cpusetsize < sizeof(cpu_set_t)) {
+        return -EINVAL;
+    }
+
+    thread_t* thread = tid ? tasking_get_thread(tid) : RUNNING_THREAD;
+    if (!thread || thread_is_freed(thread)) {
+        return -ESRCH;
+    }
+    *res = thread;
+    return 0;
+}
+
+void sys_sched_setaffinity(trapframe_t* tf)
+{
+    cpu_set_t __user* mask = (cpu_set_t __user*)SYSCALL_VAR3(tf);
+    thread_t* thread;
+    int err = _sys_sched_get_affinity_thread(SYSCALL_VAR1(tf), SYSCALL_VAR2(tf), &thread);
+    if (err) {
+        return_with_val(err);
+    }
+
+    proc_t* cur = RUNNING_THREAD->process;
+    if (!proc_is_su(cur) && cur->euid != thread->process->euid) {
+        return_with_val(-EPERM);
+    }
+
+    cpu_set_t kmask;
+    umem_copy_from_user(&kmask, mask, sizeof(kmask));
+    return_with_val(sched_setaffinity(thread, kmask.bits));
+}
+
+void sys_sched_getaffinity(trapframe_t* tf)
+{
+    cpu_set_t __user* mask = (cpu_set_t __user*)SYSCALL_VAR3(tf);
+    thread_t* thread;
+    int err = _sys_sched_get_affinity_thread(SYSCALL_VAR1(tf), SYSCALL_VAR2(tf), &thread);
+    if (err) {
+        return_with_val(err);
+    }
+
+    cpu_set_t kmask = { .bits = thread->cpu_mask };
+    umem_copy_to_user(mask, &kmask, sizeof(kmask));
+    return_with_val(0);
 }
 
 void sys_nice(trapframe_t* tf)
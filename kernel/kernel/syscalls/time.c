@@ -15,6 +15,7 @@
 #include <syscalls/handlers.h>
 #include <tasking/tasking.h>
 #include <time/time_manager.h>
+#include <time/timer.h>
 
 void sys_clock_gettime(trapframe_t* tf)
 {
@@ -89,4 +90,21 @@ void sys_sleep(trapframe_t* tf)
         umem_put_user(krem, urem);
     }
     return_with_val(0);
-}
\ No newline at end of file
+}
+
+void sys_alarm(trapframe_t* tf)
+{
+    proc_t* p = RUNNING_THREAD->process;
+    uint32_t seconds = SYSCALL_VAR1(tf);
+
+    // The seconds left of the previous alarm are rounded up, so a pending alarm never reports 0.
+    time_t ticks_left = timer_ticks_left(&p->alarm_timer);
+    bool was_pending = timer_cancel(&p->alarm_timer);
+    uint32_t prev_seconds = was_pending ? max((ticks_left + TIMER_TICKS_PER_SECOND - 1) / TIMER_TICKS_PER_SECOND, 1) : 0;
+
+    if (seconds) {
+        timespec_t delay = { seconds, 0 };
+        timer_arm_timespec(&p->alarm_timer, &delay);
+    }
+    return_with_val(prev_seconds);
+}
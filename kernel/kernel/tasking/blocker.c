@@ -11,10 +11,133 @@
 #include <libkern/log.h>
 #include <libkern/syscall_structs.h>
 #include <libkern/time.h>
+#include <platform/generic/system.h>
 #include <tasking/sched.h>
 #include <tasking/thread.h>
 #include <time/time_manager.h>
 
+/**
+ * HELPER FUNCTIONS
+ */
+
+static void _blocker_timeout_expired(timer_t* timer)
+{
+    blocker_wake_up((thread_t*)timer->data);
+}
+
+void blocker_setup(thread_t* thread)
+{
+    // join_wait_queue is not reset here: it lives as long as the thread
+    // slot does, so joiners of a previous owner could still be detaching.
+    thread->blocker.reason = BLOCKER_INVALID;
+    thread->wait_entries_count = 0;
+    timer_setup(&thread->timeout_timer, _blocker_timeout_expired, thread);
+}
+
+void blocker_wake_up(thread_t* thread)
+{
+    if (atomic_load(&thread->blocker.reason) == BLOCKER_INVALID) {
+        return;
+    }
+
+    // Clearing the reason tells the thread that it was woken up by an event,
+    // so it re-evaluates its blocking condition once it runs. If the thread
+    // is handling a signal now, it won't block again after the handler.
+    atomic_store(&thread->blocker.reason, BLOCKER_INVALID);
+    if (thread->status == THREAD_STATUS_BLOCKED) {
+        sched_enqueue(thread);
+    }
+}
+
+void blocker_detach(thread_t* thread)
+{
+    for (size_t i = 0; i < thread->wait_entries_count; i++) {
+        wait_queue_remove(&thread->wait_entries[i]);
+    }
+    thread->wait_entries_count = 0;
+    timer_cancel(&thread->timeout_timer);
+}
+
+static void _blocker_wait_for(thread_t* thread, wait_queue_t* wq)
+{
+    if (!wq) {
+        return;
+    }
+
+    for (size_t i = 0; i < thread->wait_entries_count; i++) {
+        if (thread->wait_entries[i].queue == wq) {
+            return;
+        }
+    }
+
+    ASSERT(thread->wait_entries_count < BLOCKER_MAX_WAIT_QUEUES);
+    wait_queue_entry_t* entry = &thread->wait_entries[thread->wait_entries_count++];
+    entry->thread = thread;
+    wait_queue_add(wq, entry);
+}
+
+static void _blocker_set_timeout(thread_t* thread, timespec_t until)
+{
+    timespec_t now = timeman_timespec_since_epoch();
+    timespec_t delay = { 0, 0 };
+    if (timespec_cmp(&until, &now) > 0) {
+        delay.tv_sec = until.tv_sec - now.tv_sec;
+        if (until.tv_nsec < now.tv_nsec) {
+            delay.tv_sec--;
+            delay.tv_nsec = 1000000000 + until.tv_nsec - now.tv_nsec;
+        } else {
+            delay.tv_nsec = until.tv_nsec - now.tv_nsec;
+        }
+    }
+    timer_arm_timespec(&thread->timeout_timer, &delay);
+}
+
+/**
+ * Blocks the thread until should_unblock() is satisfied. The thread should
+ * be already attached to all wait queues which could change the condition,
+ * so it's not touched by the scheduler while it's blocked.
+ */
+static int _blocker_wait(thread_t* thread, int reason, bool (*should_unblock)(thread_t* thread))
+{
+    thread->blocker.should_unblock = should_unblock;
+    thread->blocker.should_unblock_for_signal = true;
+    for (;;) {
+        // The reason is set before the check, so a notification issued
+        // while the condition is being checked is not lost.
+        system_disable_interrupts();
+        atomic_store(&thread->blocker.reason, reason);
+        if (should_unblock(thread)) {
+            thread->blocker.reason = BLOCKER_INVALID;
+            system_enable_interrupts();
+            break;
+        }
+
+        thread->status = THREAD_STATUS_BLOCKED;
+        sched_dequeue(thread);
+        // Another cpu could wake the thread up before it was marked as
+        // blocked, so nobody would enqueue it back.
+        if (atomic_load(&thread->blocker.reason) == BLOCKER_INVALID) {
+            sched_enqueue(thread);
+        }
+        system_enable_interrupts();
+        resched();
+
+        // The reason is cleared by blocker_wake_up() only, otherwise
+        // the thread was woken up by a signal.
+        if (thread->blocker.reason != BLOCKER_INVALID) {
+            thread->blocker.reason = BLOCKER_INVALID;
+            break;
+        }
+    }
+
+    blocker_detach(thread);
+    return 0;
+}
+
+/**
+ * BLOCKERS
+ */
+
 bool should_unblock_join_block(thread_t* thread)
 {
     if (thread_is_freed(thread->blocker_data.join.joinee) || thread->blocker_data.join.join_pid != thread->blocker_data.join.joinee->tid) {
@@ -32,22 +155,15 @@ extern thread_t* tasking_get_thread(pid_t tid);
 int init_join_blocker(thread_t* thread, int wait_for_pid)
 {
     thread_t* joinee_thread = tasking_get_thread(wait_for_pid);
-
-    thread->blocker_data.join.joinee = joinee_thread;
-    thread->blocker_data.join.join_pid = wait_for_pid;
-
-    if (should_unblock_join_block(thread)) {
+    if (!joinee_thread) {
         return 0;
     }
 
-    thread->status = THREAD_STATUS_BLOCKED;
-    thread->blocker.reason = BLOCKER_JOIN;
-    thread->blocker.should_unblock = should_unblock_join_block;
-    thread->blocker.should_unblock_for_signal = true;
-    sched_dequeue(thread);
-    resched();
+    thread->blocker_data.join.joinee = joinee_thread;
+    thread->blocker_data.join.join_pid = wait_for_pid;
 
-    return 0;
+    _blocker_wait_for(thread, &joinee_thread->join_wait_queue);
+    return _blocker_wait(thread, BLOCKER_JOIN, should_unblock_join_block);
 }
 
 bool should_unblock_read_block(thread_t* thread)
@@ -62,17 +178,14 @@ int init_read_blocker(thread_t* thread, file_descriptor_t* bfd)
 {
     thread->blocker_data.rw.fd = bfd;
 
-    if (should_unblock_read_block(thread)) {
+    // Files without a wait queue never change their state.
+    wait_queue_t* wq = vfs_wait_queue(bfd);
+    if (!wq) {
         return 0;
     }
 
-    thread->status = THREAD_STATUS_BLOCKED;
-    thread->blocker.reason = BLOCKER_READ;
-    thread->blocker.should_unblock = should_unblock_read_block;
-    thread->blocker.should_unblock_for_signal = true;
-    sched_dequeue(thread);
-    resched();
-    return 0;
+    _blocker_wait_for(thread, wq);
+    return _blocker_wait(thread, BLOCKER_READ, should_unblock_read_block);
 }
 
 bool should_unblock_write_block(thread_t* thread)
@@ -87,46 +200,34 @@ int init_write_blocker(thread_t* thread, file_descriptor_t* bfd)
 {
     thread->blocker_data.rw.fd = bfd;
 
-    if (should_unblock_write_block(thread)) {
+    // Files without a wait queue never change their state.
+    wait_queue_t* wq = vfs_wait_queue(bfd);
+    if (!wq) {
         return 0;
     }
 
-    thread->status = THREAD_STATUS_BLOCKED;
-    thread->blocker.reason = BLOCKER_WRITE;
-    thread->blocker.should_unblock = should_unblock_write_block;
-    thread->blocker.should_unblock_for_signal = true;
-    sched_dequeue(thread);
-    resched();
-    return 0;
+    _blocker_wait_for(thread, wq);
+    return _blocker_wait(thread, BLOCKER_WRITE, should_unblock_write_block);
 }
 
 bool should_unblock_sleep_block(thread_t* thread)
 {
     timespec_t ts = timeman_timespec_since_epoch();
-    return timespec_cmp(&thread->blocker_data.sleep.until, &ts) <= 0;
+    return !timer_pending(&thread->timeout_timer) || timespec_cmp(&thread->blocker_data.sleep.until, &ts) <= 0;
 }
 
 int init_sleep_blocker(thread_t* thread, timespec_t ts)
 {
     thread->blocker_data.sleep.until = ts;
 
-    if (should_unblock_sleep_block(thread)) {
-        return 0;
-    }
-
-    thread->status = THREAD_STATUS_BLOCKED;
-    thread->blocker.reason = BLOCKER_SLEEP;
-    thread->blocker.should_unblock = should_unblock_sleep_block;
-    thread->blocker.should_unblock_for_signal = true;
-    sched_dequeue(thread);
-    resched();
-    return 0;
+    _blocker_set_timeout(thread, ts);
+    return _blocker_wait(thread, BLOCKER_SLEEP, should_unblock_sleep_block);
 }
 
 bool should_unblock_select_block(thread_t* thread)
 {
     timespec_t ts = timeman_timespec_since_epoch();
-    if (thread->blocker_data.select.is_until_time_set && timespec_cmp(&thread->blocker_data.sleep.until, &ts) <= 0) {
+    if (thread->blocker_data.select.is_until_time_set && (!timer_pending(&thread->timeout_timer) || timespec_cmp(&thread->blocker_data.select.until, &ts) <= 0)) {
         return true;
     }
 
@@ -174,15 +275,24 @@ int init_select_blocker(thread_t* thread, int nfds, fd_set_t* readfds, fd_set_t*
     }
     thread->blocker_data.select.nfds = nfds;
 
-    if (should_unblock_select_block(thread)) {
-        return 0;
+    for (int i = 0; i < nfds; i++) {
+        if (FD_ISSET(i, &thread->blocker_data.select.readfds) || FD_ISSET(i, &thread->blocker_data.select.writefds)) {
+            file_descriptor_t* fd = proc_get_fd(thread->process, i);
+            if (fd) {
+                _blocker_wait_for(thread, vfs_wait_queue(fd));
+            }
+        }
+    }
+    if (thread->blocker_data.select.is_until_time_set) {
+        _blocker_set_timeout(thread, thread->blocker_data.select.until);
     }
 
-    thread->status = THREAD_STATUS_BLOCKED;
-    thread->blocker.reason = BLOCKER_SELECT;
-    thread->blocker.should_unblock = should_unblock_select_block;
-    thread->blocker.should_unblock_for_signal = true;
-    sched_dequeue(thread);
-    resched();
-    return 0;
+    return _blocker_wait(thread, BLOCKER_SELECT, should_unblock_select_block);
+}
+
+// Generic blocker for kernel threads which wait for a condition guarded by a wait queue.
+int init_wait_queue_blocker(thread_t* thread, wait_queue_t* wq, bool (*should_unblock)(thread_t* thread))
+{
+    _blocker_wait_for(thread, wq);
+    return _blocker_wait(thread, BLOCKER_WAIT_QUEUE, should_unblock);
 }
@@ -12,6 +12,7 @@
 #include <libkern/log.h>
 #include <mem/kmalloc.h>
 #include <mem/kmemzone.h>
+#include <mem/vmm.h>
 #include <tasking/elf.h>
 #include <tasking/tasking.h>
 
@@ -52,8 +53,12 @@ static int _elf_load_page_content(memzone_t* zone, uintptr_t vaddr)
     return 0;
 }
 
+// Pages which were not written since they were read from the file are dropped and read again on the next fault.
 static int _elf_swap_page_mode(memzone_t* zone, uintptr_t vaddr)
 {
+    if (!TEST_FLAG(zone->mmu_flags, MMU_FLAG_PERM_WRITE) || !vmm_is_page_dirty(vaddr)) {
+        return SWAP_DROP;
+    }
     return SWAP_TO_DEV;
 }
 
@@ -10,6 +10,7 @@
 #include <libkern/bits/errno.h>
 #include <libkern/libkern.h>
 #include <mem/kmalloc.h>
+#include <tasking/pid_hash.h>
 #include <tasking/proc.h>
 #include <tasking/tasking.h>
 #include <tasking/thread.h>
@@ -41,6 +42,7 @@ int kthread_setup(proc_t* p)
 {
     p->pid = proc_alloc_pid();
     p->pgid = p->pid;
+    pid_hash_add_proc(p);
     p->uid = 0;
     p->gid = 0;
     p->euid = 0;
@@ -48,11 +50,18 @@ int kthread_setup(proc_t* p)
     p->suid = 0;
     p->sgid = 0;
     p->is_kthread = true;
+    p->sched_class = SCHED_DEFAULT_CLASS;
+    p->sched_policy = SCHED_OTHER;
+    p->rt_prio = 0;
+    timer_setup(&p->alarm_timer, proc_alarm_expired, p);
     /* allocating kernel stack */
     p->main_thread = proc_alloc_thread();
     p->main_thread->tid = p->pid;
+    pid_hash_add_thread(p->main_thread);
     p->main_thread->process = p;
     p->main_thread->last_cpu = LAST_CPU_NOT_SET;
+    p->main_thread->cpu_mask = SCHED_CPU_MASK_ALL;
+    blocker_setup(p->main_thread);
 
     p->main_thread->kstack = kmemzone_new(KSTACK_ZONE_SIZE);
     if (!p->main_thread->kstack.start) {
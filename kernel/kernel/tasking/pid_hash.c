@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <libkern/lock.h>
+#include <tasking/pid_hash.h>
+#include <tasking/proc.h>
+#include <tasking/thread.h>
+
+static spinlock_t _pid_hash_procs_lock;
+static proc_t* _pid_hash_procs[PID_HASH_BUCKETS];
+static spinlock_t _pid_hash_threads_lock;
+static thread_t* _pid_hash_threads[PID_HASH_BUCKETS];
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static inline size_t _pid_hash_bucket(pid_t pid)
+{
+    return (uint32_t)pid & (PID_HASH_BUCKETS - 1);
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+void pid_hash_add_proc(proc_t* p)
+{
+    spinlock_acquire(&_pid_hash_procs_lock);
+    proc_t** bucket = &_pid_hash_procs[_pid_hash_bucket(p->pid)];
+    p->pid_hash_next = *bucket;
+    *bucket = p;
+    spinlock_release(&_pid_hash_procs_lock);
+}
+
+void pid_hash_remove_proc(proc_t* p)
+{
+    spinlock_acquire(&_pid_hash_procs_lock);
+    proc_t** link = &_pid_hash_procs[_pid_hash_bucket(p->pid)];
+    while (*link && *link != p) {
+        link = &(*link)->pid_hash_next;
+    }
+    if (*link) {
+        *link = p->pid_hash_next;
+    }
+    p->pid_hash_next = NULL;
+    spinlock_release(&_pid_hash_procs_lock);
+}
+
+proc_t* pid_hash_find_proc(pid_t pid)
+{
+    spinlock_acquire(&_pid_hash_procs_lock);
+    proc_t* p = _pid_hash_procs[_pid_hash_bucket(pid)];
+    while (p && p->pid != pid) {
+        p = p->pid_hash_next;
+    }
+    spinlock_release(&_pid_hash_procs_lock);
+    return p;
+}
+
+void pid_hash_add_thread(thread_t* thread)
+{
+    spinlock_acquire(&_pid_hash_threads_lock);
+    thread_t** bucket = &_pid_hash_threads[_pid_hash_bucket(thread->tid)];
+    thread->tid_hash_next = *bucket;
+    *bucket = thread;
+    spinlock_release(&_pid_hash_threads_lock);
+}
+
+void pid_hash_remove_thread(thread_t* thread)
+{
+    spinlock_acquire(&_pid_hash_threads_lock);
+    thread_t** link = &_pid_hash_threads[_pid_hash_bucket(thread->tid)];
+    while (*link && *link != thread) {
+        link = &(*link)->tid_hash_next;
+    }
+    if (*link) {
+        *link = thread->tid_hash_next;
+    }
+    thread->tid_hash_next = NULL;
+    spinlock_release(&_pid_hash_threads_lock);
+}
+
+thread_t* pid_hash_find_thread(pid_t tid)
+{
+    spinlock_acquire(&_pid_hash_threads_lock);
+    thread_t* thread = _pid_hash_threads[_pid_hash_bucket(tid)];
+    while (thread && thread->tid != tid) {
+        thread = thread->tid_hash_next;
+    }
+    spinlock_release(&_pid_hash_threads_lock);
+    return thread;
+}
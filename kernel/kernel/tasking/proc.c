@@ -15,6 +15,7 @@
 #include <libkern/syscall_structs.h>
 #include <mem/kmalloc.h>
 #include <tasking/elf.h>
+#include <tasking/pid_hash.h>
 #include <tasking/proc.h>
 #include <tasking/sched.h>
 #include <tasking/tasking.h>
@@ -48,6 +49,9 @@ static thread_list_node_t* proc_alloc_thread_storage_node()
 {
     thread_list_node_t* res = (thread_list_node_t*)kmalloc(sizeof(thread_list_node_t));
     memset(res->thread_storage, 0, sizeof(res->thread_storage));
+    for (int i = 0; i < THREADS_PER_NODE; i++) {
+        wait_queue_init(&res->thread_storage[i].join_wait_queue);
+    }
     res->empty_spots = THREADS_PER_NODE;
     res->next = NULL;
     return res;
@@ -95,17 +99,17 @@ thread_t* proc_alloc_thread()
 
 thread_t* thread_by_pid(pid_t pid)
 {
-    thread_list_node_t* __thread_list_node = thread_list.head;
-    while (__thread_list_node) {
-        for (int i = 0; i < THREADS_PER_NODE; i++) {
-            if (__thread_list_node->thread_storage[i].process->pid == pid) {
-                return &__thread_list_node->thread_storage[i];
-            }
-        }
-        __thread_list_node = __thread_list_node->next;
+    proc_t* p = pid_hash_find_proc(pid);
+    if (!p) {
+        return NULL;
     }
 
-    return NULL;
+    // The slot of the main thread could be already reused by another process.
+    thread_t* thread = p->main_thread;
+    if (!thread || thread_is_freed(thread) || thread->process != p) {
+        return NULL;
+    }
+    return thread;
 }
 
 pid_t proc_alloc_pid()
@@ -132,6 +136,7 @@ static int proc_setup_locked(proc_t* p)
 {
     p->pid = proc_alloc_pid();
     p->pgid = p->pid;
+    pid_hash_add_proc(p);
     p->ppid = 0;
     p->uid = 0;
     p->gid = 0;
@@ -140,6 +145,7 @@ static int proc_setup_locked(proc_t* p)
     p->suid = 0;
     p->sgid = 0;
     p->is_kthread = false;
+    p->vfork_parent = NULL;
 
     p->main_thread = proc_alloc_thread();
     int res = thread_setup_main(p, p->main_thread);
@@ -160,6 +166,10 @@ static int proc_setup_locked(proc_t* p)
 
     p->status = PROC_ALIVE;
     p->prio = DEFAULT_PRIO;
+    p->sched_class = SCHED_DEFAULT_CLASS;
+    p->sched_policy = SCHED_OTHER;
+    p->rt_prio = 0;
+    timer_setup(&p->alarm_timer, proc_alarm_expired, p);
     return 0;
 }
 
@@ -221,11 +231,9 @@ int proc_setup_vconsole(proc_t* p, vconsole_entry_t* vconsole)
     return res;
 }
 
-int proc_fork_from(proc_t* new_proc, thread_t* from_thread)
+static int proc_inherit_from(proc_t* new_proc, thread_t* from_thread)
 {
     proc_t* from_proc = from_thread->process;
-    new_proc->address_space = vmm_new_forked_address_space();
-
     thread_copy_of(new_proc->main_thread, from_thread);
 
     new_proc->ppid = from_proc->pid;
@@ -251,6 +259,27 @@ int proc_fork_from(proc_t* new_proc, thread_t* from_thread)
     return 0;
 }
 
+int proc_fork_from(proc_t* new_proc, thread_t* from_thread)
+{
+    new_proc->address_space = vmm_new_forked_address_space();
+    return proc_inherit_from(new_proc, from_thread);
+}
+
+/**
+ * The new process runs in the address space of from_thread until it calls
+ * exec or exits, from_thread should not return to userspace till then.
+ */
+int proc_vfork_from(proc_t* new_proc, thread_t* from_thread)
+{
+    vm_address_space_t* address_space = from_thread->process->address_space;
+    atomic_add(&address_space->count, 1);
+    new_proc->address_space = address_space;
+
+    new_proc->vfork_parent = from_thread;
+    from_thread->vfork_waiting = true;
+    return proc_inherit_from(new_proc, from_thread);
+}
+
 /**
  * LOAD FUNCTIONS
  */
@@ -285,7 +314,11 @@ static int proc_load_locked(proc_t* p, thread_t* main_thread, const char* path)
 success:
     // Clearing proc
     proc_kill_all_threads_except_locked(p, p->main_thread);
-    p->pid = p->main_thread->tid;
+    if (p->pid != p->main_thread->tid) {
+        pid_hash_remove_proc(p);
+        p->pid = p->main_thread->tid;
+        pid_hash_add_proc(p);
+    }
     if (p->proc_file) {
         file_put(p->proc_file);
     }
@@ -383,8 +416,10 @@ int proc_free(proc_t* p)
 int proc_die(proc_t* p, int exit_code)
 {
     spinlock_acquire(&p->lock);
+    bool was_dying = (p->status == PROC_DYING);
     p->exit_code = exit_code;
     p->status = PROC_DYING;
+    timer_cancel(&p->alarm_timer);
     foreach_thread(p)
     {
         thread_die(thread);
@@ -392,9 +427,32 @@ int proc_die(proc_t* p, int exit_code)
 
     tasking_evict_zombies_waiting_for(p);
     spinlock_release(&p->lock);
+    tasking_vfork_release(p);
+
+    // Resources are freed by the reaper, the process is queued only once.
+    if (!was_dying) {
+        tasking_queue_dying(p);
+    }
     return 0;
 }
 
+// Delivers SIGALRM, called by the timer wheel from the timer interrupt.
+void proc_alarm_expired(timer_t* timer)
+{
+    proc_t* p = (proc_t*)timer->data;
+    thread_t* thread = p->main_thread;
+    if (p->status != PROC_ALIVE || !thread || thread->status == THREAD_STATUS_INVALID || thread->status == THREAD_STATUS_DYING) {
+        return;
+    }
+
+    // The signal is dispatched once the thread is scheduled, a blocked
+    // thread is interrupted the same way as by signal_send().
+    signal_send(thread, SIGALRM);
+    if (thread->status == THREAD_STATUS_BLOCKED && thread->blocker.should_unblock_for_signal) {
+        sched_enqueue(thread);
+    }
+}
+
 int proc_block_all_threads(proc_t* p, const blocker_t* blocker)
 {
     spinlock_acquire(&p->lock);
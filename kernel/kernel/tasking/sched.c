@@ -7,9 +7,12 @@
  */
 
 #include <algo/dynamic_array.h>
+#include <drivers/irq/irq_api.h>
 #include <libkern/atomic.h>
+#include <libkern/bits/errno.h>
 #include <libkern/libkern.h>
 #include <libkern/log.h>
+#include <libkern/platform.h>
 #include <mem/kmalloc.h>
 #include <platform/generic/registers.h>
 #include <platform/generic/system.h>
@@ -18,12 +21,33 @@
 #include <tasking/cpu.h>
 #include <tasking/sched.h>
 #include <tasking/tasking.h>
+#include <time/clockevent.h>
 #include <time/time_manager.h>
 
 // #define SCHED_DEBUG
 // #define SCHED_SHOW_STAT
 
+#define IDLE_PRIO_MASK (1 << IDLE_PRIO)
+// Threads which ran recently are likely to have their data in the cache
+// of the cpu, so the balancer prefers to leave them where they are.
+#define SCHED_CACHE_HOT_TICKS 5
+#define SCHED_MAX_THREADS_TO_STEAL 4
+
+// Virtual runtime is measured in 1/1024 of a tick spent by a DEFAULT_PRIO thread.
+#define SCHED_FAIR_VRUNTIME_PER_TICK 1024
+#define SCHED_FAIR_DEFAULT_WEIGHT 1024
+// All runnable fair threads of a cpu should run once during the period.
+#define SCHED_FAIR_PERIOD_TICKS 6
+// Woken up threads are put a bit ahead of the ones which have been running,
+// so interactive threads get the cpu sooner than cpu hogs.
+#define SCHED_FAIR_WAKEUP_CREDIT (SCHED_FAIR_PERIOD_TICKS / 2 * SCHED_FAIR_VRUNTIME_PER_TICK)
+
+#define SCHED_RT_RR_TIMESLICE 10
+// SCHED_FIFO threads run until they block, yield or get preempted.
+#define SCHED_RT_FIFO_TIMESLICE 0x7fffffff
+
 static time_t _sched_timeslices[];
+static uint32_t _sched_fair_weights[];
 static int _enqueued_tasks;
 static size_t _active_cpus;
 
@@ -35,8 +59,12 @@ static void _init_cpu(cpu_t* cpu);
 /* BUFFERS */
 static inline void _sched_swap_buffers();
 static inline thread_t* _master_buf_back();
-static inline void _sched_save_running_proc();
+static inline void _sched_save_running_proc(bool yield);
+static inline bool _sched_is_idle(sched_data_t* sched);
 static inline void _sched_enqueue_impl(sched_data_t* sched, thread_t* thread);
+static inline void _sched_unlink(sched_data_t* sched, thread_t* thread);
+/* BALANCING */
+static void _sched_balance(cpu_t* cpu, bool idle);
 /* DEBUG */
 static void _debug_print_runqueue(runqueue_t* it);
 
@@ -51,12 +79,49 @@ static void _debug_print_runqueue(runqueue_t* it);
 static void _idle_thread()
 {
     while (1) {
-        system_stop_until_interrupt();
+        // The tick is stopped while there is nothing to run. A thread woken up
+        // before the cpu is halted restarts it (see _sched_kick_cpu).
+        system_disable_interrupts();
+        bool idle = _sched_is_idle(&THIS_CPU->sched);
+        system_enable_interrupts();
+        if (idle) {
+            clockevent_idle_enter();
+            system_stop_until_interrupt();
+            clockevent_idle_exit();
+        }
+
+        if (!_sched_is_idle(&THIS_CPU->sched)) {
+            resched();
+        }
     }
 }
 
+/**
+ * A thread runs in the rt class when its process has an rt policy or when
+ * it inherited an rt prio from a thread waiting for it.
+ */
+static inline int _sched_rt_prio(thread_t* thread)
+{
+    int rt_prio = thread->process->sched_class == SCHED_CLASS_RT ? thread->process->rt_prio : 0;
+    return max(rt_prio, thread->inherited_rt_prio);
+}
+
+static inline int _sched_class(thread_t* thread)
+{
+    if (_sched_rt_prio(thread)) {
+        return SCHED_CLASS_RT;
+    }
+    return thread->process->sched_class;
+}
+
 static inline time_t _sched_get_timeslice(thread_t* thread)
 {
+    if (_sched_rt_prio(thread)) {
+        return thread->process->sched_policy == SCHED_FIFO ? SCHED_RT_FIFO_TIMESLICE : SCHED_RT_RR_TIMESLICE;
+    }
+    if (thread->process->sched_class == SCHED_CLASS_FAIR) {
+        return max(SCHED_FAIR_PERIOD_TICKS / (THIS_CPU->sched.fair_enqueued_tasks + 1), 1);
+    }
     return _sched_timeslices[thread->process->prio];
 }
 
@@ -65,6 +130,8 @@ static void _create_idle_thread(cpu_t* cpu)
     proc_t* idle_proc = tasking_create_kernel_thread(_idle_thread, NULL);
     cpu->idle_thread = idle_proc->main_thread;
     idle_proc->prio = IDLE_PRIO;
+    idle_proc->sched_class = SCHED_CLASS_PRIO;
+    idle_proc->main_thread->cpu_mask = (1u << cpu->id);
     _sched_enqueue_impl(&cpu->sched, idle_proc->main_thread);
 }
 
@@ -92,12 +159,19 @@ static void _init_cpu(cpu_t* cpu)
     context_set_instruction_pointer(cpu->sched_context, (uintptr_t)sched);
     cpu->running_thread = NULL;
 
+    spinlock_init(&cpu->sched.lock);
     cpu->sched.master_buf = kmalloc(sizeof(runqueue_t) * TOTAL_PRIOS_COUNT);
     cpu->sched.slave_buf = kmalloc(sizeof(runqueue_t) * TOTAL_PRIOS_COUNT);
     memset(cpu->sched.master_buf, 0, sizeof(runqueue_t) * TOTAL_PRIOS_COUNT);
     memset(cpu->sched.slave_buf, 0, sizeof(runqueue_t) * TOTAL_PRIOS_COUNT);
-    cpu->sched.next_read_prio = 0;
+    cpu->sched.master_buf_prios = 0;
+    cpu->sched.slave_buf_prios = 0;
     cpu->sched.enqueued_tasks = 0;
+    rb_tree_init(&cpu->sched.fair_tree);
+    cpu->sched.fair_min_vruntime = 0;
+    cpu->sched.fair_enqueued_tasks = 0;
+    memset(cpu->sched.rt_queues, 0, sizeof(cpu->sched.rt_queues));
+    cpu->sched.rt_prios = 0;
 
 #ifdef FPU_ENABLED
     cpu->fpu_for_thread = NULL;
@@ -112,119 +186,549 @@ static inline void _sched_swap_buffers(sched_data_t* sched)
     runqueue_t* tmp = sched->master_buf;
     sched->master_buf = sched->slave_buf;
     sched->slave_buf = tmp;
-    sched->next_read_prio = 0;
+
+    uint32_t tmp_prios = sched->master_buf_prios;
+    sched->master_buf_prios = sched->slave_buf_prios;
+    sched->slave_buf_prios = tmp_prios;
+}
+
+// Rt threads are put into rt queues, others into the slave buffer.
+static inline runqueue_t* _sched_target_runqueue(sched_data_t* sched, thread_t* thread, uint32_t** prios, int* bit)
+{
+    int rt_prio = _sched_rt_prio(thread);
+    if (rt_prio) {
+        *bit = SCHED_RT_PRIO_MAX - rt_prio;
+        *prios = &sched->rt_prios;
+        return &sched->rt_queues[*bit];
+    }
+
+    *bit = thread->process->prio;
+    *prios = &sched->slave_buf_prios;
+    return &sched->slave_buf[*bit];
+}
+
+// Finds the mask which tracks the runqueue the thread is linked into.
+static inline uint32_t* _sched_linked_runqueue_prios(sched_data_t* sched, runqueue_t* runqueue, int* bit)
+{
+    if (sched->rt_queues <= runqueue && runqueue < sched->rt_queues + SCHED_RT_PRIOS_COUNT) {
+        *bit = runqueue - sched->rt_queues;
+        return &sched->rt_prios;
+    }
+    if (sched->master_buf <= runqueue && runqueue < sched->master_buf + TOTAL_PRIOS_COUNT) {
+        *bit = runqueue - sched->master_buf;
+        return &sched->master_buf_prios;
+    }
+    *bit = runqueue - sched->slave_buf;
+    return &sched->slave_buf_prios;
 }
 
 static inline void _sched_add_to_start_of_runqueue(sched_data_t* sched, thread_t* thread)
 {
-    thread->sched_next = sched->slave_buf[thread->process->prio].head;
+    int bit;
+    uint32_t* prios;
+    runqueue_t* runqueue = _sched_target_runqueue(sched, thread, &prios, &bit);
+
+    thread->sched_prev = NULL;
+    thread->sched_next = runqueue->head;
     if (thread->sched_next) {
         thread->sched_next->sched_prev = thread;
     } else {
-        sched->slave_buf[thread->process->prio].tail = thread;
+        runqueue->tail = thread;
     }
-    sched->slave_buf[thread->process->prio].head = thread;
+    runqueue->head = thread;
+    thread->runqueue = runqueue;
+    *prios |= (1u << bit);
 }
 
 static inline void _sched_add_to_end_of_runqueue(sched_data_t* sched, thread_t* thread)
 {
-    thread->sched_prev = sched->slave_buf[thread->process->prio].tail;
+    int bit;
+    uint32_t* prios;
+    runqueue_t* runqueue = _sched_target_runqueue(sched, thread, &prios, &bit);
+
+    thread->sched_next = NULL;
+    thread->sched_prev = runqueue->tail;
     if (thread->sched_prev) {
         thread->sched_prev->sched_next = thread;
     } else {
-        sched->slave_buf[thread->process->prio].head = thread;
+        runqueue->head = thread;
     }
-    sched->slave_buf[thread->process->prio].tail = thread;
+    runqueue->tail = thread;
+    thread->runqueue = runqueue;
+    *prios |= (1u << bit);
 }
 
-static inline void _sched_enqueue_impl(sched_data_t* sched, thread_t* thread)
+/**
+ * FAIR CLASS
+ */
+
+static bool _sched_fair_less(rb_node_t* a, rb_node_t* b)
 {
-    _sched_add_to_start_of_runqueue(sched, thread);
-    sched->enqueued_tasks++;
+    return rb_entry(a, thread_t, fair_node)->vruntime < rb_entry(b, thread_t, fair_node)->vruntime;
 }
 
-void _sched_dequeue_impl(sched_data_t* sched, thread_t* thread)
+static inline void _sched_fair_add(sched_data_t* sched, thread_t* thread)
 {
-    if (sched->slave_buf[thread->process->prio].tail == thread) {
-        sched->slave_buf[thread->process->prio].tail = thread->sched_prev;
-    }
+    rb_insert(&sched->fair_tree, &thread->fair_node, _sched_fair_less);
+    thread->in_fair_tree = true;
+    sched->fair_enqueued_tasks++;
+}
 
-    if (sched->slave_buf[thread->process->prio].head == thread) {
-        sched->slave_buf[thread->process->prio].head = thread->sched_next;
-    }
+static inline void _sched_fair_remove(sched_data_t* sched, thread_t* thread)
+{
+    rb_erase(&sched->fair_tree, &thread->fair_node);
+    thread->in_fair_tree = false;
+    sched->fair_enqueued_tasks--;
+}
 
-    if (sched->master_buf[thread->process->prio].tail == thread) {
-        sched->master_buf[thread->process->prio].tail = thread->sched_prev;
+static inline void _sched_fair_place(sched_data_t* sched, thread_t* thread, bool is_new)
+{
+    // New threads start from the current minimum, otherwise a fork-heavy
+    // workload would get the wakeup credit for every child.
+    if (is_new) {
+        thread->vruntime = sched->fair_min_vruntime;
+    } else if (thread->vruntime + SCHED_FAIR_WAKEUP_CREDIT < sched->fair_min_vruntime) {
+        thread->vruntime = sched->fair_min_vruntime - SCHED_FAIR_WAKEUP_CREDIT;
     }
+}
+
+static inline void _sched_fair_account(thread_t* thread, time_t ran_ticks)
+{
+    // The math is kept in 32 bits, since 64-bit division is not available
+    // on all targets.
+    uint32_t ticks = min(ran_ticks, 1024);
+    thread->vruntime += ticks * SCHED_FAIR_VRUNTIME_PER_TICK * SCHED_FAIR_DEFAULT_WEIGHT / _sched_fair_weights[thread->process->prio];
+}
+
+/**
+ * RUNQUEUES
+ */
+
+static inline bool _sched_is_linked(thread_t* thread)
+{
+    return thread->runqueue || thread->in_fair_tree;
+}
 
-    if (sched->master_buf[thread->process->prio].head == thread) {
-        sched->master_buf[thread->process->prio].head = thread->sched_next;
+static inline void _sched_unlink(sched_data_t* sched, thread_t* thread)
+{
+    if (thread->in_fair_tree) {
+        _sched_fair_remove(sched, thread);
+        sched->enqueued_tasks--;
+        return;
     }
 
+    runqueue_t* runqueue = thread->runqueue;
     if (thread->sched_prev) {
         thread->sched_prev->sched_next = thread->sched_next;
+    } else {
+        runqueue->head = thread->sched_next;
     }
 
     if (thread->sched_next) {
         thread->sched_next->sched_prev = thread->sched_prev;
+    } else {
+        runqueue->tail = thread->sched_prev;
+    }
+
+    if (!runqueue->head) {
+        int bit;
+        uint32_t* prios = _sched_linked_runqueue_prios(sched, runqueue, &bit);
+        *prios &= ~(1u << bit);
     }
 
     thread->sched_next = thread->sched_prev = NULL;
+    thread->runqueue = NULL;
     sched->enqueued_tasks--;
 }
 
-int _sched_find_cpu_with_less_load()
+// The following functions should be called with sched->lock held.
+// A thread could be woken up while it is still running (e.g. before
+// it reaches resched()), so a thread which is linked already is skipped.
+static inline void _sched_enqueue_impl(sched_data_t* sched, thread_t* thread)
+{
+    if (_sched_is_linked(thread)) {
+        return;
+    }
+
+    if (_sched_class(thread) == SCHED_CLASS_FAIR) {
+        _sched_fair_add(sched, thread);
+    } else {
+        _sched_add_to_start_of_runqueue(sched, thread);
+    }
+    sched->enqueued_tasks++;
+}
+
+static inline void _sched_requeue_impl(sched_data_t* sched, thread_t* thread)
 {
-    int mx = cpus[0].sched.enqueued_tasks;
-    int id = 0;
-    for (int i = 1; i < active_cpu_count(); i++) {
-        if (mx > cpus[i].sched.enqueued_tasks) {
+    if (_sched_is_linked(thread)) {
+        return;
+    }
+
+    if (_sched_class(thread) == SCHED_CLASS_FAIR) {
+        _sched_fair_add(sched, thread);
+    } else {
+        _sched_add_to_end_of_runqueue(sched, thread);
+    }
+    sched->enqueued_tasks++;
+}
+
+static inline void _sched_dequeue_impl(sched_data_t* sched, thread_t* thread)
+{
+    if (_sched_is_linked(thread)) {
+        _sched_unlink(sched, thread);
+    }
+}
+
+/**
+ * Locks the runqueues of the cpu the thread belongs to. The balancer could
+ * move the thread to another cpu while we wait for the lock, so last_cpu
+ * is checked again once the lock is held.
+ */
+static sched_data_t* _sched_lock_thread_cpu(thread_t* thread)
+{
+    for (;;) {
+        int cpu = thread->last_cpu;
+        sched_data_t* sched = &cpus[cpu].sched;
+        spinlock_acquire(&sched->lock);
+        if (likely(thread->last_cpu == cpu)) {
+            return sched;
+        }
+        spinlock_release(&sched->lock);
+    }
+}
+
+static inline void _sched_save_running_proc(bool yield)
+{
+    thread_t* thread = RUNNING_THREAD;
+    time_t ran_ticks = timeman_ticks_since_boot() - thread->start_time_in_ticks;
+    thread->stat_total_running_ticks += ran_ticks;
+
+    system_disable_interrupts();
+    sched_data_t* sched = _sched_lock_thread_cpu(thread);
+    int class = _sched_class(thread);
+    if (class == SCHED_CLASS_FAIR) {
+        // The thread could be woken up and linked while it was running,
+        // its key in the tree is about to change.
+        if (thread->in_fair_tree) {
+            _sched_unlink(sched, thread);
+        }
+        _sched_fair_account(thread, ran_ticks);
+    }
+
+    // Add the thread back to runqueue only if thread is still running.
+    // A preempted rt thread keeps its place in the queue, while the one
+    // which used up its timeslice or yielded goes to the end.
+    if (thread->status == THREAD_STATUS_RUNNING) {
+        if (class == SCHED_CLASS_RT && !yield && thread->ticks_until_preemption) {
+            _sched_enqueue_impl(sched, thread);
+        } else {
+            _sched_requeue_impl(sched, thread);
+        }
+    }
+    spinlock_release(&sched->lock);
+    system_enable_interrupts();
+}
+
+static inline bool _sched_cpu_allowed(thread_t* thread, int cpu)
+{
+    return (thread->cpu_mask >> cpu) & 1;
+}
+
+static inline uint32_t _sched_active_cpus_mask()
+{
+    return (1u << active_cpu_count()) - 1;
+}
+
+int _sched_find_cpu_with_less_load(uint32_t mask)
+{
+    int mx = 0;
+    int id = -1;
+    for (int i = 0; i < active_cpu_count(); i++) {
+        if (!((mask >> i) & 1)) {
+            continue;
+        }
+        if (id < 0 || mx > cpus[i].sched.enqueued_tasks) {
             mx = cpus[i].sched.enqueued_tasks;
             id = i;
         }
     }
-    return id;
+
+    // The mask could name only cpus which are not up yet.
+    return id < 0 ? 0 : id;
 }
 
-void scheduler_init()
+/**
+ * LOAD BALANCING
+ */
+
+static inline bool _sched_is_idle(sched_data_t* sched)
 {
+    return !sched->rt_prios && rb_empty(&sched->fair_tree) && (sched->master_buf_prios | sched->slave_buf_prios) == IDLE_PRIO_MASK;
 }
 
-void schedule_activate_cpu()
+static cpu_t* _sched_find_busiest_cpu(cpu_t* cpu)
 {
-    int id = system_cpu_id();
-    ASSERT(id < MAX_CPU_CNT);
-    _init_cpu(&cpus[id]);
-    cpus[id].id = id;
+    cpu_t* busiest = NULL;
+    int max_load = cpu->sched.enqueued_tasks;
+    for (int i = 0; i < active_cpu_count(); i++) {
+        if (cpus[i].sched.enqueued_tasks > max_load) {
+            max_load = cpus[i].sched.enqueued_tasks;
+            busiest = &cpus[i];
+        }
+    }
+    return busiest;
 }
 
-extern thread_list_t thread_list;
-static void sched_unblock_threads()
+static inline bool _sched_can_steal(cpu_t* victim, cpu_t* cpu, thread_t* thread, bool take_cache_hot)
 {
-    thread_t* thread;
+    // The running thread could be linked before its context is saved
+    // (see _sched_enqueue_impl), idle threads are bound to their cpus.
+    if (thread == victim->running_thread || thread == victim->idle_thread) {
+        return false;
+    }
+    if (!_sched_cpu_allowed(thread, cpu->id)) {
+        return false;
+    }
+    return take_cache_hot || timeman_ticks_since_boot() - thread->start_time_in_ticks > SCHED_CACHE_HOT_TICKS;
+}
+
+static thread_t* _sched_pick_thread_to_steal(cpu_t* victim, cpu_t* cpu, bool take_cache_hot)
+{
+    for (int i = 0; i < SCHED_RT_PRIOS_COUNT; i++) {
+        for (thread_t* thread = victim->sched.rt_queues[i].tail; thread; thread = thread->sched_prev) {
+            if (_sched_can_steal(victim, cpu, thread, take_cache_hot)) {
+                return thread;
+            }
+        }
+    }
 
-    thread_list_node_t* __thread_list_node = thread_list.head;
-    while (__thread_list_node) {
-        for (int i = 0; i < THREADS_PER_NODE; i++) {
-            thread = &__thread_list_node->thread_storage[i];
-            if (thread->status == THREAD_STATUS_BLOCKED && thread->blocker.reason != BLOCKER_INVALID) {
-                if (thread->blocker.should_unblock && thread->blocker.should_unblock(thread)) {
-                    thread->status = THREAD_STATUS_RUNNING;
-                    thread->blocker.reason = BLOCKER_INVALID;
-                    sched_enqueue(thread);
+    for (rb_node_t* node = rb_first(&victim->sched.fair_tree); node; node = rb_next(node)) {
+        thread_t* thread = rb_entry(node, thread_t, fair_node);
+        if (_sched_can_steal(victim, cpu, thread, take_cache_hot)) {
+            return thread;
+        }
+    }
+
+    // Threads at the tails of the master buffer are the ones
+    // which would wait the longest on the victim.
+    runqueue_t* bufs[] = { victim->sched.master_buf, victim->sched.slave_buf };
+    for (int i = 0; i < 2; i++) {
+        for (int prio = MAX_PRIO; prio <= MIN_PRIO; prio++) {
+            for (thread_t* thread = bufs[i][prio].tail; thread; thread = thread->sched_prev) {
+                if (_sched_can_steal(victim, cpu, thread, take_cache_hot)) {
+                    return thread;
                 }
             }
         }
-        __thread_list_node = __thread_list_node->next;
+    }
+    return NULL;
+}
+
+// Both runqueues should be locked.
+static void _sched_move_thread(cpu_t* from, cpu_t* to, thread_t* thread)
+{
+    _sched_unlink(&from->sched, thread);
+    if (_sched_class(thread) == SCHED_CLASS_FAIR) {
+        // Keep the lag of the thread relative to the minimum of its cpu.
+        int64_t lag = (int64_t)(thread->vruntime - from->sched.fair_min_vruntime);
+        if (lag < 0 && (uint64_t)(-lag) > to->sched.fair_min_vruntime) {
+            thread->vruntime = 0;
+        } else {
+            thread->vruntime = to->sched.fair_min_vruntime + lag;
+        }
+    }
+    thread->last_cpu = to->id;
+    _sched_enqueue_impl(&to->sched, thread);
+}
+
+static inline void _sched_lock_pair(cpu_t* a, cpu_t* b)
+{
+    // Locks are taken in the order of cpu ids to avoid deadlocks.
+    if (a->id > b->id) {
+        cpu_t* tmp = a;
+        a = b;
+        b = tmp;
+    }
+    spinlock_acquire(&a->sched.lock);
+    if (a != b) {
+        spinlock_acquire(&b->sched.lock);
+    }
+}
+
+static inline void _sched_unlock_pair(cpu_t* a, cpu_t* b)
+{
+    spinlock_release(&a->sched.lock);
+    if (a != b) {
+        spinlock_release(&b->sched.lock);
+    }
+}
+
+/**
+ * Pulls threads from the busiest cpu to the given one. It's called on every
+ * buffers swap and when the cpu has nothing but the idle thread to run.
+ */
+static void _sched_balance(cpu_t* cpu, bool idle)
+{
+    if (active_cpu_count() < 2) {
+        return;
+    }
+
+    cpu_t* victim = _sched_find_busiest_cpu(cpu);
+    if (!victim) {
+        return;
+    }
+
+    int to_steal = (victim->sched.enqueued_tasks - cpu->sched.enqueued_tasks) / 2;
+    if (idle) {
+        to_steal = max(to_steal, 1);
+    }
+    to_steal = min(to_steal, SCHED_MAX_THREADS_TO_STEAL);
+    if (!to_steal) {
+        return;
+    }
+
+    _sched_lock_pair(cpu, victim);
+    for (int i = 0; i < to_steal; i++) {
+        // An idle cpu is better off running a cache hot thread than nothing.
+        thread_t* thread = _sched_pick_thread_to_steal(victim, cpu, false);
+        if (!thread && idle) {
+            thread = _sched_pick_thread_to_steal(victim, cpu, true);
+        }
+        if (!thread) {
+            break;
+        }
+
+        _sched_move_thread(victim, cpu, thread);
+#ifdef SCHED_DEBUG
+        log("steal task %d from cpu %d to cpu %d", thread->tid, victim->id, cpu->id);
+#endif
+    }
+    _sched_unlock_pair(cpu, victim);
+}
+
+/**
+ * PREEMPTION
+ */
+
+static bool _sched_should_preempt(cpu_t* cpu, thread_t* thread)
+{
+    thread_t* running = cpu->running_thread;
+    if (!running || running == cpu->idle_thread) {
+        return true;
+    }
+
+    int class = _sched_class(thread);
+    int running_class = _sched_class(running);
+    if (class != running_class) {
+        return class < running_class;
+    }
+
+    switch (class) {
+    case SCHED_CLASS_RT:
+        return _sched_rt_prio(thread) > _sched_rt_prio(running);
+    case SCHED_CLASS_FAIR:
+        return thread->vruntime < running->vruntime;
+    default:
+        return false;
+    }
+}
+
+static inline bool _sched_in_sched_context()
+{
+    uintptr_t sp = (uintptr_t)&sp;
+    kmemzone_t* zone = &THIS_CPU->sched_stack_zone;
+    return zone->start <= sp && sp < zone->start + zone->len;
+}
+
+static void _sched_resched_ipi_handler()
+{
+    // A more important thread was put into our runqueue. The interrupt could
+    // come while sched() is picking the next thread, the running thread is
+    // not set up yet, so the choice is left to sched().
+    if (RUNNING_THREAD && !_sched_in_sched_context()) {
+        resched();
+    }
+}
+
+// Called when the thread is linked into the cpu's runqueue.
+static void _sched_kick_cpu(int cpu, thread_t* thread)
+{
+    // Rt threads preempt others right away, the rest waits for the next
+    // tick on this cpu. Idle cpus sleep until an interrupt, so they are kicked too.
+    if (thread != cpus[cpu].running_thread && _sched_should_preempt(&cpus[cpu], thread)) {
+        if (cpu == system_cpu_id() && RUNNING_THREAD) {
+            RUNNING_THREAD->ticks_until_preemption = min(RUNNING_THREAD->ticks_until_preemption, 1);
+            if (RUNNING_THREAD == THIS_CPU->idle_thread) {
+                clockevent_idle_exit();
+            }
+        }
+        if (cpu != system_cpu_id() || _sched_class(thread) == SCHED_CLASS_RT) {
+            irq_send_ipi(IPI_RESCHED, 1 << cpu);
+        }
     }
 }
 
+/**
+ * Moves the thread to a cpu from its mask. The running thread is left in
+ * place, since its context is not saved yet; it's moved by sched() once it
+ * is picked again on the wrong cpu. sched() passes is_saved, because the
+ * running thread of its cpu is the previous one. Interrupts should be disabled.
+ */
+static void _sched_migrate(thread_t* thread, bool is_saved)
+{
+    for (;;) {
+        int from = thread->last_cpu;
+        if (from == LAST_CPU_NOT_SET || _sched_cpu_allowed(thread, from)) {
+            return;
+        }
+
+        int to = _sched_find_cpu_with_less_load(thread->cpu_mask);
+        _sched_lock_pair(&cpus[from], &cpus[to]);
+        if (unlikely(thread->last_cpu != from)) {
+            _sched_unlock_pair(&cpus[from], &cpus[to]);
+            continue;
+        }
+
+        if (!is_saved && thread == cpus[from].running_thread) {
+            _sched_unlock_pair(&cpus[from], &cpus[to]);
+            if (from != system_cpu_id()) {
+                irq_send_ipi(IPI_RESCHED, 1 << from);
+            }
+            return;
+        }
+
+        bool linked = _sched_is_linked(thread);
+        if (linked) {
+            _sched_move_thread(&cpus[from], &cpus[to], thread);
+        } else {
+            thread->last_cpu = to;
+        }
+        _sched_unlock_pair(&cpus[from], &cpus[to]);
+        if (linked) {
+            _sched_kick_cpu(to, thread);
+        }
+        return;
+    }
+}
+
+void scheduler_init()
+{
+    irq_register_ipi_handler(IPI_RESCHED, _sched_resched_ipi_handler);
+}
+
+void schedule_activate_cpu()
+{
+    int id = system_cpu_id();
+    ASSERT(id < MAX_CPU_CNT);
+    // The id is set first, since the idle thread is pinned to the cpu in _init_cpu().
+    cpus[id].id = id;
+    _init_cpu(&cpus[id]);
+}
+
 void resched_dont_save_context()
 {
-    // Add the thread back to runqueue only if thread is still running.
-    if (RUNNING_THREAD && RUNNING_THREAD->status == THREAD_STATUS_RUNNING) {
-        RUNNING_THREAD->stat_total_running_ticks += timeman_ticks_since_boot() - RUNNING_THREAD->start_time_in_ticks;
-        _sched_add_to_end_of_runqueue(&cpus[RUNNING_THREAD->last_cpu].sched, RUNNING_THREAD);
+    if (RUNNING_THREAD) {
+        _sched_save_running_proc(false);
     }
     switch_to_context(THIS_CPU->sched_context);
 }
@@ -232,11 +736,17 @@ void resched_dont_save_context()
 void resched()
 {
     if (likely(RUNNING_THREAD)) {
-        RUNNING_THREAD->stat_total_running_ticks += timeman_ticks_since_boot() - RUNNING_THREAD->start_time_in_ticks;
-        // Add the thread back to runqueue only if thread is still running.
-        if (RUNNING_THREAD->status == THREAD_STATUS_RUNNING) {
-            _sched_add_to_end_of_runqueue(&cpus[RUNNING_THREAD->last_cpu].sched, RUNNING_THREAD);
-        }
+        _sched_save_running_proc(false);
+        switch_contexts(&RUNNING_THREAD->context, THIS_CPU->sched_context);
+    } else {
+        switch_to_context(THIS_CPU->sched_context);
+    }
+}
+
+void sched_yield()
+{
+    if (likely(RUNNING_THREAD)) {
+        _sched_save_running_proc(true);
         switch_contexts(&RUNNING_THREAD->context, THIS_CPU->sched_context);
     } else {
         switch_to_context(THIS_CPU->sched_context);
@@ -245,23 +755,115 @@ void resched()
 
 void sched_enqueue(thread_t* thread)
 {
-    thread->status = THREAD_STATUS_RUNNING;
+    // Threads could be woken up from interrupt handlers (see wait_queue.c),
+    // so runqueues are modified only with interrupts disabled.
+    system_disable_interrupts();
     if (thread->process->prio > MIN_PRIO) {
         thread->process->prio = MIN_PRIO;
     }
 
-    if (thread->last_cpu != LAST_CPU_NOT_SET) {
-        _sched_enqueue_impl(&cpus[thread->last_cpu].sched, thread);
-    } else {
-        int cpu = _sched_find_cpu_with_less_load();
-        _sched_enqueue_impl(&cpus[cpu].sched, thread);
+    sched_data_t* sched;
+    int cpu = thread->last_cpu;
+    bool is_new = (cpu == LAST_CPU_NOT_SET);
+    if (is_new) {
+        // The thread is not linked anywhere, so nobody could move it.
+        cpu = _sched_find_cpu_with_less_load(thread->cpu_mask);
+        sched = &cpus[cpu].sched;
+        spinlock_acquire(&sched->lock);
         thread->last_cpu = cpu;
+    } else {
+        sched = _sched_lock_thread_cpu(thread);
+        cpu = thread->last_cpu;
+    }
+
+    thread->status = THREAD_STATUS_RUNNING;
+    if (is_new) {
+        thread->inherited_rt_prio = 0;
+    }
+    if (_sched_class(thread) == SCHED_CLASS_FAIR && !_sched_is_linked(thread)) {
+        _sched_fair_place(sched, thread, is_new);
     }
+    _sched_enqueue_impl(sched, thread);
+    spinlock_release(&sched->lock);
 
 #ifdef SCHED_DEBUG
     log("enqueue task %d to cpu %d", thread->tid, thread->last_cpu);
 #endif
-    _enqueued_tasks++;
+    atomic_add(&_enqueued_tasks, 1);
+    _sched_kick_cpu(cpu, thread);
+    system_enable_interrupts();
+}
+
+/**
+ * Priority inheritance hook: a lock owner should run with the rt prio of the
+ * most important thread waiting for the lock. Pass 0 to drop the boost.
+ */
+void sched_set_inherited_prio(thread_t* thread, int rt_prio)
+{
+    system_disable_interrupts();
+    if (thread->last_cpu == LAST_CPU_NOT_SET) {
+        thread->inherited_rt_prio = rt_prio;
+        system_enable_interrupts();
+        return;
+    }
+
+    // The thread is relinked, since its class and runqueue could change.
+    sched_data_t* sched = _sched_lock_thread_cpu(thread);
+    bool linked = _sched_is_linked(thread);
+    if (linked) {
+        _sched_unlink(sched, thread);
+    }
+    thread->inherited_rt_prio = rt_prio;
+    if (linked) {
+        _sched_enqueue_impl(sched, thread);
+    }
+    spinlock_release(&sched->lock);
+    system_enable_interrupts();
+}
+
+int sched_setaffinity(thread_t* thread, uint32_t mask)
+{
+    mask &= _sched_active_cpus_mask();
+    if (!mask) {
+        return -EINVAL;
+    }
+
+    system_disable_interrupts();
+    thread->cpu_mask = mask;
+    _sched_migrate(thread, false);
+    system_enable_interrupts();
+
+    // The running thread has to leave the cpu to be moved.
+    if (thread == RUNNING_THREAD && !_sched_cpu_allowed(thread, system_cpu_id())) {
+        resched();
+    }
+    return 0;
+}
+
+int sched_setscheduler(proc_t* p, int policy, int rt_prio)
+{
+    switch (policy) {
+    case SCHED_OTHER:
+        if (rt_prio != 0) {
+            return -EINVAL;
+        }
+        p->sched_class = SCHED_DEFAULT_CLASS;
+        break;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        if (rt_prio < SCHED_RT_PRIO_MIN || rt_prio > SCHED_RT_PRIO_MAX) {
+            return -EINVAL;
+        }
+        p->sched_class = SCHED_CLASS_RT;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    // Threads which are already in runqueues are moved on their next enqueue.
+    p->sched_policy = policy;
+    p->rt_prio = rt_prio;
+    return 0;
 }
 
 void sched_dequeue(thread_t* thread)
@@ -269,11 +871,15 @@ void sched_dequeue(thread_t* thread)
 #ifdef SCHED_DEBUG
     log("dequeue task %d", thread->tid);
 #endif
+    system_disable_interrupts();
     if (likely(thread->last_cpu != LAST_CPU_NOT_SET)) {
-        _sched_dequeue_impl(&cpus[thread->last_cpu].sched, thread);
+        sched_data_t* sched = _sched_lock_thread_cpu(thread);
+        _sched_dequeue_impl(sched, thread);
+        spinlock_release(&sched->lock);
     } else {
         log("dequeue error task %d", thread->tid);
     }
+    system_enable_interrupts();
 }
 
 static void switch_to_thread(thread_t* thread)
@@ -303,26 +909,39 @@ void sched()
 #endif
         system_disable_interrupts();
         sched_data_t* sched = &THIS_CPU->sched;
-        while (!sched->master_buf[sched->next_read_prio].head) {
-            sched->next_read_prio++;
-            if (sched->next_read_prio >= TOTAL_PRIOS_COUNT) {
-                if (THIS_CPU->id == 0) {
-                    tasking_kill_dying();
-                    sched_unblock_threads();
-                }
+        if (!sched->master_buf_prios) {
+            _sched_balance(THIS_CPU, _sched_is_idle(sched));
+        } else if (_sched_is_idle(sched)) {
+            _sched_balance(THIS_CPU, true);
+        }
+
+        spinlock_acquire(&sched->lock);
+        thread_t* thread;
+        if (sched->rt_prios) {
+            thread = sched->rt_queues[ctz32(sched->rt_prios)].head;
+        } else if (!rb_empty(&sched->fair_tree)) {
+            thread = rb_entry(rb_first(&sched->fair_tree), thread_t, fair_node);
+            sched->fair_min_vruntime = max(sched->fair_min_vruntime, thread->vruntime);
+        } else {
+            // Do not waste a timeslice on the idle thread while others are waiting.
+            if (!sched->master_buf_prios || (sched->master_buf_prios == IDLE_PRIO_MASK && (sched->slave_buf_prios & ~IDLE_PRIO_MASK))) {
                 _sched_swap_buffers(sched);
             }
-        }
 
-        thread_t* thread = sched->master_buf[sched->next_read_prio].head;
-        sched->master_buf[sched->next_read_prio].head = thread->sched_next;
-        if (sched->master_buf[sched->next_read_prio].tail == thread) {
-            sched->master_buf[sched->next_read_prio].tail = NULL;
+            // The idle thread is always runnable, so there is at least one thread.
+            ASSERT(sched->master_buf_prios);
+            thread = sched->master_buf[ctz32(sched->master_buf_prios)].head;
         }
-        if (thread->sched_next) {
-            thread->sched_next->sched_prev = NULL;
+
+        // The affinity of the thread was changed while it was here.
+        if (unlikely(!_sched_cpu_allowed(thread, THIS_CPU->id))) {
+            spinlock_release(&sched->lock);
+            _sched_migrate(thread, true);
+            system_enable_interrupts();
+            continue;
         }
-        thread->sched_next = thread->sched_prev = NULL;
+        _sched_unlink(sched, thread);
+        spinlock_release(&sched->lock);
 #ifdef SCHED_DEBUG
         log("next to run %d %zx %zx [cpu %d]", thread->tid, thread->process->prio, thread->tf, THIS_CPU->id);
 #endif
@@ -331,6 +950,10 @@ void sched()
 #endif
         ASSERT(thread->status == THREAD_STATUS_RUNNING);
         system_enable_interrupts();
+        // The tick could be stopped by the idle thread.
+        if (thread != THIS_CPU->idle_thread) {
+            clockevent_idle_exit();
+        }
         switch_to_thread(thread);
     }
 }
@@ -361,4 +984,20 @@ static time_t _sched_timeslices[] = {
     [10] = 2,
     [11] = 1,
     [12] = 1,
+};
+
+// Weights follow the nice levels, each prio step changes the cpu share by ~25%.
+static uint32_t _sched_fair_weights[] = {
+    [0] = 3906,
+    [1] = 3121,
+    [2] = 2501,
+    [3] = 1991,
+    [4] = 1586,
+    [5] = 1277,
+    [6] = 1024,
+    [7] = 820,
+    [8] = 655,
+    [9] = 526,
+    [10] = 423,
+    [11] = 335,
 };
\ No newline at end of file
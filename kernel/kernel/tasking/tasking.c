@@ -16,6 +16,7 @@
 #include <platform/generic/system.h>
 #include <tasking/cpu.h>
 #include <tasking/dump.h>
+#include <tasking/pid_hash.h>
 #include <tasking/sched.h>
 #include <tasking/tasking.h>
 #include <tasking/thread.h>
@@ -25,6 +26,13 @@
 proc_t proc[MAX_PROCESS_COUNT];
 static pid_t nxt_proc = 0;
 
+// Dying processes pushed by proc_die(), kreaperd() takes them all at once.
+static proc_t* _tasking_dying_head = NULL;
+static wait_queue_t _tasking_reaper_queue;
+
+// Parents of vfork() children wait here for their address spaces.
+static wait_queue_t _tasking_vfork_queue;
+
 static int _tasking_do_exec(proc_t* p, thread_t* main_thread, const char* path, int argc, char** argv, int envc, char** envp);
 
 static inline pid_t _tasking_next_proc_id()
@@ -63,32 +71,14 @@ void _tasking_jumper()
  * TASK LOADING FUNCTIONS
  */
 
-extern thread_list_t thread_list;
 thread_t* tasking_get_thread(pid_t tid)
 {
-    thread_list_node_t* __thread_list_node = thread_list.head;
-    while (__thread_list_node) {
-        for (int i = 0; i < THREADS_PER_NODE; i++) {
-            if (__thread_list_node->thread_storage[i].tid == tid) {
-                return &__thread_list_node->thread_storage[i];
-            }
-        }
-        __thread_list_node = __thread_list_node->next;
-    }
-
-    return NULL;
+    return pid_hash_find_thread(tid);
 }
 
 proc_t* tasking_get_proc(pid_t pid)
 {
-    proc_t* p;
-    for (int i = 0; i < _tasking_get_proc_count(); i++) {
-        p = &proc[i];
-        if (p->pid == pid) {
-            return p;
-        }
-    }
-    return NULL;
+    return pid_hash_find_proc(pid);
 }
 
 static inline proc_t* _tasking_alloc_proc()
@@ -169,6 +159,8 @@ proc_t* tasking_run_kernel_thread(void* entry_point, void* data)
 void tasking_init()
 {
     proc_init_storage();
+    wait_queue_init(&_tasking_reaper_queue);
+    wait_queue_init(&_tasking_vfork_queue);
     swapfile_init();
     signal_init();
     dump_prepare_kernel_data();
@@ -206,28 +198,86 @@ void tasking_evict_zombies_waiting_for(proc_t* pp)
 
 void tasking_evict_proc_entry(proc_t* p)
 {
+    pid_hash_remove_proc(p);
     p->pid = 0;
     p->status = PROC_DEAD;
 }
 
-void tasking_kill_dying()
+/**
+ * REAPER
+ */
+
+void tasking_queue_dying(proc_t* p)
 {
-    proc_t* p;
-    for (int i = 0; i < _tasking_get_proc_count(); i++) {
-        p = &proc[i];
-        if (p->status == PROC_DYING) {
-            spinlock_acquire(&p->lock);
-            if (unlikely(p->status != PROC_DYING)) {
-                spinlock_release(&p->lock);
-                continue;
-            }
-            proc_free_locked(p);
-            if (tasking_should_become_zombie(p)) {
-                p->status = PROC_ZOMBIE;
-            } else {
-                tasking_evict_proc_entry(p);
+    proc_t* head = atomic_load(&_tasking_dying_head);
+    do {
+        p->reap_next = head;
+    } while (!atomic_compare_exchange(&_tasking_dying_head, &head, p));
+    wait_queue_notify_all(&_tasking_reaper_queue);
+}
+
+static bool _tasking_proc_is_running(proc_t* p)
+{
+    for (int i = 0; i < MAX_CPU_CNT; i++) {
+        thread_t* thread = cpus[i].running_thread;
+        if (thread && thread->process == p) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns false if a thread of the process has not left its cpu yet.
+static bool _tasking_reap(proc_t* p)
+{
+    system_disable_interrupts();
+    if (_tasking_proc_is_running(p)) {
+        system_enable_interrupts();
+        return false;
+    }
+
+    spinlock_acquire(&p->lock);
+    if (p->status == PROC_DYING) {
+        proc_free_locked(p);
+        if (tasking_should_become_zombie(p)) {
+            p->status = PROC_ZOMBIE;
+        } else {
+            tasking_evict_proc_entry(p);
+        }
+    }
+    spinlock_release(&p->lock);
+    system_enable_interrupts();
+    return true;
+}
+
+static bool _tasking_reaper_has_work(thread_t* thread)
+{
+    return atomic_load(&_tasking_dying_head) != NULL;
+}
+
+/**
+ * Is a thread entry point. Frees resources of dying processes, so the
+ * teardown is not done by the scheduler.
+ */
+void kreaperd()
+{
+    for (;;) {
+        init_wait_queue_blocker(RUNNING_THREAD, &_tasking_reaper_queue, _tasking_reaper_has_work);
+
+        bool deferred = false;
+        proc_t* p = atomic_exchange(&_tasking_dying_head, NULL);
+        while (p) {
+            proc_t* next = p->reap_next;
+            if (!_tasking_reap(p)) {
+                tasking_queue_dying(p);
+                deferred = true;
             }
-            spinlock_release(&p->lock);
+            p = next;
+        }
+
+        // The cpu will switch from the dying thread soon, let it run.
+        if (deferred) {
+            sched_yield();
         }
     }
 }
@@ -254,6 +304,53 @@ void tasking_fork()
     resched();
 }
 
+static bool _tasking_vfork_done(thread_t* thread)
+{
+    return !atomic_load(&thread->vfork_waiting);
+}
+
+/**
+ * Starts a child which borrows the address space and waits until it calls
+ * exec or exits. The child runs on the stack of the caller, so the wait
+ * is not interrupted by signals.
+ */
+void tasking_vfork()
+{
+    thread_t* thread = RUNNING_THREAD;
+    proc_t* new_proc = _tasking_setup_proc();
+    proc_vfork_from(new_proc, thread);
+
+    /* setting output */
+    set_syscall_result(new_proc->main_thread->tf, 0);
+    set_syscall_result(thread->tf, new_proc->pid);
+
+    new_proc->main_thread->status = THREAD_STATUS_RUNNING;
+
+#ifdef TASKING_DEBUG
+    log("Vfork %d to pid %d", thread->tid, new_proc->pid);
+#endif
+
+    sched_enqueue(new_proc->main_thread);
+    while (!_tasking_vfork_done(thread)) {
+        init_wait_queue_blocker(thread, &_tasking_vfork_queue, _tasking_vfork_done);
+    }
+}
+
+// Gives the address space back to the vfork() parent.
+void tasking_vfork_release(proc_t* p)
+{
+    thread_t* parent = atomic_exchange(&p->vfork_parent, NULL);
+    if (!parent) {
+        return;
+    }
+
+    // The parent could have died, its thread slot is reused then.
+    if (parent->process && parent->process->pid == p->ppid) {
+        atomic_store(&parent->vfork_waiting, false);
+    }
+    wait_queue_notify_all(&_tasking_vfork_queue);
+}
+
 static int _tasking_validate_exec_params(const char** argv, int* kargc, char*** kargv)
 {
     int start_with = *kargc;
@@ -332,6 +429,9 @@ int tasking_exec(const char __user* path, const char __user** argv, const char _
     log("Exec %s : pid %d", kpath, p->pid);
 #endif
 
+    // The old address space is left, so a vfork() parent could continue.
+    tasking_vfork_release(p);
+
     if (p->is_tracee) {
         // Wait for SIGCONT from parent thread.
         tasking_signal(thread, SIGSTOP);
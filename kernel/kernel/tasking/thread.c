@@ -11,6 +11,7 @@
 #include <libkern/libkern.h>
 #include <libkern/log.h>
 #include <mem/kmalloc.h>
+#include <tasking/pid_hash.h>
 #include <tasking/proc.h>
 #include <tasking/sched.h>
 #include <tasking/tasking.h>
@@ -56,7 +57,11 @@ int thread_setup_main(proc_t* p, thread_t* thread)
 
     thread->process = p;
     thread->tid = p->pid;
+    pid_hash_add_thread(thread);
     thread->last_cpu = LAST_CPU_NOT_SET;
+    thread->cpu_mask = SCHED_CPU_MASK_ALL;
+    blocker_setup(thread);
+    thread->vfork_waiting = false;
 
     /* setting signal handlers to 0 */
     thread->signals_mask = 0xffffffff; /* for now all signals are legal */
@@ -83,7 +88,15 @@ int thread_setup(proc_t* p, thread_t* thread)
 
     thread->process = p;
     thread->tid = proc_alloc_pid();
+    pid_hash_add_thread(thread);
     thread->last_cpu = LAST_CPU_NOT_SET;
+    // Threads inherit the affinity of the thread which creates them.
+    thread->cpu_mask = SCHED_CPU_MASK_ALL;
+    if (RUNNING_THREAD && RUNNING_THREAD->process == p) {
+        thread->cpu_mask = RUNNING_THREAD->cpu_mask;
+    }
+    blocker_setup(thread);
+    thread->vfork_waiting = false;
 
     /* setting signal handlers to 0 */
     thread->signals_mask = 0xffffffff; /* for now all signals are legal */
@@ -104,6 +117,7 @@ int thread_copy_of(thread_t* thread, thread_t* from_thread)
 {
     memcpy(thread->tf, from_thread->tf, sizeof(trapframe_t));
     memcpy(thread->signal_handlers, from_thread->signal_handlers, sizeof(from_thread->signal_handlers));
+    thread->cpu_mask = from_thread->cpu_mask;
 #ifdef FPU_ENABLED
     // FPUs reinitilaztion for each implements a lazy-switch, this
     // should be checked to copy the latest data.
@@ -270,6 +284,7 @@ int thread_free(thread_t* thread)
     }
 
     thread_kstack_free(thread);
+    pid_hash_remove_thread(thread);
     thread->status = THREAD_STATUS_INVALID;
     return 0;
 }
@@ -282,6 +297,8 @@ int thread_die(thread_t* thread)
 
     thread->status = THREAD_STATUS_DYING;
     sched_dequeue(thread);
+    blocker_detach(thread);
+    wait_queue_notify_all(&thread->join_wait_queue);
     return 0;
 }
 
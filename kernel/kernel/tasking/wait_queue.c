@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <libkern/libkern.h>
+#include <platform/generic/system.h>
+#include <tasking/thread.h>
+#include <tasking/wait_queue.h>
+
+void wait_queue_init(wait_queue_t* wq)
+{
+    wq->head = NULL;
+    wq->tail = NULL;
+    spinlock_init(&wq->lock);
+}
+
+void wait_queue_add(wait_queue_t* wq, wait_queue_entry_t* entry)
+{
+    // Queues could be notified from interrupt handlers (e.g. keyboard),
+    // so interrupts are disabled while the lock is held.
+    system_disable_interrupts();
+    spinlock_acquire(&wq->lock);
+    entry->queue = wq;
+    entry->next = NULL;
+    entry->prev = wq->tail;
+    if (wq->tail) {
+        wq->tail->next = entry;
+    } else {
+        wq->head = entry;
+    }
+    wq->tail = entry;
+    spinlock_release(&wq->lock);
+    system_enable_interrupts();
+}
+
+void wait_queue_remove(wait_queue_entry_t* entry)
+{
+    system_disable_interrupts();
+    wait_queue_t* wq = entry->queue;
+    if (!wq) {
+        system_enable_interrupts();
+        return;
+    }
+
+    spinlock_acquire(&wq->lock);
+    // The entry could be taken off by its queue owner (e.g. an expired
+    // timeout) while the lock was being acquired.
+    if (entry->queue != wq) {
+        spinlock_release(&wq->lock);
+        system_enable_interrupts();
+        return;
+    }
+
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->head = entry->next;
+    }
+
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        wq->tail = entry->prev;
+    }
+
+    entry->queue = NULL;
+    entry->next = entry->prev = NULL;
+    spinlock_release(&wq->lock);
+    system_enable_interrupts();
+}
+
+/**
+ * Wakes up all threads waiting for the queue. Waiters re-evaluate their
+ * blocking condition on their own, so a spurious notification is harmless.
+ */
+void wait_queue_notify_all(wait_queue_t* wq)
+{
+    system_disable_interrupts();
+    spinlock_acquire(&wq->lock);
+    for (wait_queue_entry_t* entry = wq->head; entry; entry = entry->next) {
+        blocker_wake_up(entry->thread);
+    }
+    spinlock_release(&wq->lock);
+    system_enable_interrupts();
+}
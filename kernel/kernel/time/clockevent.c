@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <drivers/irq/irq_api.h>
+#include <libkern/kassert.h>
+#include <libkern/libkern.h>
+#include <libkern/log.h>
+#include <platform/generic/system.h>
+#include <tasking/cpu.h>
+#include <tasking/sched.h>
+#include <tasking/thread.h>
+#include <time/clockevent.h>
+#include <time/time_manager.h>
+#include <time/timer.h>
+
+// #define CLOCKEVENT_DEBUG
+
+// An idle cpu still wakes up once in a while, this also keeps the math in 32 bits.
+#define CLOCKEVENT_MAX_DELTA_NS (1000000000)
+#define CLOCKEVENT_NS2CYC_SHIFT 32
+#define CLOCKEVENT_CYC2NS_SHIFT 20
+
+struct clockevent_state {
+    clockevent_device_t* dev;
+    spinlock_t lock;
+    uint64_t ns2cyc_mult;
+    uint64_t cyc2ns_mult;
+    uint32_t max_ns;
+    uint32_t slack_ns; // Conversions are not exact, so ticks are rounded up by one cycle.
+    int32_t last_left; // Cycles left on the device when the time was accounted last.
+    uint32_t unaccounted_cycles; // Passed before the device was reprogrammed.
+    int32_t ns_since_tick; // Could go below 0 by the slack, when a tick is rounded up.
+    bool tickless;
+};
+typedef struct clockevent_state clockevent_state_t;
+
+static clockevent_state_t _clockevent_cpus[MAX_CPU_CNT];
+static clockevent_state_t _clockevent_global;
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+// Returns a * 2^shift / b, 64-bit division is not available on all targets.
+static uint64_t _clockevent_fixed_div(uint32_t a, uint32_t b, int shift)
+{
+    uint64_t res = a / b;
+    uint32_t rem = a % b;
+    for (int i = 0; i < shift; i++) {
+        res <<= 1;
+        rem <<= 1;
+        if (rem >= b) {
+            rem -= b;
+            res |= 1;
+        }
+    }
+    return res;
+}
+
+static inline uint32_t _clockevent_ns2cyc(clockevent_state_t* state, uint32_t ns)
+{
+    return (ns * state->ns2cyc_mult) >> CLOCKEVENT_NS2CYC_SHIFT;
+}
+
+static inline uint32_t _clockevent_cyc2ns(clockevent_state_t* state, uint32_t cycles)
+{
+    return (cycles * state->cyc2ns_mult) >> CLOCKEVENT_CYC2NS_SHIFT;
+}
+
+static clockevent_state_t* _clockevent_state()
+{
+    clockevent_state_t* state = &_clockevent_cpus[system_cpu_id()];
+    if (state->dev) {
+        return state;
+    }
+    if (_clockevent_global.dev) {
+        return &_clockevent_global;
+    }
+    return NULL;
+}
+
+static inline bool _clockevent_can_stop_tick(clockevent_state_t* state)
+{
+    // A global device ticks for all cpus, it's stopped only if no one else needs it.
+    return (state->dev->flags & CLOCKEVENT_PER_CPU) || active_cpu_count() == 1;
+}
+
+// Returns cycles passed since the last call, the device keeps counting after the event has fired.
+static uint32_t _clockevent_cycles_passed(clockevent_state_t* state)
+{
+    int32_t left = state->dev->cycles_left();
+    int64_t passed = (int64_t)state->last_left - left;
+    state->last_left = left;
+    return passed > 0 ? passed : 0;
+}
+
+/**
+ * Accounts the time passed since the last accounting, replaying all ticks
+ * which were crossed. Returns the number of ticks.
+ */
+static int _clockevent_account(clockevent_state_t* state)
+{
+    uint32_t elapsed_cycles = state->unaccounted_cycles + _clockevent_cycles_passed(state);
+    state->unaccounted_cycles = 0;
+
+    int ticks = 0;
+    state->ns_since_tick += _clockevent_cyc2ns(state, elapsed_cycles);
+    while (state->ns_since_tick + (int32_t)state->slack_ns >= TIMER_NSEC_PER_TICK) {
+        state->ns_since_tick -= TIMER_NSEC_PER_TICK;
+        cpu_tick();
+        timeman_timer_tick();
+        ticks++;
+    }
+    timeman_timer_set_nsec_since_tick(max(state->ns_since_tick, 0));
+    return ticks;
+}
+
+static void _clockevent_program_next(clockevent_state_t* state, uint32_t next_timer_ns)
+{
+    uint32_t delta = state->tickless ? state->max_ns : TIMER_NSEC_PER_TICK - state->ns_since_tick;
+    delta = min(delta, next_timer_ns);
+
+    uint32_t cycles = _clockevent_ns2cyc(state, min(delta, state->max_ns));
+    cycles = max(cycles, state->dev->min_cycles);
+    cycles = min(cycles, state->dev->max_cycles);
+
+    // Time since the last accounting (e.g. spent running timers) is carried to the next one.
+    state->unaccounted_cycles += _clockevent_cycles_passed(state);
+    state->last_left = cycles;
+    state->dev->set_next_event(cycles);
+}
+
+enum CLOCKEVENT_TICK_OPS {
+    CLOCKEVENT_KEEP_TICK,
+    CLOCKEVENT_STOP_TICK,
+    CLOCKEVENT_START_TICK,
+};
+
+// Interrupts should be disabled. Returns the number of ticks passed.
+static int _clockevent_process(clockevent_state_t* state, int tick_op)
+{
+    spinlock_acquire(&state->lock);
+    int ticks = _clockevent_account(state);
+    if (tick_op != CLOCKEVENT_KEEP_TICK) {
+        state->tickless = (tick_op == CLOCKEVENT_STOP_TICK);
+    }
+    spinlock_release(&state->lock);
+
+    // Timers are run by the boot cpu. Expired ones could wake up threads
+    // on this cpu, which restarts the tick, so no locks are held here.
+    uint32_t next_timer_ns = CLOCKEVENT_MAX_DELTA_NS;
+    if (system_cpu_id() == 0) {
+        timer_run();
+        next_timer_ns = timer_nsec_until_next(CLOCKEVENT_MAX_DELTA_NS);
+    }
+
+    spinlock_acquire(&state->lock);
+    _clockevent_program_next(state, next_timer_ns);
+    spinlock_release(&state->lock);
+    return ticks;
+}
+
+static void _clockevent_timers_changed_ipi_handler()
+{
+    clockevent_update();
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+void clockevent_register(clockevent_device_t* dev)
+{
+    ASSERT(dev->freq && dev->freq < (1u << 31));
+    ASSERT(dev->max_cycles <= 0x7fffffff);
+    clockevent_state_t* state = (dev->flags & CLOCKEVENT_PER_CPU) ? &_clockevent_cpus[system_cpu_id()] : &_clockevent_global;
+
+    spinlock_init(&state->lock);
+    state->ns2cyc_mult = _clockevent_fixed_div(dev->freq, 1000000000, CLOCKEVENT_NS2CYC_SHIFT);
+    state->cyc2ns_mult = _clockevent_fixed_div(1000000000, dev->freq, CLOCKEVENT_CYC2NS_SHIFT);
+    state->dev = dev;
+    state->max_ns = min(_clockevent_cyc2ns(state, dev->max_cycles), CLOCKEVENT_MAX_DELTA_NS);
+    state->slack_ns = _clockevent_cyc2ns(state, 1) + 1;
+    state->last_left = dev->cycles_left();
+    state->unaccounted_cycles = 0;
+    state->ns_since_tick = 0;
+    state->tickless = false;
+
+    if (system_cpu_id() == 0) {
+        irq_register_ipi_handler(IPI_TIMER, _clockevent_timers_changed_ipi_handler);
+    }
+
+#ifdef CLOCKEVENT_DEBUG
+    log("Clockevent: %s at %d Hz, max delta %d ns", dev->name, dev->freq, state->max_ns);
+#endif
+    _clockevent_program_next(state, CLOCKEVENT_MAX_DELTA_NS);
+}
+
+// Called by drivers from their interrupt handlers.
+void clockevent_handle_event()
+{
+    system_disable_interrupts();
+    clockevent_state_t* state = _clockevent_state();
+    if (!state) {
+        system_enable_interrupts();
+        return;
+    }
+
+    int ticks = _clockevent_process(state, CLOCKEVENT_KEEP_TICK);
+    system_enable_interrupts();
+
+    if (ticks) {
+        sched_tick();
+    }
+}
+
+// Reprograms the device, e.g. when a closer timeout appeared.
+void clockevent_update()
+{
+    system_disable_interrupts();
+    clockevent_state_t* state = _clockevent_state();
+    if (!state) {
+        system_enable_interrupts();
+        return;
+    }
+
+    _clockevent_process(state, CLOCKEVENT_KEEP_TICK);
+    system_enable_interrupts();
+}
+
+void clockevent_timers_changed()
+{
+    if (system_cpu_id() == 0) {
+        clockevent_update();
+    } else {
+        irq_send_ipi(IPI_TIMER, 1 << 0);
+    }
+}
+
+void clockevent_idle_enter()
+{
+    system_disable_interrupts();
+    clockevent_state_t* state = _clockevent_state();
+    if (!state || state->tickless || !_clockevent_can_stop_tick(state)) {
+        system_enable_interrupts();
+        return;
+    }
+
+    _clockevent_process(state, CLOCKEVENT_STOP_TICK);
+    system_enable_interrupts();
+}
+
+// Restarts the tick, it's safe to call when the tick is not stopped.
+void clockevent_idle_exit()
+{
+    system_disable_interrupts();
+    clockevent_state_t* state = _clockevent_state();
+    if (!state || !state->tickless) {
+        system_enable_interrupts();
+        return;
+    }
+
+    _clockevent_process(state, CLOCKEVENT_START_TICK);
+    system_enable_interrupts();
+}
@@ -8,12 +8,14 @@
 
 #include <drivers/driver_manager.h>
 #include <libkern/log.h>
+#include <tasking/thread.h>
 #include <time/time_manager.h>
 
 // #define TIME_MANAGER_DEBUG
 
 time_t ticks_since_boot = 0;
 time_t ticks_since_second = 0;
+static uint32_t nsec_since_tick = 0;
 static time_t time_since_boot = 0;
 static time_t time_since_epoch = 0;
 static uint32_t (*get_rtc)() = NULL;
@@ -91,6 +93,7 @@ void timeman_timer_tick()
         return;
     }
 
+    atomic_add(&ticks_since_boot, 1);
     atomic_add(&ticks_since_second, 1);
 
     if (ticks_since_second >= TIMER_TICKS_PER_SECOND) {
@@ -100,6 +103,23 @@ void timeman_timer_tick()
     }
 }
 
+/**
+ * Clockevents could fire between ticks (e.g. for a timeout), so the time
+ * is precise up to the last event, not only up to the last tick.
+ */
+void timeman_timer_set_nsec_since_tick(uint32_t nsec)
+{
+    if (system_cpu_id() != 0) {
+        return;
+    }
+    atomic_store(&nsec_since_tick, nsec);
+}
+
+uint32_t timeman_timer_nsec_since_tick()
+{
+    return atomic_load(&nsec_since_tick);
+}
+
 time_t timeman_seconds_since_epoch()
 {
     return atomic_load(&time_since_epoch);
@@ -119,7 +139,7 @@ timespec_t timeman_timespec_since_epoch()
 {
     timespec_t kts = { 0 };
     kts.tv_sec = timeman_seconds_since_epoch();
-    kts.tv_nsec = timeman_get_ticks_from_last_second() * (1000000000 / timeman_ticks_per_second());
+    kts.tv_nsec = timeman_get_ticks_from_last_second() * TIMER_NSEC_PER_TICK + atomic_load(&nsec_since_tick);
     return kts;
 }
 
@@ -127,7 +147,7 @@ timespec_t timeman_timespec_since_boot()
 {
     timespec_t kts = { 0 };
     kts.tv_sec = timeman_seconds_since_boot();
-    kts.tv_nsec = timeman_get_ticks_from_last_second() * (1000000000 / timeman_ticks_per_second());
+    kts.tv_nsec = timeman_get_ticks_from_last_second() * TIMER_NSEC_PER_TICK + atomic_load(&nsec_since_tick);
     return kts;
 }
 
@@ -135,7 +155,7 @@ timeval_t timeman_timeval_since_epoch()
 {
     timeval_t ktv = { 0 };
     ktv.tv_sec = timeman_seconds_since_epoch();
-    ktv.tv_usec = timeman_get_ticks_from_last_second() * (1000000 / timeman_ticks_per_second());
+    ktv.tv_usec = timeman_get_ticks_from_last_second() * (1000000 / timeman_ticks_per_second()) + atomic_load(&nsec_since_tick) / 1000;
     return ktv;
 }
 
@@ -143,7 +163,7 @@ timeval_t timeman_timeval_since_boot()
 {
     timeval_t ktv = { 0 };
     ktv.tv_sec = timeman_seconds_since_boot();
-    ktv.tv_usec = timeman_get_ticks_from_last_second() * (1000000 / timeman_ticks_per_second());
+    ktv.tv_usec = timeman_get_ticks_from_last_second() * (1000000 / timeman_ticks_per_second()) + atomic_load(&nsec_since_tick) / 1000;
     return ktv;
 }
 
@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2020-2022 The opuntiaOS Project Authors.
+ *  + Contributed by Nikita Melekhin <nimelehin@gmail.com>
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <libkern/kassert.h>
+#include <libkern/libkern.h>
+#include <libkern/lock.h>
+#include <libkern/platform.h>
+#include <platform/generic/system.h>
+#include <time/clockevent.h>
+#include <time/time_manager.h>
+#include <time/timer.h>
+
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVEL_SHIFT(level) ((level)*TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_RANGE (1u << TIMER_WHEEL_LEVEL_SHIFT(TIMER_WHEEL_LEVELS))
+
+/**
+ * Level L of the wheel has slots of 32^L ticks. A timer is put to the lowest
+ * level which covers its delay and moves down (cascades) once the wheel
+ * reaches the start of its slot.
+ */
+struct timer_wheel {
+    spinlock_t lock;
+    time_t clk; // The tick which is being processed.
+    uint32_t occupied[TIMER_WHEEL_LEVELS];
+    timer_slot_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+    // Expired timers stay pending here until their callbacks are called,
+    // so they could still be cancelled or rearmed.
+    timer_slot_t expired;
+    timer_t* running; // The timer whose callback is being called.
+    int running_cpu;
+
+    // The earliest expiry the clockevent was programmed for.
+    bool has_next;
+    time_t next_expires;
+    uint32_t next_expires_nsec;
+};
+typedef struct timer_wheel timer_wheel_t;
+
+static timer_wheel_t _timer_wheel;
+
+/**
+ * HELPER FUNCTIONS
+ */
+
+static inline int _timer_slot_index(timer_slot_t* slot)
+{
+    return (slot - &_timer_wheel.slots[0][0]) % TIMER_WHEEL_SLOTS;
+}
+
+static inline int _timer_slot_level(timer_slot_t* slot)
+{
+    return (slot - &_timer_wheel.slots[0][0]) / TIMER_WHEEL_SLOTS;
+}
+
+static inline bool _timer_is_before(time_t a, uint32_t a_nsec, time_t b, uint32_t b_nsec)
+{
+    int32_t diff = (int32_t)(a - b);
+    return diff < 0 || (diff == 0 && a_nsec < b_nsec);
+}
+
+static void _timer_unlink(timer_t* timer)
+{
+    timer_slot_t* slot = timer->slot;
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        slot->head = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    if (!slot->head && slot != &_timer_wheel.expired) {
+        _timer_wheel.occupied[_timer_slot_level(slot)] &= ~(1u << _timer_slot_index(slot));
+    }
+
+    timer->prev = timer->next = NULL;
+    timer->slot = NULL;
+}
+
+static void _timer_enqueue(timer_t* timer)
+{
+    int32_t delta = (int32_t)(timer->expires - _timer_wheel.clk);
+    if (delta < 0) {
+        // The tick is already processed, fire at the current one.
+        timer->expires = _timer_wheel.clk;
+        timer->expires_nsec = 0;
+        delta = 0;
+    }
+
+    // Timers which are too far are parked at the top level and placed again
+    // when they cascade, the expiry itself is kept.
+    time_t expires = timer->expires;
+    if ((uint32_t)delta >= TIMER_WHEEL_RANGE) {
+        expires = _timer_wheel.clk + TIMER_WHEEL_RANGE - 1;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && (uint32_t)delta >= (1u << TIMER_WHEEL_LEVEL_SHIFT(level + 1))) {
+        level++;
+    }
+
+    int index = (expires >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_SLOT_MASK;
+    timer_slot_t* slot = &_timer_wheel.slots[level][index];
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = slot->head;
+    if (slot->head) {
+        slot->head->prev = timer;
+    }
+    slot->head = timer;
+    _timer_wheel.occupied[level] |= (1u << index);
+}
+
+// Moves timers of the slots which start at the current tick to lower levels.
+static void _timer_cascade()
+{
+    time_t clk = _timer_wheel.clk;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (clk & ((1u << TIMER_WHEEL_LEVEL_SHIFT(level)) - 1)) {
+            return;
+        }
+
+        int index = (clk >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_SLOT_MASK;
+        timer_slot_t* slot = &_timer_wheel.slots[level][index];
+        timer_t* timer = slot->head;
+        slot->head = NULL;
+        _timer_wheel.occupied[level] &= ~(1u << index);
+
+        while (timer) {
+            timer_t* next = timer->next;
+            _timer_enqueue(timer);
+            timer = next;
+        }
+    }
+}
+
+// Moves expired timers of the current tick to the expired slot, they are fired without the lock.
+static void _timer_collect(uint32_t upto_nsec)
+{
+    timer_slot_t* expired = &_timer_wheel.expired;
+    timer_slot_t* slot = &_timer_wheel.slots[0][_timer_wheel.clk & TIMER_WHEEL_SLOT_MASK];
+    timer_t* timer = slot->head;
+    while (timer) {
+        timer_t* next = timer->next;
+        if (timer->expires_nsec <= upto_nsec) {
+            _timer_unlink(timer);
+            timer->slot = expired;
+            timer->next = expired->head;
+            if (expired->head) {
+                expired->head->prev = timer;
+            }
+            expired->head = timer;
+        }
+        timer = next;
+    }
+}
+
+static inline uint32_t _timer_min_nsec(timer_slot_t* slot)
+{
+    uint32_t res = TIMER_NSEC_PER_TICK;
+    for (timer_t* timer = slot->head; timer; timer = timer->next) {
+        res = min(res, timer->expires_nsec);
+    }
+    return res;
+}
+
+/**
+ * Finds the earliest point the wheel has to be run at: an expiry at level 0
+ * or a cascade of a higher level, which is enough to find the expiry later.
+ */
+static bool _timer_find_next(time_t* ticks, uint32_t* nsec)
+{
+    time_t clk = _timer_wheel.clk;
+    bool found = false;
+    time_t best = 0;
+    uint32_t best_nsec = 0;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint32_t occupied = _timer_wheel.occupied[level];
+        if (!occupied) {
+            continue;
+        }
+
+        int shift = TIMER_WHEEL_LEVEL_SHIFT(level);
+        int cur = (clk >> shift) & TIMER_WHEEL_SLOT_MASK;
+        uint32_t rotated = (occupied >> cur) | (cur ? (occupied << (TIMER_WHEEL_SLOTS - cur)) : 0);
+        int dist = ctz32(rotated);
+        int index = (cur + dist) & TIMER_WHEEL_SLOT_MASK;
+
+        time_t at;
+        uint32_t at_nsec = 0;
+        if (level == 0) {
+            at = clk + dist;
+            at_nsec = _timer_min_nsec(&_timer_wheel.slots[0][index]);
+        } else {
+            // The current slot of a higher level is reached after the full turn.
+            at = (clk & ~((1u << shift) - 1)) + ((dist ? dist : TIMER_WHEEL_SLOTS) << shift);
+        }
+
+        if (!found || _timer_is_before(at, at_nsec, best, best_nsec)) {
+            found = true;
+            best = at;
+            best_nsec = at_nsec;
+        }
+    }
+
+    *ticks = best;
+    *nsec = best_nsec;
+    return found;
+}
+
+/**
+ * API FUNCTIONS
+ */
+
+void timer_setup(timer_t* timer, timer_callback_t callback, void* data)
+{
+    timer->prev = timer->next = NULL;
+    timer->slot = NULL;
+    timer->expires = 0;
+    timer->expires_nsec = 0;
+    timer->callback = callback;
+    timer->data = data;
+}
+
+// Arms the timer to fire after the delay, a pending timer is rearmed.
+void timer_arm(timer_t* timer, time_t ticks, uint32_t nsec)
+{
+    ticks += nsec / TIMER_NSEC_PER_TICK;
+    nsec %= TIMER_NSEC_PER_TICK;
+
+    system_disable_interrupts();
+    spinlock_acquire(&_timer_wheel.lock);
+    if (timer->slot) {
+        _timer_unlink(timer);
+    }
+
+    nsec += timeman_timer_nsec_since_tick();
+    if (nsec >= TIMER_NSEC_PER_TICK) {
+        nsec -= TIMER_NSEC_PER_TICK;
+        ticks++;
+    }
+    timer->expires = timeman_timer_ticks() + ticks;
+    timer->expires_nsec = nsec;
+    _timer_enqueue(timer);
+
+    bool is_first = !_timer_wheel.has_next || _timer_is_before(timer->expires, timer->expires_nsec, _timer_wheel.next_expires, _timer_wheel.next_expires_nsec);
+    if (is_first) {
+        _timer_wheel.has_next = true;
+        _timer_wheel.next_expires = timer->expires;
+        _timer_wheel.next_expires_nsec = timer->expires_nsec;
+    }
+    spinlock_release(&_timer_wheel.lock);
+    system_enable_interrupts();
+
+    if (is_first) {
+        clockevent_timers_changed();
+    }
+}
+
+void timer_arm_timespec(timer_t* timer, const timespec_t* delay)
+{
+    // Delays over the range of the wheel are not distinguishable anyway.
+    uint32_t secs = min((uint32_t)delay->tv_sec, TIMER_WHEEL_RANGE / TIMER_TICKS_PER_SECOND);
+    time_t ticks = secs * TIMER_TICKS_PER_SECOND + delay->tv_nsec / TIMER_NSEC_PER_TICK;
+    timer_arm(timer, ticks, delay->tv_nsec % TIMER_NSEC_PER_TICK);
+}
+
+/**
+ * Returns true if the timer was pending. A callback which is already being
+ * called is waited for, unless it's cancelling its own timer, so the data
+ * of the timer is not used after the call.
+ */
+bool timer_cancel(timer_t* timer)
+{
+    system_disable_interrupts();
+    spinlock_acquire(&_timer_wheel.lock);
+    bool was_pending = timer->slot;
+    if (was_pending) {
+        _timer_unlink(timer);
+    }
+    while (_timer_wheel.running == timer && _timer_wheel.running_cpu != system_cpu_id()) {
+        spinlock_release(&_timer_wheel.lock);
+        while (atomic_load(&_timer_wheel.running) == timer) { }
+        spinlock_acquire(&_timer_wheel.lock);
+    }
+    spinlock_release(&_timer_wheel.lock);
+    system_enable_interrupts();
+    return was_pending;
+}
+
+time_t timer_ticks_left(timer_t* timer)
+{
+    system_disable_interrupts();
+    spinlock_acquire(&_timer_wheel.lock);
+    time_t res = 0;
+    if (timer->slot) {
+        int32_t delta = (int32_t)(timer->expires - timeman_timer_ticks());
+        res = max(delta, 0);
+    }
+    spinlock_release(&_timer_wheel.lock);
+    system_enable_interrupts();
+    return res;
+}
+
+/**
+ * Fires all expired timers. Called by the boot cpu from the timer interrupt
+ * with interrupts disabled. Callbacks are called without the lock, so they
+ * could arm timers and wake threads up. Timers are taken off the expired
+ * slot one at a time, so the rest could still be cancelled or rearmed.
+ */
+void timer_run()
+{
+    spinlock_acquire(&_timer_wheel.lock);
+    time_t now = timeman_timer_ticks();
+    uint32_t now_nsec = timeman_timer_nsec_since_tick();
+    while ((int32_t)(now - _timer_wheel.clk) > 0) {
+        _timer_collect(TIMER_NSEC_PER_TICK);
+        _timer_wheel.clk++;
+        _timer_cascade();
+    }
+    _timer_collect(now_nsec);
+
+    if (_timer_wheel.has_next && !_timer_is_before(now, now_nsec, _timer_wheel.next_expires, _timer_wheel.next_expires_nsec)) {
+        _timer_wheel.has_next = false;
+    }
+
+    timer_t* timer;
+    while ((timer = _timer_wheel.expired.head)) {
+        _timer_unlink(timer);
+        _timer_wheel.running = timer;
+        _timer_wheel.running_cpu = system_cpu_id();
+        spinlock_release(&_timer_wheel.lock);
+
+        timer->callback(timer);
+
+        spinlock_acquire(&_timer_wheel.lock);
+        atomic_store(&_timer_wheel.running, NULL);
+    }
+    spinlock_release(&_timer_wheel.lock);
+}
+
+// Returns nanoseconds until the wheel has to be run again, but not more than the limit.
+uint32_t timer_nsec_until_next(uint32_t limit)
+{
+    spinlock_acquire(&_timer_wheel.lock);
+    time_t ticks;
+    uint32_t nsec;
+    bool found = _timer_find_next(&ticks, &nsec);
+    _timer_wheel.has_next = found;
+    _timer_wheel.next_expires = ticks;
+    _timer_wheel.next_expires_nsec = nsec;
+    spinlock_release(&_timer_wheel.lock);
+
+    if (!found) {
+        return limit;
+    }
+
+    time_t now = timeman_timer_ticks();
+    uint32_t now_nsec = timeman_timer_nsec_since_tick();
+    if (!_timer_is_before(now, now_nsec, ticks, nsec)) {
+        return 0;
+    }
+
+    uint32_t delta_ticks = ticks - now;
+    if (delta_ticks > limit / TIMER_NSEC_PER_TICK + 1) {
+        return limit;
+    }
+
+    uint64_t ns = (uint64_t)delta_ticks * TIMER_NSEC_PER_TICK + nsec - now_nsec;
+    return ns < limit ? (uint32_t)ns : limit;
+}
@@ -0,0 +1,29 @@
+#ifndef _LIBC_BITS_SCHED_H
+#define _LIBC_BITS_SCHED_H
+
+#include <sys/types.h>
+
+#define SCHED_OTHER 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+
+// Priorities of SCHED_FIFO and SCHED_RR, the bigger is the more important.
+#define SCHED_RT_PRIO_MIN 1
+#define SCHED_RT_PRIO_MAX 32
+
+struct sched_param {
+    int sched_priority;
+};
+
+// A set covers every cpu the kernel could run on, cpus are numbered from 0.
+#define CPU_SETSIZE 32
+typedef struct {
+    uint32_t bits;
+} cpu_set_t;
+
+#define CPU_ZERO(set) ((set)->bits = 0)
+#define CPU_SET(cpu, set) ((set)->bits |= (1u << (cpu)))
+#define CPU_CLR(cpu, set) ((set)->bits &= ~(1u << (cpu)))
+#define CPU_ISSET(cpu, set) (((set)->bits >> (cpu)) & 1)
+
+#endif // _LIBC_BITS_SCHED_H
@@ -1,12 +1,22 @@
 #ifndef _LIBC_SCHED_H
 #define _LIBC_SCHED_H
 
+#include <bits/sched.h>
+#include <stddef.h>
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
 __BEGIN_DECLS
 
 void sched_yield();
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param* param);
+int sched_getscheduler(pid_t pid);
+int sched_setparam(pid_t pid, const struct sched_param* param);
+int sched_getparam(pid_t pid, struct sched_param* param);
+int sched_get_priority_max(int policy);
+int sched_get_priority_min(int policy);
+int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t* mask);
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t* mask);
 
 __END_DECLS
 
@@ -0,0 +1,57 @@
+#ifndef _LIBC_SPAWN_H
+#define _LIBC_SPAWN_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+#define POSIX_SPAWN_SETPGROUP 0x1
+
+enum __spawn_action_type {
+    __SPAWN_ACTION_OPEN,
+    __SPAWN_ACTION_CLOSE,
+    __SPAWN_ACTION_DUP2,
+};
+
+struct __spawn_action {
+    int type;
+    int fd;
+    int newfd;
+    int flags;
+    mode_t mode;
+    const char* path;
+};
+
+struct __posix_spawn_file_actions {
+    struct __spawn_action* actions;
+    int count;
+    int capacity;
+};
+typedef struct __posix_spawn_file_actions posix_spawn_file_actions_t;
+
+struct __posix_spawnattr {
+    short flags;
+    pid_t pgroup;
+};
+typedef struct __posix_spawnattr posix_spawnattr_t;
+
+int posix_spawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]);
+int posix_spawnp(pid_t* pid, const char* file, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attrp, char* const argv[], char* const envp[]);
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t* file_actions);
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t* file_actions);
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t* file_actions, int fd, const char* path, int flags, mode_t mode);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t* file_actions, int fd);
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t* file_actions, int fd, int newfd);
+
+int posix_spawnattr_init(posix_spawnattr_t* attr);
+int posix_spawnattr_destroy(posix_spawnattr_t* attr);
+int posix_spawnattr_getflags(const posix_spawnattr_t* attr, short* flags);
+int posix_spawnattr_setflags(posix_spawnattr_t* attr, short flags);
+int posix_spawnattr_getpgroup(const posix_spawnattr_t* attr, pid_t* pgroup);
+int posix_spawnattr_setpgroup(posix_spawnattr_t* attr, pid_t pgroup);
+
+__END_DECLS
+
+#endif // _LIBC_SPAWN_H
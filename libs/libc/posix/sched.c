@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <sched.h>
 #include <sysdep.h>
 #include <unistd.h>
@@ -11,4 +12,68 @@ int nice(int inc)
 {
     int res = DO_SYSCALL_1(SYS_NICE, inc);
     RETURN_WITH_ERRNO(res, 0, -1);
-}
\ No newline at end of file
+}
+
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param* param)
+{
+    int res = DO_SYSCALL_3(SYS_SCHED_SETSCHEDULER, pid, policy, param);
+    RETURN_WITH_ERRNO(res, 0, -1);
+}
+
+int sched_getscheduler(pid_t pid)
+{
+    int res = DO_SYSCALL_1(SYS_SCHED_GETSCHEDULER, pid);
+    RETURN_WITH_ERRNO(res, res, -1);
+}
+
+int sched_setparam(pid_t pid, const struct sched_param* param)
+{
+    int res = DO_SYSCALL_2(SYS_SCHED_SETPARAM, pid, param);
+    RETURN_WITH_ERRNO(res, 0, -1);
+}
+
+int sched_getparam(pid_t pid, struct sched_param* param)
+{
+    int res = DO_SYSCALL_2(SYS_SCHED_GETPARAM, pid, param);
+    RETURN_WITH_ERRNO(res, 0, -1);
+}
+
+int sched_get_priority_max(int policy)
+{
+    switch (policy) {
+    case SCHED_OTHER:
+        return 0;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHED_RT_PRIO_MAX;
+    default:
+        set_errno(EINVAL);
+        return -1;
+    }
+}
+
+int sched_get_priority_min(int policy)
+{
+    switch (policy) {
+    case SCHED_OTHER:
+        return 0;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHED_RT_PRIO_MIN;
+    default:
+        set_errno(EINVAL);
+        return -1;
+    }
+}
+
+int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t* mask)
+{
+    int res = DO_SYSCALL_3(SYS_SCHED_SETAFFINITY, pid, cpusetsize, mask);
+    RETURN_WITH_ERRNO(res, 0, -1);
+}
+
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t* mask)
+{
+    int res = DO_SYSCALL_3(SYS_SCHED_GETAFFINITY, pid, cpusetsize, mask);
+    RETURN_WITH_ERRNO(res, 0, -1);
+}
@@ -0,0 +1,353 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysdep.h>
+#include <unistd.h>
+
+#define SPAWN_PATH_MAX 256
+#define SPAWN_STACK_SIZE 4096
+
+struct spawn_args {
+    const char* path;
+    const char* env_path; // PATH to search, NULL if the path is used as is.
+    const posix_spawn_file_actions_t* file_actions;
+    const posix_spawnattr_t* attrp;
+    char* const* argv;
+    char* const* envp;
+    volatile int err; // Set by the child, it shares memory with the parent.
+};
+
+/**
+ * The child runs in the address space of the parent until exec, so the
+ * code below uses raw syscalls only: it must not allocate memory or change
+ * any state of the parent except args->err.
+ */
+
+static int _spawn_apply_file_actions(const posix_spawn_file_actions_t* file_actions)
+{
+    for (int i = 0; i < file_actions->count; i++) {
+        const struct __spawn_action* action = &file_actions->actions[i];
+        int res = 0;
+        switch (action->type) {
+        case __SPAWN_ACTION_OPEN:
+            res = DO_SYSCALL_3(SYS_OPEN, action->path, action->flags, action->mode);
+            if (res >= 0 && res != action->fd) {
+                int fd = res;
+                res = DO_SYSCALL_2(SYS_DUP2, fd, action->fd);
+                DO_SYSCALL_1(SYS_CLOSE, fd);
+            }
+            break;
+        case __SPAWN_ACTION_CLOSE:
+            res = DO_SYSCALL_1(SYS_CLOSE, action->fd);
+            break;
+        case __SPAWN_ACTION_DUP2:
+            res = DO_SYSCALL_2(SYS_DUP2, action->fd, action->newfd);
+            break;
+        }
+
+        if (res < 0) {
+            return res;
+        }
+    }
+    return 0;
+}
+
+static int _spawn_exec_search_path(const char* env_path, const char* file, char* const argv[], char* const envp[])
+{
+    char full_path[SPAWN_PATH_MAX];
+    size_t namelen = strlen(file);
+
+    int err = -ENOENT;
+    int len = 0;
+    for (int i = 0; env_path[i]; i += len) {
+        len = 0;
+        while (env_path[i + len] && env_path[i + len] != ':') {
+            len++;
+        }
+
+        if (len + namelen + 2 <= SPAWN_PATH_MAX) {
+            memcpy(full_path, &env_path[i], len);
+            full_path[len] = '/';
+            memcpy(&full_path[len + 1], file, namelen + 1);
+            err = DO_SYSCALL_3(SYS_EXECVE, full_path, argv, envp);
+        }
+
+        if (env_path[i + len] == ':') {
+            len++;
+        }
+    }
+    return err;
+}
+
+static void __attribute__((noreturn)) _spawn_child(struct spawn_args* args)
+{
+    int err = 0;
+    if (args->attrp && (args->attrp->flags & POSIX_SPAWN_SETPGROUP)) {
+        pid_t pid = DO_SYSCALL_0(SYS_GETPID);
+        pid_t pgroup = args->attrp->pgroup ? args->attrp->pgroup : pid;
+        err = DO_SYSCALL_2(SYS_SETPGID, pid, pgroup);
+    }
+
+    if (!err && args->file_actions) {
+        err = _spawn_apply_file_actions(args->file_actions);
+    }
+
+    if (!err) {
+        if (args->env_path) {
+            err = _spawn_exec_search_path(args->env_path, args->path, args->argv, args->envp);
+        } else {
+            err = DO_SYSCALL_3(SYS_EXECVE, args->path, args->argv, args->envp);
+        }
+    }
+
+    // exit() would run atexit handlers and flush stdio buffers of the parent.
+    args->err = err;
+    DO_SYSCALL_1(SYS_EXIT, 127);
+    __builtin_unreachable();
+}
+
+/**
+ * The child leaves the stack of the parent right after the syscall and
+ * calls _spawn_child() on its own stack, so it never writes to a frame
+ * which the parent still uses. The parent resumes once the child has
+ * called exec or exited.
+ */
+static pid_t _spawn_vfork(struct spawn_args* args, void* stack_top)
+{
+    intptr_t ret;
+#ifdef __i386__
+    asm volatile(
+        "int $0x80;\
+        test %%eax, %%eax;\
+        jnz 1f;\
+        mov %2, %%esp;\
+        sub $12, %%esp;\
+        push %1;\
+        call *%3;\
+        1:"
+        : "=a"(ret)
+        : "r"(args), "r"(stack_top), "r"(_spawn_child), "0"(SYS_VFORK)
+        : "memory");
+#elif __x86_64__
+    asm volatile(
+        "int $0x80;\
+        test %%rax, %%rax;\
+        jnz 1f;\
+        mov %2, %%rsp;\
+        mov %1, %%rdi;\
+        call *%3;\
+        1:"
+        : "=a"(ret)
+        : "r"(args), "r"(stack_top), "r"(_spawn_child), "0"((intptr_t)SYS_VFORK)
+        : "memory", "rdi");
+#elif __arm__
+    asm volatile(
+        "mov r7, %1;\
+        swi 1;\
+        cmp r0, #0;\
+        bne 1f;\
+        mov sp, %3;\
+        mov r0, %2;\
+        blx %4;\
+        1:\
+        mov %0, r0;"
+        : "=r"(ret)
+        : "r"(SYS_VFORK), "r"(args), "r"(stack_top), "r"(_spawn_child)
+        : "memory", "r0", "r7", "lr");
+#elif __aarch64__
+    asm volatile(
+        "mov x8, %x1;\
+        svc 1;\
+        cbnz x0, 1f;\
+        mov sp, %x3;\
+        mov x0, %x2;\
+        blr %x4;\
+        1:\
+        mov %x0, x0;"
+        : "=r"(ret)
+        : "r"(SYS_VFORK), "r"(args), "r"(stack_top), "r"(_spawn_child)
+        : "memory", "x0", "x8", "x30");
+#endif
+    return ret;
+}
+
+static int _spawn(pid_t* pid, struct spawn_args* args)
+{
+    // The parent waits for the child, so the stack is not needed longer than the frame.
+    char child_stack[SPAWN_STACK_SIZE] __attribute__((aligned(16)));
+    args->err = 0;
+
+    int res = _spawn_vfork(args, &child_stack[SPAWN_STACK_SIZE]);
+    if (res < 0) {
+        return -res;
+    }
+
+    if (args->err) {
+        DO_SYSCALL_3(SYS_WAITPID, res, NULL, 0);
+        return -args->err;
+    }
+
+    if (pid) {
+        *pid = res;
+    }
+    return 0;
+}
+
+int posix_spawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attrp, char* const argv[], char* const envp[])
+{
+    struct spawn_args args = {
+        .path = path,
+        .env_path = NULL,
+        .file_actions = file_actions,
+        .attrp = attrp,
+        .argv = argv,
+        .envp = envp ? envp : environ,
+    };
+    return _spawn(pid, &args);
+}
+
+int posix_spawnp(pid_t* pid, const char* file, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attrp, char* const argv[], char* const envp[])
+{
+    struct spawn_args args = {
+        .path = file,
+        .env_path = NULL,
+        .file_actions = file_actions,
+        .attrp = attrp,
+        .argv = argv,
+        .envp = envp ? envp : environ,
+    };
+    if (!strchr(file, '/')) {
+        args.env_path = getenv("PATH");
+        if (!args.env_path) {
+            args.env_path = "/bin:/usr/bin";
+        }
+    }
+    return _spawn(pid, &args);
+}
+
+/**
+ * FILE ACTIONS
+ */
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t* file_actions)
+{
+    file_actions->actions = NULL;
+    file_actions->count = 0;
+    file_actions->capacity = 0;
+    return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t* file_actions)
+{
+    free(file_actions->actions);
+    return posix_spawn_file_actions_init(file_actions);
+}
+
+static struct __spawn_action* _spawn_file_actions_add(posix_spawn_file_actions_t* file_actions)
+{
+    if (file_actions->count == file_actions->capacity) {
+        int capacity = file_actions->capacity ? file_actions->capacity * 2 : 4;
+        struct __spawn_action* actions = realloc(file_actions->actions, capacity * sizeof(struct __spawn_action));
+        if (!actions) {
+            return NULL;
+        }
+        file_actions->actions = actions;
+        file_actions->capacity = capacity;
+    }
+    return &file_actions->actions[file_actions->count++];
+}
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t* file_actions, int fd, const char* path, int flags, mode_t mode)
+{
+    if (fd < 0) {
+        return EBADF;
+    }
+
+    struct __spawn_action* action = _spawn_file_actions_add(file_actions);
+    if (!action) {
+        return ENOMEM;
+    }
+    action->type = __SPAWN_ACTION_OPEN;
+    action->fd = fd;
+    action->path = path;
+    action->flags = flags;
+    action->mode = mode;
+    return 0;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t* file_actions, int fd)
+{
+    if (fd < 0) {
+        return EBADF;
+    }
+
+    struct __spawn_action* action = _spawn_file_actions_add(file_actions);
+    if (!action) {
+        return ENOMEM;
+    }
+    action->type = __SPAWN_ACTION_CLOSE;
+    action->fd = fd;
+    return 0;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t* file_actions, int fd, int newfd)
+{
+    if (fd < 0 || newfd < 0) {
+        return EBADF;
+    }
+
+    struct __spawn_action* action = _spawn_file_actions_add(file_actions);
+    if (!action) {
+        return ENOMEM;
+    }
+    action->type = __SPAWN_ACTION_DUP2;
+    action->fd = fd;
+    action->newfd = newfd;
+    return 0;
+}
+
+/**
+ * ATTRIBUTES
+ */
+
+int posix_spawnattr_init(posix_spawnattr_t* attr)
+{
+    attr->flags = 0;
+    attr->pgroup = 0;
+    return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t* attr)
+{
+    return 0;
+}
+
+int posix_spawnattr_getflags(const posix_spawnattr_t* attr, short* flags)
+{
+    *flags = attr->flags;
+    return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t* attr, short flags)
+{
+    if (flags & ~POSIX_SPAWN_SETPGROUP) {
+        return EINVAL;
+    }
+    attr->flags = flags;
+    return 0;
+}
+
+int posix_spawnattr_getpgroup(const posix_spawnattr_t* attr, pid_t* pgroup)
+{
+    *pgroup = attr->pgroup;
+    return 0;
+}
+
+int posix_spawnattr_setpgroup(posix_spawnattr_t* attr, pid_t pgroup)
+{
+    attr->pgroup = pgroup;
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include <sys/time.h>
 #include <sysdep.h>
+#include <unistd.h>
 
 int nanosleep(const timespec_t* req, timespec_t* rem)
 {
@@ -7,6 +8,11 @@ int nanosleep(const timespec_t* req, timespec_t* rem)
     RETURN_WITH_ERRNO(res, 0, -1);
 }
 
+unsigned int alarm(unsigned int seconds)
+{
+    return (unsigned int)DO_SYSCALL_1(SYS_ALARM, seconds);
+}
+
 int gettimeofday(timeval_t* tv, timezone_t* tz)
 {
     int res = DO_SYSCALL_2(SYS_GETTIMEOFDAY, tv, tz);
@@ -0,0 +1,46 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char** argv)
+{
+    cpu_set_t orig;
+    if (sched_getaffinity(0, sizeof(orig), &orig) != 0) {
+        TestErr("Can't get affinity");
+    }
+    if (!CPU_ISSET(0, &orig)) {
+        TestErr("Boot cpu is not in the default mask");
+    }
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(0, &mask);
+    if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+        TestErr("Can't pin to the boot cpu");
+    }
+
+    // The thread is moved to the boot cpu, so it still runs after a yield.
+    sched_yield();
+
+    cpu_set_t res;
+    if (sched_getaffinity(0, sizeof(res), &res) != 0) {
+        TestErr("Can't get affinity");
+    }
+    if (res.bits != mask.bits) {
+        TestErr("Affinity is not the one which was set");
+    }
+
+    CPU_ZERO(&mask);
+    if (sched_setaffinity(0, sizeof(mask), &mask) == 0) {
+        TestErr("Empty mask was accepted");
+    }
+    if (sched_getaffinity(0, sizeof(res), &res) != 0 || res.bits != (1u << 0)) {
+        TestErr("Affinity changed after a failed call");
+    }
+
+    if (sched_setaffinity(0, sizeof(orig), &orig) != 0) {
+        TestErr("Can't restore affinity");
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Tests are run with uid 10, while init is run by root.
+const pid_t root_pid = 1;
+
+int main(int argc, char** argv)
+{
+    struct sched_param param = { .sched_priority = SCHED_RT_PRIO_MIN };
+    if (sched_setscheduler(0, SCHED_FIFO, &param) == 0) {
+        TestErr("Unprivileged process became SCHED_FIFO");
+    }
+    if (sched_setscheduler(0, SCHED_RR, &param) == 0) {
+        TestErr("Unprivileged process became SCHED_RR");
+    }
+    if (sched_getscheduler(0) != SCHED_OTHER) {
+        TestErr("Policy changed after a failed call");
+    }
+
+    param.sched_priority = 0;
+    if (sched_setscheduler(0, SCHED_OTHER, &param) != 0) {
+        TestErr("Can't set SCHED_OTHER for itself");
+    }
+    if (sched_setparam(0, &param) != 0) {
+        TestErr("Can't set params for itself");
+    }
+
+    if (sched_setscheduler(root_pid, SCHED_OTHER, &param) == 0) {
+        TestErr("Changed policy of a process of another user");
+    }
+    if (sched_setparam(root_pid, &param) == 0) {
+        TestErr("Changed params of a process of another user");
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const int child_exit_code = 42;
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "child") == 0) {
+        return child_exit_code;
+    }
+
+    // The test spawns itself to get a child with a known exit code.
+    char* child_argv[] = { argv[0], "child", NULL };
+    pid_t pid = 0;
+    if (posix_spawn(&pid, argv[0], NULL, NULL, child_argv, environ) != 0) {
+        TestErr("Can't spawn a child");
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (status != child_exit_code) {
+        TestErr("Wrong exit code of a child");
+    }
+
+    // A failed exec makes the child exit with 127, it's reported as an error.
+    char* missing_argv[] = { "/test_bin/nonexistent", NULL };
+    if (posix_spawn(&pid, missing_argv[0], NULL, NULL, missing_argv, environ) != ENOENT) {
+        TestErr("Spawned a missing file");
+    }
+
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+    posix_spawn_file_actions_adddup2(&file_actions, 1000, 1001);
+    if (posix_spawn(&pid, argv[0], &file_actions, NULL, child_argv, environ) != EBADF) {
+        TestErr("Spawned a child with a failed file action");
+    }
+    posix_spawn_file_actions_destroy(&file_actions);
+    return 0;
+}
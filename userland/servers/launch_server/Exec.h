@@ -1,6 +1,8 @@
 #pragma once
 
 #include <csignal>
+#include <cstdlib>
+#include <spawn.h>
 #include <string>
 #include <unistd.h>
 #include <vector>
@@ -23,10 +25,10 @@ public:
 
     void launch()
     {
-        m_pid = fork();
-        if (m_pid == 0) {
-            execlp(m_path.c_str(), m_path.c_str(), NULL);
-            std::abort();
+        char* const argv[] = { const_cast<char*>(m_path.c_str()), nullptr };
+        pid_t pid;
+        if (posix_spawnp(&pid, m_path.c_str(), nullptr, nullptr, argv, environ) == 0) {
+            m_pid = pid;
         }
     }
 